@@ -0,0 +1,49 @@
+#include "animated_gif.h"
+
+#include "mapped_file.h"
+
+#pragma warning(push,3)
+#include <stb_image.h>
+#pragma warning(pop)
+
+#include <climits>
+#include <cstdio>
+#include <cstring>
+
+bool IsGifData(const uint8_t* data, size_t size) {
+    return size >= 6 && (memcmp(data, "GIF87a", 6) == 0 || memcmp(data, "GIF89a", 6) == 0);
+}
+
+bool IsGifFile(const std::string& filename) {
+    FILE* f = fopen(filename.c_str(), "rb");
+    if (!f) {
+        return false;
+    }
+    uint8_t signature[6] = {};
+    const bool is_gif = IsGifData(signature, fread(signature, 1, 6, f));
+    fclose(f);
+    return is_gif;
+}
+
+GifFrames::~GifFrames() {
+    stbi_image_free(m_pixels);
+}
+
+bool GifFrames::Load(const std::string& filename) {
+    MappedFile file;
+    return file.Open(filename) && LoadFromMemory(file.data(), file.size());
+}
+
+bool GifFrames::LoadFromMemory(const uint8_t* data, size_t size) {
+    if (size > INT_MAX || !stbi_info_from_memory(data, (int)size, &m_width, &m_height, &m_components)) {
+        return false;
+    }
+    int width = 0, height = 0, components = 0;
+    m_pixels = stbi_load_gif_from_memory(data, (int)size, nullptr, &width, &height, &m_frame_count,
+            &components, 4);
+    return m_pixels && width == m_width && height == m_height && m_frame_count > 0;
+}
+
+bool GifFrames::SameAsPreviousFrame(int frame) const {
+    return frame > 0 && memcmp(Frame(frame), Frame(frame - 1), (size_t)m_width * m_height * 4) == 0;
+}
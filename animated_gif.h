@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Every frame of a GIF, decoded in one pass. stb_image composites each frame
+// onto the full canvas, so every frame is a complete image of the same size
+// and can become one array layer, without extracting the frames to separate
+// files first.
+
+// Returns true if the size bytes at data (or the file filename) start with a
+// GIF signature.
+bool IsGifData(const uint8_t* data, size_t size);
+bool IsGifFile(const std::string& filename);
+
+class GifFrames {
+public:
+    GifFrames() = default;
+    ~GifFrames();
+    GifFrames(const GifFrames&) = delete;
+    GifFrames& operator=(const GifFrames&) = delete;
+
+    // Decodes every frame of filename to RGBA. Returns false on failure.
+    bool Load(const std::string& filename);
+    // Same, for a GIF file already in memory.
+    bool LoadFromMemory(const uint8_t* data, size_t size);
+
+    int Width() const { return m_width; }
+    int Height() const { return m_height; }
+    int Components() const { return m_components; }  // as reported by stbi_info
+    int FrameCount() const { return m_frame_count; }
+    // Width() x Height() RGBA pixels, tightly packed.
+    const uint8_t* Frame(int frame) const { return m_pixels + (size_t)frame * m_width * m_height * 4; }
+    // True if frame is identical to the frame before it.
+    bool SameAsPreviousFrame(int frame) const;
+
+private:
+    uint8_t* m_pixels = nullptr;
+    int m_width = 0, m_height = 0, m_components = 0, m_frame_count = 0;
+};
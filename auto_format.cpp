@@ -0,0 +1,252 @@
+#include "auto_format.h"
+
+#include "bc_encoder.h"
+#include "cpu_features.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(IMG2KTX_X86)
+#include <immintrin.h>
+#endif
+#if defined(IMG2KTX_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// Adds the squared differences of every channel of two runs of RGBA pixels to
+// *sum. Color channels of pixels whose reference alpha is 0 are invisible, so
+// they do not count. Each kernel handles a prefix of the pixels and returns
+// how many it summed.
+typedef int (*SquaredErrorFunc)(const uint8_t* reference, const uint8_t* test, int pixel_count, uint64_t* sum);
+
+int SquaredErrorScalar(const uint8_t* reference, const uint8_t* test, int pixel_count, uint64_t* sum) {
+    uint64_t total = 0;
+    for(int i = 0; i < pixel_count * 4; ++i) {
+        if ((i & 3) != 3 && reference[i | 3] == 0) {
+            continue;
+        }
+        const int diff = reference[i] - test[i];
+        total += diff * diff;
+    }
+    *sum += total;
+    return pixel_count;
+}
+
+// Lanes of the 32-bit accumulators gain at most 4 * 255^2 per iteration, so
+// they are flushed to 64 bits before this many iterations.
+const int kSquaredErrorFlushIterations = 4096;
+
+#if defined(IMG2KTX_X86)
+// 4 pixels per iteration: absolute differences as max - min with saturating
+// subtracts, widened to 16 bits and squared and paired up by madd.
+IMG2KTX_TARGET("sse2")
+int SquaredErrorSse2(const uint8_t* reference, const uint8_t* test, int pixel_count, uint64_t* sum) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha_bits = _mm_set1_epi32((int)0xFF000000);
+    __m128i total = zero;
+    int x = 0;
+    while (x + 4 <= pixel_count) {
+        const int end = std::min(pixel_count & ~3, x + 4 * kSquaredErrorFlushIterations);
+        __m128i acc = zero;
+        for(; x < end; x += 4) {
+            const __m128i r = _mm_loadu_si128((const __m128i*)(reference + x * 4));
+            const __m128i t = _mm_loadu_si128((const __m128i*)(test + x * 4));
+            const __m128i transparent = _mm_cmpeq_epi32(_mm_and_si128(r, alpha_bits), zero);
+            __m128i d = _mm_or_si128(_mm_subs_epu8(r, t), _mm_subs_epu8(t, r));
+            d = _mm_andnot_si128(_mm_andnot_si128(alpha_bits, transparent), d);
+            const __m128i lo = _mm_unpacklo_epi8(d, zero);
+            const __m128i hi = _mm_unpackhi_epi8(d, zero);
+            acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+        }
+        total = _mm_add_epi64(total, _mm_add_epi64(_mm_unpacklo_epi32(acc, zero), _mm_unpackhi_epi32(acc, zero)));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, total);
+    *sum += lanes[0] + lanes[1];
+    return x;
+}
+
+// Same as the SSE2 kernel, 8 pixels per iteration.
+IMG2KTX_TARGET("avx2")
+int SquaredErrorAvx2(const uint8_t* reference, const uint8_t* test, int pixel_count, uint64_t* sum) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alpha_bits = _mm256_set1_epi32((int)0xFF000000);
+    __m256i total = zero;
+    int x = 0;
+    while (x + 8 <= pixel_count) {
+        const int end = std::min(pixel_count & ~7, x + 8 * kSquaredErrorFlushIterations);
+        __m256i acc = zero;
+        for(; x < end; x += 8) {
+            const __m256i r = _mm256_loadu_si256((const __m256i*)(reference + x * 4));
+            const __m256i t = _mm256_loadu_si256((const __m256i*)(test + x * 4));
+            const __m256i transparent = _mm256_cmpeq_epi32(_mm256_and_si256(r, alpha_bits), zero);
+            __m256i d = _mm256_or_si256(_mm256_subs_epu8(r, t), _mm256_subs_epu8(t, r));
+            d = _mm256_andnot_si256(_mm256_andnot_si256(alpha_bits, transparent), d);
+            const __m256i lo = _mm256_unpacklo_epi8(d, zero);
+            const __m256i hi = _mm256_unpackhi_epi8(d, zero);
+            acc = _mm256_add_epi32(acc, _mm256_add_epi32(_mm256_madd_epi16(lo, lo), _mm256_madd_epi16(hi, hi)));
+        }
+        total = _mm256_add_epi64(total,
+                _mm256_add_epi64(_mm256_unpacklo_epi32(acc, zero), _mm256_unpackhi_epi32(acc, zero)));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, total);
+    *sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    return x;
+}
+#endif  // IMG2KTX_X86
+
+#if defined(IMG2KTX_NEON)
+// 4 pixels per iteration, with vabdq for the differences and widening
+// multiplies and pairwise adds for the sums.
+int SquaredErrorNeon(const uint8_t* reference, const uint8_t* test, int pixel_count, uint64_t* sum) {
+    const uint32x4_t alpha_bits = vdupq_n_u32(0xFF000000u);
+    uint64x2_t total = vdupq_n_u64(0);
+    int x = 0;
+    while (x + 4 <= pixel_count) {
+        const int end = std::min(pixel_count & ~3, x + 4 * kSquaredErrorFlushIterations);
+        uint32x4_t acc = vdupq_n_u32(0);
+        for(; x < end; x += 4) {
+            const uint8x16_t r = vld1q_u8(reference + x * 4);
+            const uint8x16_t t = vld1q_u8(test + x * 4);
+            const uint32x4_t transparent = vceqq_u32(vandq_u32(vreinterpretq_u32_u8(r), alpha_bits), vdupq_n_u32(0));
+            const uint8x16_t d = vbicq_u8(vabdq_u8(r, t), vreinterpretq_u8_u32(vbicq_u32(transparent, alpha_bits)));
+            acc = vpadalq_u16(acc, vmull_u8(vget_low_u8(d), vget_low_u8(d)));
+            acc = vpadalq_u16(acc, vmull_u8(vget_high_u8(d), vget_high_u8(d)));
+        }
+        total = vpadalq_u32(total, acc);
+    }
+    *sum += vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1);
+    return x;
+}
+#endif  // IMG2KTX_NEON
+
+SquaredErrorFunc SelectSquaredError() {
+#if defined(IMG2KTX_X86)
+    const CpuFeatures& cpu = GetCpuFeatures();
+    if (cpu.avx2) {
+        return SquaredErrorAvx2;
+    }
+    if (cpu.sse2) {
+        return SquaredErrorSse2;
+    }
+#elif defined(IMG2KTX_NEON)
+    return SquaredErrorNeon;
+#endif
+    return SquaredErrorScalar;
+}
+
+const GlFormatInfo* FindFormat(const char* name) {
+    for(size_t f = 0; f < g_format_count; ++f) {
+        if (strcmp(g_formats[f].name, name) == 0) {
+            return g_formats + f;
+        }
+    }
+    return nullptr;
+}
+
+// Encodes and decodes the sample in a BC format. Returns 99 if it is lossless,
+// as the benchmark does.
+double MeasurePsnr(const AutoFormatSample& sample, const GlFormatInfo* format_info, int original_components,
+        EncoderQuality quality) {
+    BcFormat bc_format = kBcFormatBC1;
+    FindBcFormat(format_info->name, &bc_format);
+    const int block_count = sample.BlockCount();
+    const int pixel_count = block_count * 16;
+    rgba_surface surface;
+    surface.ptr = const_cast<uint8_t*>(sample.Blocks());
+    surface.width = 4;
+    surface.height = block_count * 4;
+    surface.stride = 16;
+    std::vector<uint8_t> blocks((size_t)block_count * format_info->block_bytes);
+    CompressSurface(&surface, blocks.data(), format_info, original_components, quality);
+    std::vector<uint8_t> decoded((size_t)pixel_count * 4);
+    DecodeBcBlocks(blocks.data(), 1, block_count, bc_format, decoded.data(), 16);
+
+    static const SquaredErrorFunc squared_error = SelectSquaredError();
+    uint64_t sum = 0;
+    const int done = squared_error(sample.Blocks(), decoded.data(), pixel_count, &sum);
+    SquaredErrorScalar(sample.Blocks() + done * 4, decoded.data() + done * 4, pixel_count - done, &sum);
+    if (sum == 0) {
+        return 99.0;
+    }
+    const int channels = sample.Opaque() ? 3 : 4;
+    return 10.0 * log10(255.0 * 255.0 * pixel_count * channels / (double)sum);
+}
+
+}  // namespace
+
+void AutoFormatSample::AddImage(const uint8_t* pixels, int width, int height, size_t row_pitch, int max_blocks) {
+    // Opaque implies binary alpha, so the scan can stop at the first other value.
+    for(int y = 0; y < height && m_binary_alpha; ++y) {
+        const uint8_t* row = pixels + (size_t)y * row_pitch;
+        for(int x = 0; x < width && m_binary_alpha; ++x) {
+            const uint8_t alpha = row[x * 4 + 3];
+            m_opaque = m_opaque && alpha == 255;
+            m_binary_alpha = alpha == 0 || alpha == 255;
+        }
+    }
+
+    // One block from the middle of each cell of a grid with about max_blocks
+    // cells, shaped like the image so that samples cover it evenly.
+    const int blocks_x = (width + 3) / 4, blocks_y = (height + 3) / 4;
+    const double cell = sqrt((double)blocks_x * blocks_y / std::max(max_blocks, 1));
+    const int grid_x = std::max(1, std::min(blocks_x, (int)(blocks_x / cell)));
+    const int grid_y = std::max(1, std::min(blocks_y, std::max(max_blocks, 1) / grid_x));
+    const size_t offset = m_blocks.size();
+    m_blocks.resize(offset + (size_t)grid_x * grid_y * 64);
+    for(int gy = 0; gy < grid_y; ++gy) {
+        const int by = (int)((2LL * gy + 1) * blocks_y / (2 * grid_y));
+        for(int gx = 0; gx < grid_x; ++gx) {
+            const int bx = (int)((2LL * gx + 1) * blocks_x / (2 * grid_x));
+            uint8_t* dst = m_blocks.data() + offset + (size_t)(gy * grid_x + gx) * 64;
+            for(int y = 0; y < 4; ++y) {
+                const int sy = std::min(by * 4 + y, height - 1);
+                for(int x = 0; x < 4; ++x) {
+                    const int sx = std::min(bx * 4 + x, width - 1);
+                    memcpy(dst + (y * 4 + x) * 4, pixels + (size_t)sy * row_pitch + sx * 4, 4);
+                }
+            }
+        }
+    }
+}
+
+void AutoFormatSample::Append(const AutoFormatSample& other) {
+    m_blocks.insert(m_blocks.end(), other.m_blocks.begin(), other.m_blocks.end());
+    m_opaque = m_opaque && other.m_opaque;
+    m_binary_alpha = m_binary_alpha && other.m_binary_alpha;
+}
+
+const GlFormatInfo* ChooseAutoFormat(const AutoFormatSample& sample, int original_components,
+        EncoderQuality quality, double target_psnr, std::vector<AutoFormatTrial>* trials) {
+    trials->clear();
+    std::vector<const char*> candidates;
+    if (sample.Opaque()) {
+        candidates.push_back("BC1");  // BC3 would add nothing but an opaque alpha block
+    } else {
+        if (sample.BinaryAlpha()) {
+            candidates.push_back("BC1a");
+        }
+        candidates.push_back("BC3");
+    }
+    for(const char* name : candidates) {
+        const GlFormatInfo* format_info = FindFormat(name);
+        const AutoFormatTrial trial = { format_info,
+            MeasurePsnr(sample, format_info, original_components, quality), true };
+        trials->push_back(trial);
+        if (trial.psnr >= target_psnr) {
+            return format_info;
+        }
+    }
+    const GlFormatInfo* bc7 = FindFormat("BC7");
+    if (FormatAvailable(bc7)) {
+        trials->push_back(AutoFormatTrial{ bc7, 0, false });
+        return bc7;
+    }
+    const GlFormatInfo* rgba = FindFormat("RGBA");
+    trials->push_back(AutoFormatTrial{ rgba, 99.0, true });
+    return rgba;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "encoders.h"
+
+#include <cstdint>
+#include <vector>
+
+// -f auto: picks the output format with the fewest bits per pixel whose error
+// on a sample of the input's blocks meets a PSNR target. Only formats that
+// keep all of RGBA are candidates, smallest first: BC1 for opaque inputs,
+// BC1a if every alpha is 0 or 255 (4 bits per pixel), then BC3 if there is
+// alpha (8 bits per pixel). Each is measured by encoding the sample with
+// CompressSurface() and decoding it with DecodeBcBlocks(). If none meets the
+// target, the result is BC7, whose error is not measured because img2ktx has
+// no BC7 decoder, or RGBA when BC7 is unavailable. ASTC is never chosen, for
+// the same reason.
+
+const double kDefaultAutoFormatPsnr = 40.0;
+
+// Evenly spaced 4x4 blocks from every layer of a job, plus whether the whole
+// of each layer is opaque.
+class AutoFormatSample {
+public:
+    // Adds up to max_blocks blocks of an RGBA image with rows row_pitch bytes
+    // apart, and scans all of its alpha. Blocks that extend past the edges replicate the last
+    // row and column, as PadSurfaceEdges() does.
+    void AddImage(const uint8_t* pixels, int width, int height, size_t row_pitch, int max_blocks);
+    void Append(const AutoFormatSample& other);
+
+    int BlockCount() const { return (int)(m_blocks.size() / 64); }
+    // The blocks, 64 bytes each: a 4-pixel-wide surface, one block per block row.
+    const uint8_t* Blocks() const { return m_blocks.data(); }
+    bool Opaque() const { return m_opaque; }  // every alpha is 255
+    bool BinaryAlpha() const { return m_binary_alpha; }  // every alpha is 0 or 255
+
+private:
+    std::vector<uint8_t> m_blocks;
+    bool m_opaque = true;
+    bool m_binary_alpha = true;
+};
+
+struct AutoFormatTrial {
+    const GlFormatInfo* format_info;
+    double psnr;  // on the sample, over RGB (and alpha, if not opaque); 99 if lossless
+    bool measured;
+};
+
+// Tries the candidates for sample in order and returns the chosen format.
+// trials receives every candidate tried; the last one is the choice.
+const GlFormatInfo* ChooseAutoFormat(const AutoFormatSample& sample, int original_components,
+        EncoderQuality quality, double target_psnr, std::vector<AutoFormatTrial>* trials);
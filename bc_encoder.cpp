@@ -0,0 +1,399 @@
+#include "bc_encoder.h"
+
+#include "cpu_features.h"
+#include "ispc_texcomp.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#if defined(IMG2KTX_X86)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Each kernel returns a block as kBcWords 32-bit words, which WriteBlock()
+// lays out in the format's byte order.
+enum {
+    kBcWordColors,      // color0 | color1 << 16
+    kBcWordColorBits,   // 2-bit indices
+    kBcWordChannel0,    // endpoint0 | endpoint1 << 8, then the 3-bit indices of pixels 0-7 and 8-15
+    kBcWordChannel1 = kBcWordChannel0 + 3,
+    kBcWords = kBcWordChannel1 + 3,
+};
+
+void PutLe16(uint8_t* dst, uint32_t value) {
+    dst[0] = (uint8_t)value;
+    dst[1] = (uint8_t)(value >> 8);
+}
+
+void PutLe32(uint8_t* dst, uint32_t value) {
+    PutLe16(dst, value);
+    PutLe16(dst + 2, value >> 16);
+}
+
+void WriteColorBlock(const uint32_t* words, uint8_t* dst) {
+    PutLe32(dst, words[kBcWordColors]);
+    PutLe32(dst + 4, words[kBcWordColorBits]);
+}
+
+void WriteChannelBlock(const uint32_t* words, uint8_t* dst) {
+    PutLe16(dst, words[0]);
+    PutLe16(dst + 2, words[1]);
+    dst[4] = (uint8_t)(words[1] >> 16);
+    PutLe16(dst + 5, words[2]);
+    dst[7] = (uint8_t)(words[2] >> 16);
+}
+
+void WriteBlock(BcFormat format, const uint32_t* words, uint8_t* dst) {
+    switch(format) {
+    case kBcFormatBC1:
+    case kBcFormatBC1a:
+        WriteColorBlock(words, dst);
+        break;
+    case kBcFormatBC3:
+        WriteChannelBlock(words + kBcWordChannel0, dst);
+        WriteColorBlock(words, dst + 8);
+        break;
+    case kBcFormatBC4:
+        WriteChannelBlock(words + kBcWordChannel0, dst);
+        break;
+    case kBcFormatBC5:
+        WriteChannelBlock(words + kBcWordChannel0, dst);
+        WriteChannelBlock(words + kBcWordChannel1, dst + 8);
+        break;
+    }
+}
+
+uint32_t LoadPixel(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+}  // namespace
+
+// Portable fallback: one block at a time.
+namespace bc_scalar {
+const int kLanes = 1;
+struct VF { float v; };
+struct VI { int32_t v; };
+struct VM { bool v; };
+#define IMG2KTX_BC_KERNEL
+inline VF Splat(float x) { return { x }; }
+inline VI SplatInt(int32_t x) { return { x }; }
+inline VF operator+(VF a, VF b) { return { a.v + b.v }; }
+inline VF operator-(VF a, VF b) { return { a.v - b.v }; }
+inline VF operator*(VF a, VF b) { return { a.v * b.v }; }
+inline VF operator/(VF a, VF b) { return { a.v / b.v }; }
+inline VF Min(VF a, VF b) { return { a.v < b.v ? a.v : b.v }; }  // as minps/maxps: b unless a wins
+inline VF Max(VF a, VF b) { return { a.v > b.v ? a.v : b.v }; }
+inline VF Floor(VF a) {  // inputs are far below 2^31
+    const float truncated = (float)(int32_t)a.v;
+    return { truncated > a.v ? truncated - 1.0f : truncated };
+}
+inline VM operator<(VF a, VF b) { return { a.v < b.v }; }
+inline VM operator>(VF a, VF b) { return { a.v > b.v }; }
+inline VM operator==(VF a, VF b) { return { a.v == b.v }; }
+inline VM operator&(VM a, VM b) { return { a.v && b.v }; }
+inline bool Any(VM m) { return m.v; }
+inline VF Select(VM m, VF a, VF b) { return m.v ? a : b; }
+inline VI Select(VM m, VI a, VI b) { return m.v ? a : b; }
+inline VI operator|(VI a, VI b) { return { a.v | b.v }; }
+inline VI operator&(VI a, VI b) { return { a.v & b.v }; }
+inline VI operator<<(VI a, int n) { return { (int32_t)((uint32_t)a.v << n) }; }
+inline VI operator>>(VI a, int n) { return { (int32_t)((uint32_t)a.v >> n) }; }
+inline VI ToInt(VF a) { return { (int32_t)a.v }; }
+inline VF ToFloat(VI a) { return { (float)a.v }; }
+inline VI GatherPixels(const uint8_t* base, const int32_t* offsets) { return { (int32_t)LoadPixel(base + offsets[0]) }; }
+inline void Store(int32_t* dst, VI a) { dst[0] = a.v; }
+#include "bc_encoder_kernel.inl"
+#undef IMG2KTX_BC_KERNEL
+}  // namespace bc_scalar
+
+#if defined(IMG2KTX_X86)
+
+namespace bc_sse41 {
+const int kLanes = 4;
+struct VF { __m128 v; };
+struct VI { __m128i v; };
+struct VM { __m128 v; };
+#define IMG2KTX_BC_KERNEL IMG2KTX_TARGET("sse4.1")
+IMG2KTX_BC_KERNEL inline VF Splat(float x) { return { _mm_set1_ps(x) }; }
+IMG2KTX_BC_KERNEL inline VI SplatInt(int32_t x) { return { _mm_set1_epi32(x) }; }
+IMG2KTX_BC_KERNEL inline VF operator+(VF a, VF b) { return { _mm_add_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VF operator-(VF a, VF b) { return { _mm_sub_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VF operator*(VF a, VF b) { return { _mm_mul_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VF operator/(VF a, VF b) { return { _mm_div_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VF Min(VF a, VF b) { return { _mm_min_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VF Max(VF a, VF b) { return { _mm_max_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VF Floor(VF a) { return { _mm_floor_ps(a.v) }; }
+IMG2KTX_BC_KERNEL inline VM operator<(VF a, VF b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VM operator>(VF a, VF b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VM operator==(VF a, VF b) { return { _mm_cmpeq_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VM operator&(VM a, VM b) { return { _mm_and_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline bool Any(VM m) { return _mm_movemask_ps(m.v) != 0; }
+IMG2KTX_BC_KERNEL inline VF Select(VM m, VF a, VF b) { return { _mm_blendv_ps(b.v, a.v, m.v) }; }
+IMG2KTX_BC_KERNEL inline VI Select(VM m, VI a, VI b) {
+    return { _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(b.v), _mm_castsi128_ps(a.v), m.v)) };
+}
+IMG2KTX_BC_KERNEL inline VI operator|(VI a, VI b) { return { _mm_or_si128(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VI operator&(VI a, VI b) { return { _mm_and_si128(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VI operator<<(VI a, int n) { return { _mm_slli_epi32(a.v, n) }; }
+IMG2KTX_BC_KERNEL inline VI operator>>(VI a, int n) { return { _mm_srli_epi32(a.v, n) }; }
+IMG2KTX_BC_KERNEL inline VI ToInt(VF a) { return { _mm_cvttps_epi32(a.v) }; }
+IMG2KTX_BC_KERNEL inline VF ToFloat(VI a) { return { _mm_cvtepi32_ps(a.v) }; }
+IMG2KTX_BC_KERNEL inline VI GatherPixels(const uint8_t* base, const int32_t* offsets) {
+    int32_t pixels[4];
+    for(int lane = 0; lane < 4; ++lane) {
+        memcpy(&pixels[lane], base + offsets[lane], 4);
+    }
+    return { _mm_loadu_si128((const __m128i*)pixels) };
+}
+IMG2KTX_BC_KERNEL inline void Store(int32_t* dst, VI a) { _mm_storeu_si128((__m128i*)dst, a.v); }
+#include "bc_encoder_kernel.inl"
+#undef IMG2KTX_BC_KERNEL
+}  // namespace bc_sse41
+
+namespace bc_avx2 {
+const int kLanes = 8;
+struct VF { __m256 v; };
+struct VI { __m256i v; };
+struct VM { __m256 v; };
+#define IMG2KTX_BC_KERNEL IMG2KTX_TARGET("avx2")
+IMG2KTX_BC_KERNEL inline VF Splat(float x) { return { _mm256_set1_ps(x) }; }
+IMG2KTX_BC_KERNEL inline VI SplatInt(int32_t x) { return { _mm256_set1_epi32(x) }; }
+IMG2KTX_BC_KERNEL inline VF operator+(VF a, VF b) { return { _mm256_add_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VF operator-(VF a, VF b) { return { _mm256_sub_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VF operator*(VF a, VF b) { return { _mm256_mul_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VF operator/(VF a, VF b) { return { _mm256_div_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VF Min(VF a, VF b) { return { _mm256_min_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VF Max(VF a, VF b) { return { _mm256_max_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VF Floor(VF a) { return { _mm256_floor_ps(a.v) }; }
+IMG2KTX_BC_KERNEL inline VM operator<(VF a, VF b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+IMG2KTX_BC_KERNEL inline VM operator>(VF a, VF b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+IMG2KTX_BC_KERNEL inline VM operator==(VF a, VF b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ) }; }
+IMG2KTX_BC_KERNEL inline VM operator&(VM a, VM b) { return { _mm256_and_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline bool Any(VM m) { return _mm256_movemask_ps(m.v) != 0; }
+IMG2KTX_BC_KERNEL inline VF Select(VM m, VF a, VF b) { return { _mm256_blendv_ps(b.v, a.v, m.v) }; }
+IMG2KTX_BC_KERNEL inline VI Select(VM m, VI a, VI b) {
+    return { _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(b.v), _mm256_castsi256_ps(a.v), m.v)) };
+}
+IMG2KTX_BC_KERNEL inline VI operator|(VI a, VI b) { return { _mm256_or_si256(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VI operator&(VI a, VI b) { return { _mm256_and_si256(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VI operator<<(VI a, int n) { return { _mm256_slli_epi32(a.v, n) }; }
+IMG2KTX_BC_KERNEL inline VI operator>>(VI a, int n) { return { _mm256_srli_epi32(a.v, n) }; }
+IMG2KTX_BC_KERNEL inline VI ToInt(VF a) { return { _mm256_cvttps_epi32(a.v) }; }
+IMG2KTX_BC_KERNEL inline VF ToFloat(VI a) { return { _mm256_cvtepi32_ps(a.v) }; }
+IMG2KTX_BC_KERNEL inline VI GatherPixels(const uint8_t* base, const int32_t* offsets) {
+    return { _mm256_i32gather_epi32((const int*)base, _mm256_load_si256((const __m256i*)offsets), 1) };
+}
+IMG2KTX_BC_KERNEL inline void Store(int32_t* dst, VI a) { _mm256_storeu_si256((__m256i*)dst, a.v); }
+#include "bc_encoder_kernel.inl"
+#undef IMG2KTX_BC_KERNEL
+}  // namespace bc_avx2
+
+// AVX-512 F only: BcKernelSupported() checks the same feature set.
+namespace bc_avx512 {
+const int kLanes = 16;
+struct VF { __m512 v; };
+struct VI { __m512i v; };
+struct VM { __mmask16 v; };
+#define IMG2KTX_BC_KERNEL IMG2KTX_TARGET("avx512f")
+IMG2KTX_BC_KERNEL inline VF Splat(float x) { return { _mm512_set1_ps(x) }; }
+IMG2KTX_BC_KERNEL inline VI SplatInt(int32_t x) { return { _mm512_set1_epi32(x) }; }
+IMG2KTX_BC_KERNEL inline VF operator+(VF a, VF b) { return { _mm512_add_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VF operator-(VF a, VF b) { return { _mm512_sub_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VF operator*(VF a, VF b) { return { _mm512_mul_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VF operator/(VF a, VF b) { return { _mm512_div_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VF Min(VF a, VF b) { return { _mm512_min_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VF Max(VF a, VF b) { return { _mm512_max_ps(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VF Floor(VF a) {
+    return { _mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC) };
+}
+IMG2KTX_BC_KERNEL inline VM operator<(VF a, VF b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ) }; }
+IMG2KTX_BC_KERNEL inline VM operator>(VF a, VF b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ) }; }
+IMG2KTX_BC_KERNEL inline VM operator==(VF a, VF b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_EQ_OQ) }; }
+IMG2KTX_BC_KERNEL inline VM operator&(VM a, VM b) { return { (__mmask16)(a.v & b.v) }; }
+IMG2KTX_BC_KERNEL inline bool Any(VM m) { return m.v != 0; }
+IMG2KTX_BC_KERNEL inline VF Select(VM m, VF a, VF b) { return { _mm512_mask_blend_ps(m.v, b.v, a.v) }; }
+IMG2KTX_BC_KERNEL inline VI Select(VM m, VI a, VI b) { return { _mm512_mask_blend_epi32(m.v, b.v, a.v) }; }
+IMG2KTX_BC_KERNEL inline VI operator|(VI a, VI b) { return { _mm512_or_si512(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VI operator&(VI a, VI b) { return { _mm512_and_si512(a.v, b.v) }; }
+IMG2KTX_BC_KERNEL inline VI operator<<(VI a, int n) { return { _mm512_slli_epi32(a.v, n) }; }
+IMG2KTX_BC_KERNEL inline VI operator>>(VI a, int n) { return { _mm512_srli_epi32(a.v, n) }; }
+IMG2KTX_BC_KERNEL inline VI ToInt(VF a) { return { _mm512_cvttps_epi32(a.v) }; }
+IMG2KTX_BC_KERNEL inline VF ToFloat(VI a) { return { _mm512_cvtepi32_ps(a.v) }; }
+IMG2KTX_BC_KERNEL inline VI GatherPixels(const uint8_t* base, const int32_t* offsets) {
+    return { _mm512_i32gather_epi32(_mm512_load_si512(offsets), base, 1) };
+}
+IMG2KTX_BC_KERNEL inline void Store(int32_t* dst, VI a) { _mm512_storeu_si512(dst, a.v); }
+#include "bc_encoder_kernel.inl"
+#undef IMG2KTX_BC_KERNEL
+}  // namespace bc_avx512
+
+#endif  // IMG2KTX_X86
+
+namespace {
+
+typedef void (*EncodeBlocksFunc)(const rgba_surface* src, uint8_t* dst, BcFormat format);
+
+EncodeBlocksFunc KernelFunc(BcKernel kernel) {
+    switch(kernel) {
+#if defined(IMG2KTX_X86)
+    case kBcKernelSse41:  return bc_sse41::EncodeBlocks;
+    case kBcKernelAvx2:   return bc_avx2::EncodeBlocks;
+    case kBcKernelAvx512: return bc_avx512::EncodeBlocks;
+#endif
+    default:              return bc_scalar::EncodeBlocks;
+    }
+}
+
+BcKernel BestBcKernel() {
+    for(int k = kBcKernelCount - 1; k > kBcKernelScalar; --k) {
+        if (BcKernelSupported((BcKernel)k)) {
+            return (BcKernel)k;
+        }
+    }
+    return kBcKernelScalar;
+}
+
+std::atomic<int> g_forced_kernel(kBcKernelCount);  // kBcKernelCount: not forced
+
+const char* const kBcKernelNames[kBcKernelCount] = { "scalar", "sse4.1", "avx2", "avx512" };
+
+// In 3-color mode, index 3 is black, transparent if alpha is set.
+void DecodeColorBlock(const uint8_t* src, uint8_t* dst, int dst_stride, bool alpha) {
+    const uint32_t c[2] = { (uint32_t)src[0] | ((uint32_t)src[1] << 8), (uint32_t)src[2] | ((uint32_t)src[3] << 8) };
+    uint8_t palette[4][4];
+    for(int i = 0; i < 2; ++i) {
+        const uint32_t r = (c[i] >> 11) & 31, g = (c[i] >> 5) & 63, b = c[i] & 31;
+        palette[i][0] = (uint8_t)((r << 3) | (r >> 2));
+        palette[i][1] = (uint8_t)((g << 2) | (g >> 4));
+        palette[i][2] = (uint8_t)((b << 3) | (b >> 2));
+        palette[i][3] = 255;
+    }
+    for(int ch = 0; ch < 3; ++ch) {
+        if (c[0] > c[1]) {
+            palette[2][ch] = (uint8_t)((2 * palette[0][ch] + palette[1][ch] + 1) / 3);
+            palette[3][ch] = (uint8_t)((palette[0][ch] + 2 * palette[1][ch] + 1) / 3);
+        } else {
+            palette[2][ch] = (uint8_t)((palette[0][ch] + palette[1][ch] + 1) / 2);
+            palette[3][ch] = 0;
+        }
+    }
+    palette[2][3] = 255;
+    palette[3][3] = (alpha && c[0] <= c[1]) ? 0 : 255;
+    const uint32_t bits = LoadPixel(src + 4);
+    for(int p = 0; p < 16; ++p) {
+        memcpy(dst + (p / 4) * dst_stride + (p % 4) * 4, palette[(bits >> (2 * p)) & 3], 4);
+    }
+}
+
+// Writes one channel (at byte offset channel of every pixel) of a BC4 block.
+void DecodeChannelBlock(const uint8_t* src, uint8_t* dst, int dst_stride, int channel) {
+    const int a0 = src[0], a1 = src[1];
+    uint8_t palette[8] = { (uint8_t)a0, (uint8_t)a1 };
+    if (a0 > a1) {
+        for(int k = 2; k < 8; ++k) {
+            palette[k] = (uint8_t)(((8 - k) * a0 + (k - 1) * a1 + 3) / 7);
+        }
+    } else {
+        for(int k = 2; k < 6; ++k) {
+            palette[k] = (uint8_t)(((6 - k) * a0 + (k - 1) * a1 + 2) / 5);
+        }
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+    uint64_t bits = 0;
+    for(int i = 0; i < 6; ++i) {
+        bits |= (uint64_t)src[2 + i] << (8 * i);
+    }
+    for(int p = 0; p < 16; ++p) {
+        dst[(p / 4) * dst_stride + (p % 4) * 4 + channel] = palette[(bits >> (3 * p)) & 7];
+    }
+}
+
+}  // namespace
+
+bool FindBcFormat(const char* format_name, BcFormat* format) {
+    static const char* const kNames[] = { "BC1", "BC1a", "BC3", "BC4", "BC5" };
+    for(int f = 0; f < (int)(sizeof(kNames) / sizeof(kNames[0])); ++f) {
+        if (strcmp(format_name, kNames[f]) == 0) {
+            *format = (BcFormat)f;
+            return true;
+        }
+    }
+    return false;
+}
+
+int BcBlockBytes(BcFormat format) {
+    return (format == kBcFormatBC3 || format == kBcFormatBC5) ? 16 : 8;
+}
+
+const char* BcKernelName(BcKernel kernel) {
+    return kBcKernelNames[kernel];
+}
+
+bool BcKernelSupported(BcKernel kernel) {
+    const CpuFeatures& cpu = GetCpuFeatures();
+    switch(kernel) {
+    case kBcKernelScalar: return true;
+#if defined(IMG2KTX_X86)
+    case kBcKernelSse41:  return cpu.sse41;
+    case kBcKernelAvx2:   return cpu.avx2;
+    case kBcKernelAvx512: return cpu.avx512f;
+#endif
+    default:              return false;
+    }
+}
+
+BcKernel ActiveBcKernel() {
+    static const BcKernel best = BestBcKernel();
+    const int forced = g_forced_kernel.load(std::memory_order_relaxed);
+    return (forced < kBcKernelCount) ? (BcKernel)forced : best;
+}
+
+void ForceBcKernel(BcKernel kernel) {
+    g_forced_kernel.store(kernel, std::memory_order_relaxed);
+}
+
+void EncodeBcBlocks(const rgba_surface* src, uint8_t* dst, BcFormat format) {
+    if (src->width < 4 || src->height < 4) {
+        return;
+    }
+    KernelFunc(ActiveBcKernel())(src, dst, format);
+}
+
+void DecodeBcBlocks(const uint8_t* src, int blocks_x, int blocks_y, BcFormat format,
+        uint8_t* dst, int dst_stride) {
+    static const uint8_t kEmptyPixel[4] = { 0, 0, 0, 255 };
+    const int block_bytes = BcBlockBytes(format);
+    for(int by = 0; by < blocks_y; ++by) {
+        for(int bx = 0; bx < blocks_x; ++bx) {
+            const uint8_t* block = src + ((size_t)by * blocks_x + bx) * block_bytes;
+            uint8_t* pixels = dst + (size_t)by * 4 * dst_stride + bx * 16;
+            switch(format) {
+            case kBcFormatBC1:
+            case kBcFormatBC1a:
+                DecodeColorBlock(block, pixels, dst_stride, format == kBcFormatBC1a);
+                break;
+            case kBcFormatBC3:
+                DecodeColorBlock(block + 8, pixels, dst_stride, false);
+                DecodeChannelBlock(block, pixels, dst_stride, 3);
+                break;
+            case kBcFormatBC4:
+            case kBcFormatBC5:
+                for(int y = 0; y < 4; ++y) {
+                    for(int x = 0; x < 4; ++x) {
+                        memcpy(pixels + y * dst_stride + x * 4, kEmptyPixel, 4);
+                    }
+                }
+                DecodeChannelBlock(block, pixels, dst_stride, 0);
+                if (format == kBcFormatBC5) {
+                    DecodeChannelBlock(block + 8, pixels, dst_stride, 1);
+                }
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+
+struct rgba_surface;  // from ispc_texcomp.h, which has no include guard
+
+// Built-in encoders for the BC1-BC5 formats, which img2ktx uses instead of
+// ispc_texcomp. Each SIMD lane encodes one block: fit the colors to their
+// principal axis, quantize the endpoints, then refine them by least squares.
+// Every kernel produces bit-identical output, so the result does not depend
+// on the CPU it runs on.
+
+enum BcFormat {
+    kBcFormatBC1,   // RGB, 4-color blocks only
+    kBcFormatBC1a,  // RGB + 1-bit alpha: blocks with any alpha < 128 use 3-color mode
+    kBcFormatBC3,   // BC1 color + BC4 alpha
+    kBcFormatBC4,   // red channel
+    kBcFormatBC5,   // red and green channels
+};
+
+// Returns false if format_name (a g_formats name) has no built-in encoder.
+bool FindBcFormat(const char* format_name, BcFormat* format);
+int BcBlockBytes(BcFormat format);
+
+enum BcKernel {
+    kBcKernelScalar,
+    kBcKernelSse41,
+    kBcKernelAvx2,
+    kBcKernelAvx512,
+    kBcKernelCount,
+};
+
+const char* BcKernelName(BcKernel kernel);
+// True if the kernel is compiled in and the CPU supports it.
+bool BcKernelSupported(BcKernel kernel);
+// The kernel EncodeBcBlocks() uses: the widest supported one, unless forced.
+BcKernel ActiveBcKernel();
+// Makes EncodeBcBlocks() use kernel, which must be supported. Meant for
+// benchmarks; must not be called while blocks are being encoded.
+void ForceBcKernel(BcKernel kernel);
+
+// Compresses every 4x4 block of src (whose dimensions must be multiples of 4)
+// into dst, in row-major block order. Safe to call concurrently.
+void EncodeBcBlocks(const rgba_surface* src, uint8_t* dst, BcFormat format);
+
+// Reference decoder: expands the blocks_x x blocks_y blocks at src into RGBA
+// pixels at dst (row pitch dst_stride bytes). Channels a format does not store
+// decode as 0 (green, blue) or 255 (alpha).
+void DecodeBcBlocks(const uint8_t* src, int blocks_x, int blocks_y, BcFormat format,
+        uint8_t* dst, int dst_stride);
@@ -0,0 +1,328 @@
+// Body of the built-in BC encoders (see bc_encoder.h), included by
+// bc_encoder.cpp once per instruction set, inside that instruction set's
+// namespace. Each SIMD lane encodes one block. The including file defines
+// kLanes, the VF (float), VI (int32) and VM (mask) vector types with their
+// operators, and IMG2KTX_BC_KERNEL, which marks every function for the
+// instruction set. Only exactly rounded operations are used (no FMA,
+// reciprocal estimates or square roots), so every kernel produces the same
+// blocks. Vectors are passed by pointer or reference except to the small
+// inline operators: GCC may clear the upper half of a vector register returned
+// from a non-inlined function compiled for a wider instruction set.
+
+IMG2KTX_BC_KERNEL inline VF& operator+=(VF& a, VF b) { return a = a + b; }
+IMG2KTX_BC_KERNEL inline VI& operator|=(VI& a, VI b) { return a = a | b; }
+IMG2KTX_BC_KERNEL inline VF Abs(VF x) { return Max(x, Splat(0.0f) - x); }
+IMG2KTX_BC_KERNEL inline VF Clamp(VF x, float lo, float hi) { return Min(Max(x, Splat(lo)), Splat(hi)); }
+IMG2KTX_BC_KERNEL inline VF Round(VF x) { return Floor(x + Splat(0.5f)); }
+
+// The 16 pixels of kLanes blocks, as values 0-255: c[channel][y * 4 + x].
+struct BlockPixels {
+    VF c[4][16];
+};
+
+IMG2KTX_BC_KERNEL void LoadBlocks(const uint8_t* base, int stride, const int32_t* offsets, BlockPixels* px) {
+    const VI byte_mask = SplatInt(0xFF);
+    for(int y = 0; y < 4; ++y) {
+        for(int x = 0; x < 4; ++x) {
+            const VI rgba = GatherPixels(base + (size_t)y * stride + x * 4, offsets);
+            const int p = y * 4 + x;
+            px->c[0][p] = ToFloat(rgba & byte_mask);
+            px->c[1][p] = ToFloat((rgba >> 8) & byte_mask);
+            px->c[2][p] = ToFloat((rgba >> 16) & byte_mask);
+            px->c[3][p] = ToFloat(rgba >> 24);
+        }
+    }
+}
+
+// A pair of RGB565 endpoints and the palette entry chosen for each pixel, as
+// a position from 0 (endpoint 0) to steps (endpoint 1).
+struct ColorFit {
+    VI packed[2];
+    VF t[16];
+    VF error;  // weighted sum of squared differences
+};
+
+// Rounds an RGB endpoint (0-255 per channel) to RGB565, and returns the color
+// it decodes to in expanded.
+IMG2KTX_BC_KERNEL void Quantize565(const VF rgb[3], VI* packed, VF expanded[3]) {
+    const VI r = ToInt(Round(rgb[0] * Splat(31.0f / 255.0f)));
+    const VI g = ToInt(Round(rgb[1] * Splat(63.0f / 255.0f)));
+    const VI b = ToInt(Round(rgb[2] * Splat(31.0f / 255.0f)));
+    expanded[0] = ToFloat((r << 3) | (r >> 2));
+    expanded[1] = ToFloat((g << 2) | (g >> 4));
+    expanded[2] = ToFloat((b << 3) | (b >> 2));
+    *packed = (r << 11) | (g << 5) | b;
+}
+
+// Quantizes the endpoints and maps every pixel to the nearest of the steps + 1
+// palette entries, which lie evenly spaced on the line between them.
+IMG2KTX_BC_KERNEL void FitPalette(const BlockPixels& px, const VF weights[16], const VF e0[3], const VF e1[3],
+        float steps, ColorFit* fit) {
+    VF q0[3], q1[3];
+    Quantize565(e0, &fit->packed[0], q0);
+    Quantize565(e1, &fit->packed[1], q1);
+    const VF d[3] = { q1[0] - q0[0], q1[1] - q0[1], q1[2] - q0[2] };
+    // Endpoints are whole numbers, so a nonzero squared length is at least 1.
+    const VF length_squared = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+    const VF scale = Splat(steps) / Max(length_squared, Splat(1.0f));
+    VF error = Splat(0.0f);
+    for(int p = 0; p < 16; ++p) {
+        const VF o[3] = { px.c[0][p] - q0[0], px.c[1][p] - q0[1], px.c[2][p] - q0[2] };
+        const VF t = Clamp(Round((o[0] * d[0] + o[1] * d[1] + o[2] * d[2]) * scale), 0.0f, steps);
+        fit->t[p] = t;
+        const VF f = t * Splat(1.0f / steps);
+        const VF r = o[0] - d[0] * f, g = o[1] - d[1] * f, b = o[2] - d[2] * f;
+        error += weights[p] * (r * r + g * g + b * b);
+    }
+    fit->error = error;
+}
+
+// Initial endpoints: the two pixels furthest apart along the principal axis of
+// the weighted pixel colors.
+IMG2KTX_BC_KERNEL void PrincipalEndpoints(const BlockPixels& px, const VF weights[16], VF e0[3], VF e1[3]) {
+    VF count = Splat(0.0f);
+    VF mean[3] = { Splat(0.0f), Splat(0.0f), Splat(0.0f) };
+    for(int p = 0; p < 16; ++p) {
+        count += weights[p];
+        for(int c = 0; c < 3; ++c) {
+            mean[c] += weights[p] * px.c[c][p];
+        }
+    }
+    const VF inv_count = Splat(1.0f) / Max(count, Splat(1.0f));
+    for(int c = 0; c < 3; ++c) {
+        mean[c] = mean[c] * inv_count;
+    }
+    VF cov[6] = { Splat(0.0f), Splat(0.0f), Splat(0.0f), Splat(0.0f), Splat(0.0f), Splat(0.0f) };  // rr rg rb gg gb bb
+    for(int p = 0; p < 16; ++p) {
+        const VF r = px.c[0][p] - mean[0], g = px.c[1][p] - mean[1], b = px.c[2][p] - mean[2];
+        const VF wr = weights[p] * r, wg = weights[p] * g;
+        cov[0] += wr * r;
+        cov[1] += wr * g;
+        cov[2] += wr * b;
+        cov[3] += wg * g;
+        cov[4] += wg * b;
+        cov[5] += weights[p] * b * b;
+    }
+    // Power iteration, starting from the covariance row of the channel with the
+    // largest variance (never zero unless the block is a single color).
+    VF axis[3] = { cov[0], cov[1], cov[2] };
+    const VM green = cov[3] > cov[0];
+    const VF largest = Max(cov[0], cov[3]);
+    const VM blue = cov[5] > largest;
+    axis[0] = Select(blue, cov[2], Select(green, cov[1], axis[0]));
+    axis[1] = Select(blue, cov[4], Select(green, cov[3], axis[1]));
+    axis[2] = Select(blue, cov[5], Select(green, cov[4], axis[2]));
+    for(int iteration = 0; iteration < 4; ++iteration) {
+        const VF r = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+        const VF g = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+        const VF b = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+        const VF norm = Splat(1.0f) / Max(Max(Abs(r), Abs(g)), Max(Abs(b), Splat(1e-20f)));
+        axis[0] = r * norm;
+        axis[1] = g * norm;
+        axis[2] = b * norm;
+    }
+    VF t_min = Splat(3.0e38f), t_max = Splat(-3.0e38f);
+    for(int c = 0; c < 3; ++c) {
+        e0[c] = e1[c] = Splat(0.0f);
+    }
+    for(int p = 0; p < 16; ++p) {
+        const VF t = px.c[0][p] * axis[0] + px.c[1][p] * axis[1] + px.c[2][p] * axis[2];
+        const VM included = weights[p] > Splat(0.0f);
+        const VM below = included & (t < t_min);
+        const VM above = included & (t > t_max);
+        t_min = Select(below, t, t_min);
+        t_max = Select(above, t, t_max);
+        for(int c = 0; c < 3; ++c) {
+            e0[c] = Select(below, px.c[c][p], e0[c]);
+            e1[c] = Select(above, px.c[c][p], e1[c]);
+        }
+    }
+}
+
+// Solves for the unquantized endpoints that minimize the squared error of the
+// palette positions in fit. Lanes where every pixel uses the same position have
+// no unique solution; those are left out of solved.
+IMG2KTX_BC_KERNEL void LeastSquaresEndpoints(const BlockPixels& px, const VF weights[16], const ColorFit& fit,
+        float steps, VF e0[3], VF e1[3], VM* solved) {
+    VF aa = Splat(0.0f), ab = Splat(0.0f), bb = Splat(0.0f);
+    VF ax[3] = { Splat(0.0f), Splat(0.0f), Splat(0.0f) };
+    VF bx[3] = { Splat(0.0f), Splat(0.0f), Splat(0.0f) };
+    for(int p = 0; p < 16; ++p) {
+        const VF f = fit.t[p] * Splat(1.0f / steps);
+        const VF g = Splat(1.0f) - f;
+        const VF wf = weights[p] * f, wg = weights[p] * g;
+        aa += wg * g;
+        ab += wg * f;
+        bb += wf * f;
+        for(int c = 0; c < 3; ++c) {
+            ax[c] += wg * px.c[c][p];
+            bx[c] += wf * px.c[c][p];
+        }
+    }
+    // Positions are multiples of 1/steps, so a nonzero determinant is at least
+    // 1/steps^4 (1/81 for four colors).
+    const VF det = aa * bb - ab * ab;
+    *solved = det > Splat(1.0f / 128.0f);
+    const VF inv_det = Splat(1.0f) / Select(*solved, det, Splat(1.0f));
+    for(int c = 0; c < 3; ++c) {
+        e0[c] = Clamp((ax[c] * bb - bx[c] * ab) * inv_det, 0.0f, 255.0f);
+        e1[c] = Clamp((bx[c] * aa - ax[c] * ab) * inv_det, 0.0f, 255.0f);
+    }
+}
+
+const int kRefinePasses = 1;
+
+// Fits a palette of steps + 1 colors to the pixels with nonzero weight.
+IMG2KTX_BC_KERNEL void FitColors(const BlockPixels& px, const VF weights[16], float steps, ColorFit* best) {
+    VF e0[3], e1[3];
+    PrincipalEndpoints(px, weights, e0, e1);
+    FitPalette(px, weights, e0, e1, steps, best);
+    for(int pass = 0; pass < kRefinePasses; ++pass) {
+        VM solved;
+        LeastSquaresEndpoints(px, weights, *best, steps, e0, e1, &solved);
+        if (!Any(solved)) {
+            break;
+        }
+        ColorFit fit;
+        FitPalette(px, weights, e0, e1, steps, &fit);
+        const VM better = solved & (fit.error < best->error);
+        best->packed[0] = Select(better, fit.packed[0], best->packed[0]);
+        best->packed[1] = Select(better, fit.packed[1], best->packed[1]);
+        for(int p = 0; p < 16; ++p) {
+            best->t[p] = Select(better, fit.t[p], best->t[p]);
+        }
+        best->error = Select(better, fit.error, best->error);
+    }
+}
+
+// Orders the endpoints of a 4-color fit (color0 > color1) and packs the block:
+// colors receives color0 | color1 << 16, bits the 2-bit indices.
+IMG2KTX_BC_KERNEL void PackFourColorBlock(const ColorFit& fit, VI* colors, VI* bits) {
+    const VF c0 = ToFloat(fit.packed[0]), c1 = ToFloat(fit.packed[1]);
+    const VM swap = c0 < c1;
+    const VM same = c0 == c1;  // decodes as 3-color; index 0 is still endpoint 0
+    *colors = Select(swap, fit.packed[1] | (fit.packed[0] << 16), fit.packed[0] | (fit.packed[1] << 16));
+    *bits = SplatInt(0);
+    for(int p = 0; p < 16; ++p) {
+        const VF t = Select(swap, Splat(3.0f) - fit.t[p], fit.t[p]);
+        // Palette order: color0, color1, 2/3 color0 + 1/3 color1, 1/3 color0 + 2/3 color1
+        VF index = Select(t == Splat(0.0f), Splat(0.0f), Select(t == Splat(3.0f), Splat(1.0f), t + Splat(1.0f)));
+        index = Select(same, Splat(0.0f), index);
+        *bits |= ToInt(index) << (2 * p);
+    }
+}
+
+// Orders the endpoints of a 3-color fit (color0 <= color1) and packs the block,
+// with index 3 (transparent black) for zero-weight pixels.
+IMG2KTX_BC_KERNEL void PackThreeColorBlock(const ColorFit& fit, const VF weights[16], VI* colors, VI* bits) {
+    const VF c0 = ToFloat(fit.packed[0]), c1 = ToFloat(fit.packed[1]);
+    const VM swap = c0 > c1;
+    *colors = Select(swap, fit.packed[1] | (fit.packed[0] << 16), fit.packed[0] | (fit.packed[1] << 16));
+    *bits = SplatInt(0);
+    for(int p = 0; p < 16; ++p) {
+        const VF t = Select(swap, Splat(2.0f) - fit.t[p], fit.t[p]);
+        // Palette order: color0, color1, 1/2 color0 + 1/2 color1, transparent
+        VF index = Select(t == Splat(1.0f), Splat(2.0f), Select(t == Splat(2.0f), Splat(1.0f), Splat(0.0f)));
+        index = Select(weights[p] == Splat(0.0f), Splat(3.0f), index);
+        *bits |= ToInt(index) << (2 * p);
+    }
+}
+
+IMG2KTX_BC_KERNEL void EncodeColorBlocks(const BlockPixels& px, bool punch_through_alpha, VI* colors, VI* bits) {
+    VF weights[16];
+    VF min_alpha = px.c[3][0];
+    for(int p = 0; p < 16; ++p) {
+        weights[p] = Splat(1.0f);
+        if (punch_through_alpha) {
+            weights[p] = Select(px.c[3][p] < Splat(128.0f), Splat(0.0f), weights[p]);
+            min_alpha = Min(min_alpha, px.c[3][p]);
+        }
+    }
+    const VM transparent = min_alpha < Splat(128.0f);
+    // Opaque lanes have all weights 1, so one 4-color fit serves every lane
+    // that has no transparent pixel.
+    ColorFit fit;
+    FitColors(px, weights, 3.0f, &fit);
+    PackFourColorBlock(fit, colors, bits);
+    if (punch_through_alpha && Any(transparent)) {
+        VI three_colors, three_bits;
+        FitColors(px, weights, 2.0f, &fit);
+        PackThreeColorBlock(fit, weights, &three_colors, &three_bits);
+        *colors = Select(transparent, three_colors, *colors);
+        *bits = Select(transparent, three_bits, *bits);
+    }
+}
+
+// BC4: endpoints at the channel's minimum and maximum, in the 8-value mode
+// (endpoint0 > endpoint1). Sets endpoints (endpoint0 | endpoint1 << 8) and the
+// 3-bit indices of pixels 0-7 and 8-15.
+IMG2KTX_BC_KERNEL void EncodeChannelBlocks(const VF values[16], VI* endpoints, VI* bits_lo, VI* bits_hi) {
+    VF lo = values[0], hi = values[0];
+    for(int p = 1; p < 16; ++p) {
+        lo = Min(lo, values[p]);
+        hi = Max(hi, values[p]);
+    }
+    *endpoints = ToInt(hi) | (ToInt(lo) << 8);
+    const VF scale = Splat(7.0f) / Max(hi - lo, Splat(1.0f));
+    *bits_lo = *bits_hi = SplatInt(0);
+    for(int p = 0; p < 16; ++p) {
+        // t steps from lo (0) to hi (7); palette order: hi, lo, then 6/7 hi + 1/7 lo
+        // down to 1/7 hi + 6/7 lo. When hi == lo every pixel gets index 1.
+        const VF t = Clamp(Round((values[p] - lo) * scale), 0.0f, 7.0f);
+        const VF index = Select(t == Splat(7.0f), Splat(0.0f),
+                Select(t == Splat(0.0f), Splat(1.0f), Splat(8.0f) - t));
+        VI* bits = (p < 8) ? bits_lo : bits_hi;
+        *bits |= ToInt(index) << (3 * (p % 8));
+    }
+}
+
+IMG2KTX_BC_KERNEL void EncodeBlocks(const rgba_surface* src, uint8_t* dst, BcFormat format) {
+    const int blocks_x = src->width / 4;
+    const int block_count = blocks_x * (src->height / 4);
+    const int block_bytes = BcBlockBytes(format);
+    alignas(64) int32_t offsets[kLanes];
+    alignas(64) int32_t words[kBcWords][kLanes];
+    for(int first = 0; first < block_count; first += kLanes) {
+        // Lanes past the last block repeat it; their results are dropped.
+        const int lanes = std::min(kLanes, block_count - first);
+        const int first_x = first % blocks_x, first_y = first / blocks_x;
+        const uint8_t* base = src->ptr + (size_t)first_y * 4 * src->stride + first_x * 16;
+        for(int lane = 0; lane < kLanes; ++lane) {
+            const int block = first + std::min(lane, lanes - 1);
+            offsets[lane] = (block / blocks_x - first_y) * 4 * src->stride + (block % blocks_x - first_x) * 16;
+        }
+        BlockPixels px;
+        LoadBlocks(base, src->stride, offsets, &px);
+        VI out[kBcWords];
+        for(int w = 0; w < kBcWords; ++w) {
+            out[w] = SplatInt(0);
+        }
+        switch(format) {
+        case kBcFormatBC1:
+        case kBcFormatBC1a:
+            EncodeColorBlocks(px, format == kBcFormatBC1a, &out[kBcWordColors], &out[kBcWordColorBits]);
+            break;
+        case kBcFormatBC3:
+            EncodeColorBlocks(px, false, &out[kBcWordColors], &out[kBcWordColorBits]);
+            EncodeChannelBlocks(px.c[3], &out[kBcWordChannel0], &out[kBcWordChannel0 + 1], &out[kBcWordChannel0 + 2]);
+            break;
+        case kBcFormatBC4:
+            EncodeChannelBlocks(px.c[0], &out[kBcWordChannel0], &out[kBcWordChannel0 + 1], &out[kBcWordChannel0 + 2]);
+            break;
+        case kBcFormatBC5:
+            EncodeChannelBlocks(px.c[0], &out[kBcWordChannel0], &out[kBcWordChannel0 + 1], &out[kBcWordChannel0 + 2]);
+            EncodeChannelBlocks(px.c[1], &out[kBcWordChannel1], &out[kBcWordChannel1 + 1], &out[kBcWordChannel1 + 2]);
+            break;
+        }
+        for(int w = 0; w < kBcWords; ++w) {
+            Store(words[w], out[w]);
+        }
+        for(int lane = 0; lane < lanes; ++lane) {
+            uint32_t lane_words[kBcWords];
+            for(int w = 0; w < kBcWords; ++w) {
+                lane_words[w] = (uint32_t)words[w][lane];
+            }
+            WriteBlock(format, lane_words, dst + (size_t)(first + lane) * block_bytes);
+        }
+    }
+}
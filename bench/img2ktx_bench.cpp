@@ -0,0 +1,878 @@
+// img2ktx_bench: measures the throughput of each img2ktx pipeline stage (load,
+// resize, mip generation, every encoder in g_formats, KTX writing) over
+// synthetic images and/or real image files, at several sizes and thread
+// counts. Results go to stdout as a table and optionally to a JSON file, so
+// runs from different commits can be compared.
+#include "build_version.h"
+
+#include "bc_encoder.h"
+#include "buffer_pool.h"
+#include "cpu_features.h"
+#include "encoders.h"
+#include "ktx_file.h"
+#include "mapped_file.h"
+#include "memory_stats.h"
+#include "mip_downsample.h"
+#include "worker_pool.h"
+
+#pragma warning(push,3)
+#include <stb_image.h>
+#include <stb_image_resize.h>
+#pragma warning(pop)
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct BenchOptions {
+    std::vector<int> sizes;
+    std::vector<int> thread_counts;
+    std::vector<const GlFormatInfo*> formats;
+    std::vector<EncoderQuality> qualities;
+    std::vector<std::string> stages;
+    std::vector<std::string> input_filenames;
+    double min_seconds = 0.5;
+    std::string json_filename;
+};
+
+// One measured case. Rates are computed from the fastest iteration.
+struct BenchResult {
+    std::string stage;
+    std::string variant;  // format name, filter name, etc.
+    std::string input;
+    int width = 0, height = 0;
+    int threads = 1;
+    int iterations = 0;
+    double best_seconds = 0;
+    uint64_t pixels = 0;  // per iteration
+    uint64_t bytes = 0;  // per iteration; see PrintUsage() for what each stage counts
+    uint64_t peak_rss_bytes = 0;
+    double psnr = 0;  // encode stage, built-in BC encoders only
+};
+
+// A decoded RGBA image to run the stages on.
+struct BenchImage {
+    std::string name;
+    std::string filename;  // empty for synthetic images
+    int width = 0, height = 0;
+    int original_components = 4;
+    bool psnr_floor = false;  // MinSyntheticPsnr() applies
+    std::vector<uint8_t> pixels;
+};
+
+void PrintUsage(const char* argv0) {
+    fprintf(stdout, "img2ktx_bench %s\n", img2ktx_build_version);
+    fprintf(stdout, "Usage: %s [options] [image files]\n", argv0);
+    fprintf(stdout, R"options(options:
+  --sizes [list]    Comma-separated edge lengths of square synthetic images:
+                    smooth gradients, and a sparse atlas of textured sprites
+                    and flat panels on a transparent background.
+                    Default: 256,1024,2048 if no image files are given,
+                    otherwise none.
+  --threads [list]  Comma-separated worker thread counts for the encode stage.
+                    Default: 1 and the number of hardware threads.
+  --formats [list]  Comma-separated output formats to encode and write.
+                    Default: every format this build supports. BC1-BC5 are
+                    encoded once per SIMD kernel this CPU supports, and
+                    BC1 and BC3 also with ispc_texcomp if it is linked.
+  --quality [list]  Comma-separated encoder qualities to run for BC7 and ASTC.
+                    Default: basic.
+  --stages [list]   Any of load,resize,mips,encode,write. Default: all.
+                    load only runs on image files.
+  --min-time [sec]  Repeat each case for at least this long and report the
+                    fastest iteration. Default: 0.5.
+  --json [file]     Also write the results to file as JSON ("-" for stdout).
+  -h                Displays this help message
+
+Bytes per iteration are: load, the file size; resize and mips, the output
+pixel bytes; encode and write, the compressed output bytes.
+peak_rss_bytes is the process high-water mark after the case has run.
+psnr (dB) compares the decoded BC1-BC5 output with the input, over the
+channels the format stores (BC1a: color of opaque pixels, and alpha rounded
+to 0 or 255). The exit code is 4 if any BC kernel's output differs from the
+scalar kernel's, or 5 if any BC format's PSNR on a synthetic gradient image
+of 256 or more is below the floor recorded for it. BC1-BC5 are also encoded
+with the constant-block pass off ("/no_constant_blocks"), to compare.
+)options");
+}
+
+std::vector<std::string> SplitList(const char* list) {
+    std::vector<std::string> items;
+    std::string item;
+    for(const char* c = list; ; ++c) {
+        if (*c == ',' || *c == '\0') {
+            if (!item.empty()) {
+                items.push_back(item);
+            }
+            item.clear();
+            if (*c == '\0') {
+                break;
+            }
+        } else {
+            item += *c;
+        }
+    }
+    return items;
+}
+
+bool ParseIntList(const char* list, std::vector<int>* values) {
+    values->clear();
+    for(const auto& item : SplitList(list)) {
+        int value = (int)strtol(item.c_str(), nullptr, 10);
+        if (value < 1) {
+            return false;
+        }
+        values->push_back(value);
+    }
+    return true;
+}
+
+bool HasStage(const BenchOptions& opts, const char* stage) {
+    return std::find(opts.stages.begin(), opts.stages.end(), stage) != opts.stages.end();
+}
+
+// Runs body until min_seconds have passed (at least once) and records the
+// fastest iteration in result.
+void Measure(const BenchOptions& opts, BenchResult* result, const std::function<void()>& body) {
+    using Clock = std::chrono::steady_clock;
+    double total = 0;
+    result->best_seconds = 0;
+    result->iterations = 0;
+    do {
+        Clock::time_point start = Clock::now();
+        body();
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (result->iterations == 0 || seconds < result->best_seconds) {
+            result->best_seconds = seconds;
+        }
+        result->iterations += 1;
+        total += seconds;
+    } while(total < opts.min_seconds);
+    result->peak_rss_bytes = PeakResidentBytes();
+}
+
+// Smooth gradients with noise and a soft-edged alpha disc: compresses with
+// realistic effort, unlike flat or random images.
+BenchImage MakeSyntheticImage(int size) {
+    BenchImage image;
+    image.name = "synthetic_" + std::to_string(size);
+    image.width = size;
+    image.height = size;
+    image.psnr_floor = true;
+    image.pixels.resize((size_t)size * size * 4);
+    uint32_t rng = 0x9E3779B9u;
+    const float center = size * 0.5f;
+    for(int y = 0; y < size; ++y) {
+        for(int x = 0; x < size; ++x) {
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            const int noise = (int)(rng & 15) - 8;
+            uint8_t* p = &image.pixels[((size_t)y * size + x) * 4];
+            p[0] = (uint8_t)std::min(255, std::max(0, x * 255 / size + noise));
+            p[1] = (uint8_t)std::min(255, std::max(0, y * 255 / size + noise));
+            p[2] = (uint8_t)std::min(255, std::max(0, ((x ^ y) & 255) / 2 + 64 + noise));
+            const float dx = (x - center) / center, dy = (y - center) / center;
+            const float r = dx * dx + dy * dy;
+            p[3] = (uint8_t)(r < 0.5f ? 255 : r > 0.75f ? 0 : (int)((0.75f - r) * 4 * 255));
+        }
+    }
+    return image;
+}
+
+// An atlas that is mostly transparent: 64x64 cells holding noisy, soft-edged
+// sprites or flat opaque panels, or nothing. Panels are inset by 2 pixels, so
+// their edges straddle blocks. Exercises the constant-block pass.
+BenchImage MakeSparseImage(int size) {
+    BenchImage image;
+    image.name = "sparse_" + std::to_string(size);
+    image.width = size;
+    image.height = size;
+    image.pixels.assign((size_t)size * size * 4, 0);
+    uint32_t rng = 0x2545F491u;
+    for(int y = 0; y < size; ++y) {
+        for(int x = 0; x < size; ++x) {
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            const int cx = x / 64, cy = y / 64;
+            const int dx = x % 64 - 32, dy = y % 64 - 32;
+            uint8_t* p = &image.pixels[((size_t)y * size + x) * 4];
+            if ((cx + cy) % 3 == 0) {
+                const int r2 = dx * dx + dy * dy;
+                if (r2 < 28 * 28) {
+                    const int noise = (int)(rng & 31) - 16;
+                    p[0] = (uint8_t)std::min(255, std::max(0, 128 + dx * 3 + noise));
+                    p[1] = (uint8_t)std::min(255, std::max(0, 128 + dy * 3 + noise));
+                    p[2] = (uint8_t)((cx * 40 + cy * 70) & 255);
+                    p[3] = (uint8_t)(r2 < 24 * 24 ? 255 : (28 * 28 - r2) * 255 / (28 * 28 - 24 * 24));
+                }
+            } else if ((cx * 7 + cy) % 5 == 0 && dx >= -30 && dx < 30 && dy >= -30 && dy < 30) {
+                p[0] = (uint8_t)(cx * 50);
+                p[1] = (uint8_t)(cy * 90);
+                p[2] = 200;
+                p[3] = 255;
+            }
+        }
+    }
+    return image;
+}
+
+uint64_t FileSize(const char* filename) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) {
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    return size > 0 ? (uint64_t)size : 0;
+}
+
+// Copies image into a buffer padded to whole blocks, with replicated edges.
+std::vector<uint8_t> PadImage(const BenchImage& image, int block_dim_x, int block_dim_y,
+        int* pitch_x, int* pitch_y) {
+    *pitch_x = ((image.width  + block_dim_x - 1) / block_dim_x) * block_dim_x;
+    *pitch_y = ((image.height + block_dim_y - 1) / block_dim_y) * block_dim_y;
+    std::vector<uint8_t> padded((size_t)*pitch_x * *pitch_y * 4);
+    for(int y = 0; y < image.height; ++y) {
+        memcpy(&padded[(size_t)y * *pitch_x * 4], &image.pixels[(size_t)y * image.width * 4], (size_t)image.width * 4);
+    }
+    PadSurfaceEdges(padded.data(), image.width, image.height, *pitch_x, *pitch_y);
+    return padded;
+}
+
+void BenchLoad(const BenchOptions& opts, const BenchImage& image, std::vector<BenchResult>* results) {
+    BenchResult result;
+    result.stage = "load";
+    result.variant = "stb_image";
+    result.input = image.name;
+    result.width = image.width;
+    result.height = image.height;
+    result.pixels = (uint64_t)image.width * image.height;
+    result.bytes = FileSize(image.filename.c_str());
+    Measure(opts, &result, [&]() {
+        int w, h, c;
+        stbi_uc* pixels = stbi_load(image.filename.c_str(), &w, &h, &c, 4);
+        stbi_image_free(pixels);
+    });
+    results->push_back(result);
+}
+
+// Resizes to 3/4 of the original size in each dimension, as -r would.
+void BenchResize(const BenchOptions& opts, const BenchImage& image, std::vector<BenchResult>* results) {
+    const int dst_width = std::max(1, image.width * 3 / 4);
+    const int dst_height = std::max(1, image.height * 3 / 4);
+    std::vector<uint8_t> dst((size_t)dst_width * dst_height * 4);
+    BenchResult result;
+    result.stage = "resize";
+    result.variant = "stbir_default";
+    result.input = image.name;
+    result.width = image.width;
+    result.height = image.height;
+    result.pixels = (uint64_t)dst_width * dst_height;
+    result.bytes = dst.size();
+    Measure(opts, &result, [&]() {
+        stbir_resize_uint8(image.pixels.data(), image.width, image.height, image.width * 4,
+                dst.data(), dst_width, dst_height, dst_width * 4, 4);
+    });
+    results->push_back(result);
+
+    // ResizeImage(), as -r runs it: the same filter, in strips on the pool.
+    for(int threads : opts.thread_counts) {
+        WorkerPool pool(threads);
+        BenchResult strips_result = result;
+        strips_result.variant = "strips";
+        strips_result.threads = threads;
+        Measure(opts, &strips_result, [&]() {
+            ResizeImage(image.pixels.data(), image.width, image.height, (size_t)image.width * 4,
+                    dst.data(), dst_width, dst_height, (size_t)dst_width * 4, kResizeFilterDefault, pool);
+        });
+        results->push_back(strips_result);
+    }
+}
+
+// Generates the full mip chain below level 0, once per filter setting.
+void BenchMips(const BenchOptions& opts, const BenchImage& image, std::vector<BenchResult>* results) {
+    struct Variant {
+        const char* name;
+        MipFilter filter;
+        bool linear;
+    };
+    const Variant variants[] = {
+        { "box",        kMipFilterBox, false },
+        { "box_linear", kMipFilterBox, true },
+        { "stb",        kMipFilterStb, false },
+    };
+    std::vector<std::vector<uint8_t>> levels;
+    std::vector<int> widths(1, image.width), heights(1, image.height);
+    uint64_t pixels = 0;
+    while(widths.back() > 1 || heights.back() > 1) {
+        widths.push_back(std::max(1, widths.back() / 2));
+        heights.push_back(std::max(1, heights.back() / 2));
+        levels.emplace_back((size_t)widths.back() * heights.back() * 4);
+        pixels += (uint64_t)widths.back() * heights.back();
+    }
+    for(const Variant& variant : variants) {
+        BenchResult result;
+        result.stage = "mips";
+        result.variant = variant.name;
+        result.input = image.name;
+        result.width = image.width;
+        result.height = image.height;
+        result.pixels = pixels;
+        result.bytes = pixels * 4;
+        Measure(opts, &result, [&]() {
+            const uint8_t* src = image.pixels.data();
+            for(size_t i = 0; i < levels.size(); ++i) {
+                DownsampleMip(src, widths[i], heights[i], widths[i] * 4,
+                        levels[i].data(), widths[i + 1], heights[i + 1], widths[i + 1] * 4,
+                        variant.filter, variant.linear);
+                src = levels[i].data();
+            }
+        });
+        results->push_back(result);
+    }
+}
+
+// PSNR of the decoded blocks against the padded input they were encoded from.
+double BcPsnr(const uint8_t* padded, int pitch_x, int pitch_y, const uint8_t* blocks, BcFormat format) {
+    std::vector<uint8_t> decoded((size_t)pitch_x * pitch_y * 4);
+    DecodeBcBlocks(blocks, pitch_x / 4, pitch_y / 4, format, decoded.data(), pitch_x * 4);
+    const int channels = (format == kBcFormatBC4) ? 1 : (format == kBcFormatBC5) ? 2
+        : (format == kBcFormatBC1) ? 3 : 4;
+    double squared_error = 0;
+    uint64_t samples = 0;
+    for(size_t i = 0; i < decoded.size(); i += 4) {
+        for(int c = 0; c < channels; ++c) {
+            int expected = padded[i + c];
+            if (format == kBcFormatBC1a && padded[i + 3] < 128 && c < 3) {
+                continue;
+            } else if (format == kBcFormatBC1a && c == 3) {
+                expected = (expected < 128) ? 0 : 255;
+            }
+            const int diff = expected - decoded[i + c];
+            squared_error += diff * diff;
+            samples += 1;
+        }
+    }
+    if (squared_error == 0) {
+        return 99.0;  // lossless
+    }
+    return 10.0 * log10(255.0 * 255.0 * samples / squared_error);
+}
+
+#if defined(IMG2KTX_HAVE_ISPC_TEXCOMP)
+typedef void (*IspcBcEncodeFunc)(const rgba_surface* src, uint8_t* dst);
+
+// ispc_texcomp's encoder for a format that also has a built-in one, if any.
+IspcBcEncodeFunc FindIspcBcEncoder(BcFormat format) {
+    switch(format) {
+    case kBcFormatBC1: return CompressBlocksBC1;
+    case kBcFormatBC3: return CompressBlocksBC3;
+    default:           return nullptr;
+    }
+}
+
+// Encodes a padded surface with ispc_texcomp in strips of about 64K pixels
+// on the pool, as SubmitCompressSurface() does with the built-in encoders.
+void SubmitIspcStrips(WorkerPool& pool, const rgba_surface& surface, uint8_t* dst, int block_bytes,
+        IspcBcEncodeFunc encode) {
+    const int block_rows = surface.height / 4;
+    const size_t block_row_bytes = (size_t)(surface.width / 4) * block_bytes;
+    const int strip_block_rows = std::max(1, 64 * 1024 / (surface.width * 4));
+    TaskGroup group;
+    for(int first = 0; first < block_rows; first += strip_block_rows) {
+        rgba_surface strip = surface;
+        strip.ptr = surface.ptr + (size_t)first * 4 * surface.stride;
+        strip.height = std::min(strip_block_rows, block_rows - first) * 4;
+        uint8_t* strip_dst = dst + first * block_row_bytes;
+        pool.Submit([=]() { encode(&strip, strip_dst); }, &group);
+    }
+    pool.Wait(group);
+}
+#endif
+
+// The lowest PSNR (dB) each built-in encoder may reach on a synthetic image of
+// at least kPsnrFloorMinSize pixels square, a little under what it reached
+// when the floor was last raised. Larger synthetic images score higher.
+const int kPsnrFloorMinSize = 256;
+
+double MinSyntheticPsnr(BcFormat format) {
+    switch(format) {
+    case kBcFormatBC1:  return 41.7;
+    case kBcFormatBC1a: return 43.9;
+    case kBcFormatBC3:  return 42.7;
+    case kBcFormatBC4:  return 51.4;
+    case kBcFormatBC5:  return 51.4;
+    }
+    return 0;
+}
+
+// Compresses level 0 with every format at every thread count, split into
+// strips exactly as img2ktx does. Formats with built-in encoders run once per
+// supported kernel, once more with the constant-block pass off, and BC1 and
+// BC3 once more with ispc_texcomp, if linked, for comparison. Returns 0, 4 if any kernel disagrees with the scalar one,
+// or 5 if any falls below its PSNR floor (see MinSyntheticPsnr()).
+int BenchEncode(const BenchOptions& opts, const BenchImage& image, std::vector<BenchResult>* results) {
+    bool kernels_agree = true;
+    bool above_psnr_floor = true;
+    const bool check_psnr = image.psnr_floor && std::min(image.width, image.height) >= kPsnrFloorMinSize;
+    const BcKernel default_kernel = ActiveBcKernel();
+    for(const GlFormatInfo* format_info : opts.formats) {
+        int pitch_x, pitch_y;
+        std::vector<uint8_t> padded = PadImage(image, format_info->block_dim_x, format_info->block_dim_y,
+                &pitch_x, &pitch_y);
+        const size_t output_size = (size_t)(pitch_x / format_info->block_dim_x) *
+            (pitch_y / format_info->block_dim_y) * format_info->block_bytes;
+        std::vector<uint8_t> output(output_size);
+        rgba_surface surface = { padded.data(), pitch_x, pitch_y, pitch_x * 4 };
+        std::vector<EncoderQuality> qualities(1, kDefaultEncoderQuality);
+        if (FormatHasQualityLevels(format_info)) {
+            qualities = opts.qualities;
+        }
+        BcFormat bc_format;
+        const bool built_in = FindBcFormat(format_info->name, &bc_format);
+        std::vector<BcKernel> kernels(1, default_kernel);
+        if (built_in) {
+            kernels.clear();
+            for(int k = 0; k < kBcKernelCount; ++k) {
+                if (BcKernelSupported((BcKernel)k)) {
+                    kernels.push_back((BcKernel)k);
+                }
+            }
+        }
+        std::vector<uint8_t> scalar_output;
+        for(BcKernel kernel : kernels)
+        for(EncoderQuality quality : qualities)
+        for(int threads : opts.thread_counts) {
+            ForceBcKernel(kernel);
+            WorkerPool pool(threads);
+            BenchResult result;
+            result.stage = "encode";
+            result.variant = format_info->name;
+            if (FormatHasQualityLevels(format_info)) {
+                result.variant += std::string("/") + EncoderQualityName(quality);
+            }
+            if (built_in) {
+                result.variant += std::string("/") + BcKernelName(kernel);
+            }
+            result.input = image.name;
+            result.width = image.width;
+            result.height = image.height;
+            result.threads = threads;
+            result.pixels = (uint64_t)image.width * image.height;
+            result.bytes = output_size;
+            Measure(opts, &result, [&]() {
+                TaskGroup group;
+                SubmitCompressSurface(pool, surface, output.data(), format_info,
+                        image.original_components, quality, &group, nullptr);
+                pool.Wait(group);
+            });
+            if (built_in) {
+                result.psnr = BcPsnr(padded.data(), pitch_x, pitch_y, output.data(), bc_format);
+                if (check_psnr && result.psnr < MinSyntheticPsnr(bc_format)) {
+                    fprintf(stderr, "Error: %s PSNR %.3f dB of the %s kernel on %s is below the %.1f dB floor.\n",
+                            format_info->name, result.psnr, BcKernelName(kernel), image.name.c_str(),
+                            MinSyntheticPsnr(bc_format));
+                    above_psnr_floor = false;
+                }
+                if (kernel == kBcKernelScalar) {
+                    scalar_output = output;
+                } else if (output != scalar_output) {
+                    fprintf(stderr, "Error: %s output of the %s kernel differs from the scalar kernel's on %s.\n",
+                            format_info->name, BcKernelName(kernel), image.name.c_str());
+                    kernels_agree = false;
+                }
+            }
+            results->push_back(result);
+        }
+        // The active kernel again with the constant-block pass off, to show
+        // what the pass saves (or costs) on this image.
+        ForceBcKernel(default_kernel);
+        ForceConstantBlockPass(false);
+        for(int threads : built_in ? opts.thread_counts : std::vector<int>()) {
+            WorkerPool pool(threads);
+            BenchResult result;
+            result.stage = "encode";
+            result.variant = std::string(format_info->name) + "/" + BcKernelName(default_kernel) + "/no_constant_blocks";
+            result.input = image.name;
+            result.width = image.width;
+            result.height = image.height;
+            result.threads = threads;
+            result.pixels = (uint64_t)image.width * image.height;
+            result.bytes = output_size;
+            Measure(opts, &result, [&]() {
+                TaskGroup group;
+                SubmitCompressSurface(pool, surface, output.data(), format_info,
+                        image.original_components, kDefaultEncoderQuality, &group, nullptr);
+                pool.Wait(group);
+            });
+            result.psnr = BcPsnr(padded.data(), pitch_x, pitch_y, output.data(), bc_format);
+            results->push_back(result);
+        }
+        ForceConstantBlockPass(true);
+#if defined(IMG2KTX_HAVE_ISPC_TEXCOMP)
+        const IspcBcEncodeFunc ispc_encode = built_in ? FindIspcBcEncoder(bc_format) : nullptr;
+        for(int threads : ispc_encode ? opts.thread_counts : std::vector<int>()) {
+            WorkerPool pool(threads);
+            BenchResult result;
+            result.stage = "encode";
+            result.variant = std::string(format_info->name) + "/ispc_texcomp";
+            result.input = image.name;
+            result.width = image.width;
+            result.height = image.height;
+            result.threads = threads;
+            result.pixels = (uint64_t)image.width * image.height;
+            result.bytes = output_size;
+            Measure(opts, &result, [&]() {
+                SubmitIspcStrips(pool, surface, output.data(), format_info->block_bytes, ispc_encode);
+            });
+            result.psnr = BcPsnr(padded.data(), pitch_x, pitch_y, output.data(), bc_format);
+            results->push_back(result);
+        }
+#endif
+    }
+    ForceBcKernel(default_kernel);
+    return !kernels_agree ? 4 : !above_psnr_floor ? 5 : 0;
+}
+
+// Writes a one-layer KTX file with a full mip chain to a temporary file,
+// through the same LayerWriter the CLI uses. Level contents are placeholders;
+// only the size of each level matters here. The "/mmap" variant fills the
+// levels in place in a mapped file, as the CLI does with --mmap.
+void BenchWrite(const BenchOptions& opts, const BenchImage& image, std::vector<BenchResult>* results) {
+    BufferPool buffers(size_t(256) << 20);
+    for(const GlFormatInfo* format_info : opts.formats) {
+        std::vector<uint32_t> mip_sizes;
+        int mip_width = image.width, mip_height = image.height;
+        uint64_t pixels = 0;
+        for(;;) {
+            const uint32_t blocks_x = (mip_width  + format_info->block_dim_x - 1) / format_info->block_dim_x;
+            const uint32_t blocks_y = (mip_height + format_info->block_dim_y - 1) / format_info->block_dim_y;
+            mip_sizes.push_back(blocks_x * blocks_y * format_info->block_bytes);
+            pixels += (uint64_t)mip_width * mip_height;
+            if (mip_width == 1 && mip_height == 1) {
+                break;
+            }
+            mip_width = std::max(1, mip_width / 2);
+            mip_height = std::max(1, mip_height / 2);
+        }
+        KtxHeader header = {};
+        const uint8_t identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+        memcpy(header.identifier, identifier, sizeof(identifier));
+        header.endianness = 0x04030201;
+        header.glType = format_info->gl_type;
+        header.glTypeSize = format_info->gl_type_size;
+        header.glFormat = format_info->gl_format;
+        header.glInternalFormat = format_info->internal_format;
+        header.glBaseInternalFormat = format_info->base_format;
+        header.pixelWidth = image.width;
+        header.pixelHeight = image.height;
+        header.numberOfFaces = 1;
+        header.numberOfMipmapLevels = (uint32_t)mip_sizes.size();
+        const KtxLayout layout = ComputeKtxLayout(header, mip_sizes);
+
+        BenchResult result;
+        result.stage = "write";
+        result.variant = format_info->name;
+        result.input = image.name;
+        result.width = image.width;
+        result.height = image.height;
+        result.pixels = pixels;
+        result.bytes = layout.file_size;
+        BenchResult mmap_result = result;
+        mmap_result.variant = std::string(format_info->name) + "/mmap";
+        bool ok = true;
+        Measure(opts, &result, [&]() {
+            FILE* f = tmpfile();
+            if (!f) {
+                ok = false;
+                return;
+            }
+            std::vector<ImagePixels> images(1);
+            images[0].output_mips.resize(mip_sizes.size());
+            for(size_t mip = 0; mip < mip_sizes.size(); ++mip) {
+                images[0].output_mips[mip].bytes.Allocate(mip_sizes[mip], &buffers);
+                memset(images[0].output_mips[mip].bytes.data(), (int)mip, mip_sizes[mip]);
+            }
+            ok = ok && WriteKtxSkeleton(f, layout);
+            LayerWriter writer(f, layout, images, []() {});
+            writer.Push(0);
+            ok = writer.Finish() && ok && fflush(f) == 0;
+            fclose(f);
+        });
+        const std::string mmap_filename = (std::filesystem::temp_directory_path() / "img2ktx_bench.ktx").string();
+        Measure(opts, &mmap_result, [&]() {
+            MappedFile mapped;
+            if (!mapped.Create(mmap_filename, layout.file_size)) {
+                ok = false;
+                return;
+            }
+            WriteKtxSkeleton(mapped.data(), layout);
+            for(size_t mip = 0; mip < mip_sizes.size(); ++mip) {
+                memset(mapped.data() + layout.DataOffset((int)mip, 0), (int)mip, mip_sizes[mip]);
+            }
+            ok = mapped.Close() && ok;
+        });
+        remove(mmap_filename.c_str());
+        if (!ok) {
+            fprintf(stderr, "Warning: writing a temporary KTX file for %s failed.\n", format_info->name);
+        }
+        results->push_back(result);
+        results->push_back(mmap_result);
+    }
+}
+
+double PerSecond(uint64_t amount, double seconds) {
+    return seconds > 0 ? amount / seconds : 0;
+}
+
+void PrintResultTable(const std::vector<BenchResult>& results) {
+    fprintf(stdout, "%-8s %-18s %-22s %11s %3s %8s %10s %12s %10s %7s\n",
+            "stage", "variant", "input", "size", "thr", "ms", "MP/s", "MB/s", "peakMB", "PSNR");
+    for(const BenchResult& r : results) {
+        char size[32];
+        snprintf(size, sizeof(size), "%dx%d", r.width, r.height);
+        char psnr[32] = "";
+        if (r.psnr > 0) {
+            snprintf(psnr, sizeof(psnr), "%.2f", r.psnr);
+        }
+        fprintf(stdout, "%-8s %-18s %-22s %11s %3d %8.3f %10.2f %12.2f %10.1f %7s\n",
+                r.stage.c_str(), r.variant.c_str(), r.input.c_str(), size, r.threads,
+                r.best_seconds * 1000.0, PerSecond(r.pixels, r.best_seconds) / 1e6,
+                PerSecond(r.bytes, r.best_seconds) / 1e6, r.peak_rss_bytes / (1024.0 * 1024.0), psnr);
+    }
+}
+
+// For each ispc_texcomp encode result, the built-in encoder's throughput with
+// the kernel img2ktx selects on this CPU, on the same input and threads.
+void PrintIspcComparison(const std::vector<BenchResult>& results) {
+    const std::string suffix = "/ispc_texcomp";
+    const std::string kernel = BcKernelName(ActiveBcKernel());
+    bool printed_header = false;
+    for(const BenchResult& ispc : results) {
+        if (ispc.variant.size() <= suffix.size() ||
+                ispc.variant.compare(ispc.variant.size() - suffix.size(), suffix.size(), suffix) != 0) {
+            continue;
+        }
+        const std::string built_in_variant = ispc.variant.substr(0, ispc.variant.size() - suffix.size()) + "/" + kernel;
+        for(const BenchResult& r : results) {
+            if (r.stage != ispc.stage || r.variant != built_in_variant || r.input != ispc.input ||
+                    r.threads != ispc.threads) {
+                continue;
+            }
+            if (!printed_header) {
+                fprintf(stdout, "\n%-18s %-22s %3s %14s %14s %7s\n",
+                        "built-in vs ispc", "input", "thr", "built-in MP/s", "ispc MP/s", "ratio");
+                printed_header = true;
+            }
+            const double built_in_rate = PerSecond(r.pixels, r.best_seconds) / 1e6;
+            const double ispc_rate = PerSecond(ispc.pixels, ispc.best_seconds) / 1e6;
+            fprintf(stdout, "%-18s %-22s %3d %14.2f %14.2f %7.2f\n", built_in_variant.c_str(), r.input.c_str(),
+                    r.threads, built_in_rate, ispc_rate, ispc_rate > 0 ? built_in_rate / ispc_rate : 0.0);
+        }
+    }
+}
+
+std::string JsonString(const std::string& s) {
+    std::string out = "\"";
+    for(char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char)c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+bool WriteResultJson(const std::string& filename, const BenchOptions& opts, const std::vector<BenchResult>& results) {
+    FILE* f = (filename == "-") ? stdout : fopen(filename.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "Error: could not open %s for writing.\n", filename.c_str());
+        return false;
+    }
+    const CpuFeatures& cpu = GetCpuFeatures();
+    const char* encoder_library = HaveIspcTexcomp() ? "ispc_texcomp" : "none";
+    fprintf(f, "{\n");
+    fprintf(f, "  \"img2ktx_version\": %s,\n", JsonString(img2ktx_build_version).c_str());
+    fprintf(f, "  \"encoder_library\": \"%s\",\n", encoder_library);
+    fprintf(f, "  \"bc_kernel\": \"%s\",\n", BcKernelName(ActiveBcKernel()));
+    fprintf(f, "  \"hardware_threads\": %d,\n", WorkerPool::DefaultThreadCount());
+    fprintf(f, "  \"cpu_features\": {\"sse2\": %s, \"sse41\": %s, \"avx2\": %s, \"avx512f\": %s, \"avx512bw\": %s},\n",
+            cpu.sse2 ? "true" : "false", cpu.sse41 ? "true" : "false",
+            cpu.avx2 ? "true" : "false", cpu.avx512f ? "true" : "false", cpu.avx512bw ? "true" : "false");
+    fprintf(f, "  \"min_seconds\": %g,\n", opts.min_seconds);
+    fprintf(f, "  \"results\": [\n");
+    for(size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        fprintf(f, "    {\"stage\": %s, \"variant\": %s, \"input\": %s, \"width\": %d, \"height\": %d, "
+                "\"threads\": %d, \"iterations\": %d, \"best_seconds\": %.9f, \"pixels\": %llu, \"bytes\": %llu, "
+                "\"megapixels_per_second\": %.3f, \"bytes_per_second\": %.0f, \"peak_rss_bytes\": %llu, "
+                "\"psnr\": %.3f}%s\n",
+                JsonString(r.stage).c_str(), JsonString(r.variant).c_str(), JsonString(r.input).c_str(),
+                r.width, r.height, r.threads, r.iterations, r.best_seconds,
+                (unsigned long long)r.pixels, (unsigned long long)r.bytes,
+                PerSecond(r.pixels, r.best_seconds) / 1e6, PerSecond(r.bytes, r.best_seconds),
+                (unsigned long long)r.peak_rss_bytes, r.psnr, (i + 1 < results.size()) ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    bool ok = (fflush(f) == 0);
+    if (f != stdout) {
+        ok = (fclose(f) == 0) && ok;
+    }
+    return ok;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    BenchOptions opts;
+    bool sizes_given = false;
+    for(int a = 1; a < argc; ++a) {
+        if (strcmp("--sizes", argv[a]) == 0 && a+1 < argc) {
+            if (!ParseIntList(argv[++a], &opts.sizes)) {
+                fprintf(stderr, "Error: sizes must be >= 1.\n");
+                return -1;
+            }
+            sizes_given = true;
+        } else if (strcmp("--threads", argv[a]) == 0 && a+1 < argc) {
+            if (!ParseIntList(argv[++a], &opts.thread_counts)) {
+                fprintf(stderr, "Error: thread counts must be >= 1.\n");
+                return -1;
+            }
+        } else if (strcmp("--formats", argv[a]) == 0 && a+1 < argc) {
+            for(const auto& name : SplitList(argv[++a])) {
+                const GlFormatInfo* format_info = nullptr;
+                for(size_t f = 0; f < g_format_count; ++f) {
+                    if (name == g_formats[f].name) {
+                        format_info = g_formats + f;
+                    }
+                }
+                if (!format_info) {
+                    fprintf(stderr, "Error: unknown format '%s'.\n", name.c_str());
+                    return -1;
+                }
+                if (!FormatAvailable(format_info)) {
+                    fprintf(stderr, "Error: format %s requires ispc_texcomp, which this build does not include.\n",
+                            name.c_str());
+                    return -1;
+                }
+                opts.formats.push_back(format_info);
+            }
+        } else if (strcmp("--quality", argv[a]) == 0 && a+1 < argc) {
+            for(const auto& name : SplitList(argv[++a])) {
+                EncoderQuality quality;
+                if (!ParseEncoderQuality(name.c_str(), &quality)) {
+                    fprintf(stderr, "Error: unknown quality '%s'.\n", name.c_str());
+                    return -1;
+                }
+                opts.qualities.push_back(quality);
+            }
+        } else if (strcmp("--stages", argv[a]) == 0 && a+1 < argc) {
+            opts.stages = SplitList(argv[++a]);
+        } else if (strcmp("--min-time", argv[a]) == 0 && a+1 < argc) {
+            opts.min_seconds = strtod(argv[++a], nullptr);
+        } else if (strcmp("--json", argv[a]) == 0 && a+1 < argc) {
+            opts.json_filename = argv[++a];
+        } else if (strcmp("-h", argv[a]) == 0) {
+            PrintUsage(argv[0]);
+            return 0;
+        } else if (argv[a][0] == '-') {
+            PrintUsage(argv[0]);
+            return -1;
+        } else {
+            opts.input_filenames.push_back(argv[a]);
+        }
+    }
+    if (!sizes_given && opts.input_filenames.empty()) {
+        opts.sizes = { 256, 1024, 2048 };
+    }
+    if (opts.thread_counts.empty()) {
+        opts.thread_counts.push_back(1);
+        if (WorkerPool::DefaultThreadCount() > 1) {
+            opts.thread_counts.push_back(WorkerPool::DefaultThreadCount());
+        }
+    }
+    if (opts.formats.empty()) {
+        for(size_t f = 0; f < g_format_count; ++f) {
+            if (FormatAvailable(g_formats + f)) {
+                opts.formats.push_back(g_formats + f);
+            }
+        }
+    }
+    if (opts.qualities.empty()) {
+        opts.qualities.push_back(kDefaultEncoderQuality);
+    }
+    if (opts.stages.empty()) {
+        opts.stages = { "load", "resize", "mips", "encode", "write" };
+    }
+
+    std::vector<BenchImage> images;
+    for(int size : opts.sizes) {
+        images.push_back(MakeSyntheticImage(size));
+        images.push_back(MakeSparseImage(size));
+    }
+    for(const auto& filename : opts.input_filenames) {
+        BenchImage image;
+        image.filename = filename;
+        size_t slash = filename.find_last_of("/\\");
+        image.name = (slash == std::string::npos) ? filename : filename.substr(slash + 1);
+        stbi_uc* pixels = stbi_load(filename.c_str(), &image.width, &image.height, &image.original_components, 4);
+        if (!pixels) {
+            fprintf(stderr, "Error: could not load %s: %s\n", filename.c_str(), stbi_failure_reason());
+            return 2;
+        }
+        image.pixels.assign(pixels, pixels + (size_t)image.width * image.height * 4);
+        stbi_image_free(pixels);
+        images.push_back(std::move(image));
+    }
+
+    std::vector<BenchResult> results;
+    int encode_status = 0;
+    for(const BenchImage& image : images) {
+        if (HasStage(opts, "load") && !image.filename.empty()) {
+            BenchLoad(opts, image, &results);
+        }
+        if (HasStage(opts, "resize")) {
+            BenchResize(opts, image, &results);
+        }
+        if (HasStage(opts, "mips")) {
+            BenchMips(opts, image, &results);
+        }
+        if (HasStage(opts, "encode")) {
+            const int status = BenchEncode(opts, image, &results);
+            if (encode_status == 0) {
+                encode_status = status;
+            }
+        }
+        if (HasStage(opts, "write")) {
+            BenchWrite(opts, image, &results);
+        }
+    }
+
+    if (opts.json_filename != "-") {
+        PrintResultTable(results);
+        PrintIspcComparison(results);
+    }
+    if (!opts.json_filename.empty() && !WriteResultJson(opts.json_filename, opts, results)) {
+        return 3;
+    }
+    return encode_status;
+}
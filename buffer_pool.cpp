@@ -0,0 +1,119 @@
+#include "buffer_pool.h"
+
+#include <cstdlib>
+#include <utility>
+
+BufferPool::BufferPool(size_t max_cached_bytes, const BufferAllocator& allocator)
+    : m_allocator(allocator), m_max_cached_bytes(max_cached_bytes) {
+}
+
+BufferPool::~BufferPool() {
+    for(auto& block : m_free) {
+        FreeBlock(block.second);
+    }
+}
+
+uint8_t* BufferPool::AllocateBlock(size_t size) {
+    return (uint8_t*)(m_allocator.allocate ? m_allocator.allocate(m_allocator.user, size) : malloc(size));
+}
+
+void BufferPool::FreeBlock(uint8_t* ptr) {
+    if (m_allocator.allocate) {
+        m_allocator.free(m_allocator.user, ptr);
+    } else {
+        free(ptr);
+    }
+}
+
+uint8_t* BufferPool::Acquire(size_t size, size_t* capacity, BufferUsage* usage) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // Take the smallest free block that fits, unless it would waste more
+        // than half of itself.
+        auto it = m_free.lower_bound(size);
+        if (it != m_free.end() && it->first / 2 <= size) {
+            uint8_t* ptr = it->second;
+            *capacity = it->first;
+            m_cached_bytes -= it->first;
+            m_reused_bytes += it->first;
+            m_free.erase(it);
+            if (usage) {
+                usage->reused_bytes += *capacity;
+            }
+            return ptr;
+        }
+        m_allocated_bytes += size;
+    }
+    if (usage) {
+        usage->allocated_bytes += size;
+    }
+    *capacity = size;
+    return AllocateBlock(size > 0 ? size : 1);
+}
+
+void BufferPool::Release(uint8_t* ptr, size_t capacity) {
+    if (!ptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_cached_bytes + capacity <= m_max_cached_bytes) {
+            m_free.insert(std::make_pair(capacity, ptr));
+            m_cached_bytes += capacity;
+            return;
+        }
+    }
+    FreeBlock(ptr);
+}
+
+uint64_t BufferPool::AllocatedBytes() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_allocated_bytes;
+}
+
+uint64_t BufferPool::ReusedBytes() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_reused_bytes;
+}
+
+PixelBuffer& PixelBuffer::operator=(PixelBuffer&& other) noexcept {
+    if (this != &other) {
+        Reset();
+        std::swap(m_ptr, other.m_ptr);
+        std::swap(m_size, other.m_size);
+        std::swap(m_capacity, other.m_capacity);
+        std::swap(m_pool, other.m_pool);
+    }
+    return *this;
+}
+
+void PixelBuffer::Allocate(size_t size, BufferPool* pool, BufferUsage* usage) {
+    Reset();
+    m_ptr = pool->Acquire(size, &m_capacity, usage);
+    m_size = size;
+    m_pool = pool;
+}
+
+void PixelBuffer::Adopt(uint8_t* malloc_ptr, size_t size, BufferPool* pool) {
+    Reset();
+    m_ptr = malloc_ptr;
+    m_size = size;
+    m_capacity = size;
+    m_pool = pool;
+}
+
+void PixelBuffer::Wrap(uint8_t* ptr, size_t size) {
+    Reset();
+    m_ptr = ptr;
+    m_size = size;
+}
+
+void PixelBuffer::Reset() {
+    if (m_ptr && m_pool) {
+        m_pool->Release(m_ptr, m_capacity);
+    }
+    m_ptr = nullptr;
+    m_size = 0;
+    m_capacity = 0;
+    m_pool = nullptr;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+// Where a BufferPool gets its memory: malloc() and free() unless allocate is set.
+struct BufferAllocator {
+    void* (*allocate)(void* user, size_t size) = nullptr;
+    void (*free)(void* user, void* ptr) = nullptr;
+    void* user = nullptr;
+};
+
+// The pixel memory one job took from a BufferPool: new allocations and
+// recycled blocks. May be updated from several threads.
+struct BufferUsage {
+    std::atomic<uint64_t> allocated_bytes{0};
+    std::atomic<uint64_t> reused_bytes{0};
+};
+
+// Recycles large malloc() blocks between layers. Every layer of a job needs
+// the same set of buffer sizes, so freed buffers are usually reused as-is
+// instead of being returned to (and zero-filled again by) the system. Memory
+// from Acquire() is uninitialized. Thread-safe.
+class BufferPool {
+public:
+    explicit BufferPool(size_t max_cached_bytes, const BufferAllocator& allocator = BufferAllocator());
+    ~BufferPool();
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Returns a block of at least size bytes; its actual size is stored in
+    // *capacity. If usage is set, the bytes are also added to it.
+    uint8_t* Acquire(size_t size, size_t* capacity, BufferUsage* usage = nullptr);
+    // Returns a block obtained from Acquire(), or from malloc()/realloc() if
+    // UsesMalloc().
+    void Release(uint8_t* ptr, size_t capacity);
+    // False if blocks come from a custom BufferAllocator.
+    bool UsesMalloc() const { return !m_allocator.allocate; }
+
+    // Total bytes requested from malloc() so far.
+    uint64_t AllocatedBytes() const;
+    // Total bytes handed out from recycled blocks so far.
+    uint64_t ReusedBytes() const;
+
+private:
+    uint8_t* AllocateBlock(size_t size);
+    void FreeBlock(uint8_t* ptr);
+
+    mutable std::mutex m_mutex;
+    BufferAllocator m_allocator;
+    std::multimap<size_t, uint8_t*> m_free;  // capacity -> block
+    size_t m_max_cached_bytes;
+    size_t m_cached_bytes = 0;
+    uint64_t m_allocated_bytes = 0;
+    uint64_t m_reused_bytes = 0;
+};
+
+// An uninitialized, move-only byte buffer that returns its memory to a
+// BufferPool when reset or destroyed (unless it was Wrap()ped).
+class PixelBuffer {
+public:
+    PixelBuffer() = default;
+    PixelBuffer(PixelBuffer&& other) noexcept { *this = std::move(other); }
+    PixelBuffer& operator=(PixelBuffer&& other) noexcept;
+    PixelBuffer(const PixelBuffer&) = delete;
+    PixelBuffer& operator=(const PixelBuffer&) = delete;
+    ~PixelBuffer() { Reset(); }
+
+    // Replaces the contents with size uninitialized bytes from pool, counted
+    // in usage if it is set.
+    void Allocate(size_t size, BufferPool* pool, BufferUsage* usage = nullptr);
+    // Takes ownership of a block from malloc()/realloc() (e.g. from
+    // stbi_load()). pool must UsesMalloc().
+    void Adopt(uint8_t* malloc_ptr, size_t size, BufferPool* pool);
+    // Refers to memory owned by someone else (e.g. a MappedFile); Reset() just forgets it.
+    void Wrap(uint8_t* ptr, size_t size);
+    // Frees the contents.
+    void Reset();
+
+    uint8_t* data() { return m_ptr; }
+    const uint8_t* data() const { return m_ptr; }
+    size_t size() const { return m_size; }
+
+private:
+    uint8_t* m_ptr = nullptr;
+    size_t m_size = 0;
+    size_t m_capacity = 0;
+    BufferPool* m_pool = nullptr;
+};
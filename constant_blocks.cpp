@@ -0,0 +1,260 @@
+#include "constant_blocks.h"
+
+#include "cpu_features.h"
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(IMG2KTX_X86)
+#include <immintrin.h>
+#endif
+#if defined(IMG2KTX_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// Each kernel checks a prefix of the row and returns how many blocks it checked.
+typedef int (*FindConstantBlocksFunc)(const uint8_t* pixels, int stride, int block_dim_x, int block_dim_y,
+        int block_count, uint8_t* constant);
+
+int FindConstantBlocksScalar(const uint8_t* pixels, int stride, int block_dim_x, int block_dim_y,
+        int block_count, uint8_t* constant) {
+    for(int b = 0; b < block_count; ++b) {
+        const uint8_t* block = pixels + b * block_dim_x * 4;
+        bool same = true;
+        for(int y = 0; y < block_dim_y && same; ++y) {
+            for(int x = 0; x < block_dim_x && same; ++x) {
+                same = memcmp(block + y * stride + x * 4, block, 4) == 0;
+            }
+        }
+        constant[b] = same ? 1 : 0;
+    }
+    return block_count;
+}
+
+#if defined(IMG2KTX_X86)
+// One block per iteration, for 4- and 8-pixel-wide blocks: every row of the
+// block is compared with its first pixel, broadcast to all lanes.
+IMG2KTX_TARGET("sse2")
+int FindConstantBlocksSse2(const uint8_t* pixels, int stride, int block_dim_x, int block_dim_y,
+        int block_count, uint8_t* constant) {
+    if (block_dim_x != 4 && block_dim_x != 8) {
+        return 0;
+    }
+    for(int b = 0; b < block_count; ++b) {
+        const uint8_t* block = pixels + b * block_dim_x * 4;
+        const __m128i first = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)block), 0);
+        __m128i same = _mm_set1_epi32(-1);
+        for(int y = 0; y < block_dim_y; ++y) {
+            const uint8_t* row = block + y * stride;
+            same = _mm_and_si128(same, _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)row), first));
+            if (block_dim_x == 8) {
+                same = _mm_and_si128(same, _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(row + 16)), first));
+            }
+        }
+        constant[b] = (_mm_movemask_epi8(same) == 0xFFFF) ? 1 : 0;
+    }
+    return block_count;
+}
+// Two 4-pixel-wide blocks per iteration: each 128-bit lane holds one block's
+// row, so broadcasting within lanes gives each block its own first pixel.
+IMG2KTX_TARGET("avx2")
+int FindConstantBlocksAvx2(const uint8_t* pixels, int stride, int block_dim_x, int block_dim_y,
+        int block_count, uint8_t* constant) {
+    if (block_dim_x != 4) {
+        return 0;
+    }
+    int b = 0;
+    for(; b + 2 <= block_count; b += 2) {
+        const uint8_t* blocks = pixels + b * 16;
+        const __m256i top = _mm256_loadu_si256((const __m256i*)blocks);
+        const __m256i first = _mm256_shuffle_epi32(top, 0);
+        __m256i same = _mm256_cmpeq_epi32(top, first);
+        for(int y = 1; y < block_dim_y; ++y) {
+            same = _mm256_and_si256(same, _mm256_cmpeq_epi32(
+                    _mm256_loadu_si256((const __m256i*)(blocks + y * stride)), first));
+        }
+        const uint32_t mask = (uint32_t)_mm256_movemask_epi8(same);
+        constant[b] = ((mask & 0xFFFF) == 0xFFFF) ? 1 : 0;
+        constant[b + 1] = ((mask >> 16) == 0xFFFF) ? 1 : 0;
+    }
+    return b;
+}
+#endif  // IMG2KTX_X86
+
+#if defined(IMG2KTX_NEON)
+// Same as the SSE2 kernel.
+int FindConstantBlocksNeon(const uint8_t* pixels, int stride, int block_dim_x, int block_dim_y,
+        int block_count, uint8_t* constant) {
+    if (block_dim_x != 4 && block_dim_x != 8) {
+        return 0;
+    }
+    for(int b = 0; b < block_count; ++b) {
+        const uint8_t* block = pixels + b * block_dim_x * 4;
+        const uint32x4_t first = vdupq_n_u32(vgetq_lane_u32(vld1q_u32((const uint32_t*)block), 0));
+        uint32x4_t same = vdupq_n_u32(0xFFFFFFFFu);
+        for(int y = 0; y < block_dim_y; ++y) {
+            const uint8_t* row = block + y * stride;
+            same = vandq_u32(same, vceqq_u32(vld1q_u32((const uint32_t*)row), first));
+            if (block_dim_x == 8) {
+                same = vandq_u32(same, vceqq_u32(vld1q_u32((const uint32_t*)(row + 16)), first));
+            }
+        }
+        const uint32x2_t half = vand_u32(vget_low_u32(same), vget_high_u32(same));
+        constant[b] = (vget_lane_u32(half, 0) & vget_lane_u32(half, 1)) ? 1 : 0;
+    }
+    return block_count;
+}
+#endif  // IMG2KTX_NEON
+
+FindConstantBlocksFunc SelectFindConstantBlocks() {
+#if defined(IMG2KTX_X86)
+    if (GetCpuFeatures().avx2) {
+        return FindConstantBlocksAvx2;
+    }
+    if (GetCpuFeatures().sse2) {
+        return FindConstantBlocksSse2;
+    }
+#elif defined(IMG2KTX_NEON)
+    return FindConstantBlocksNeon;
+#endif
+    return FindConstantBlocksScalar;
+}
+
+// For every 8-bit value, the pair of endpoints whose interpolant at a fixed
+// weight is closest to it (exact where possible); ties go to the pair with
+// the smallest spread, on which differently rounding decoders agree best.
+struct EndpointTable {
+    uint8_t endpoints[256][2];
+};
+
+template<typename ExpandFunc, typename InterpolateFunc>
+EndpointTable BuildEndpointTable(int bits, ExpandFunc expand, InterpolateFunc interpolate) {
+    EndpointTable table = {};
+    for(int v = 0; v < 256; ++v) {
+        int best = INT_MAX;
+        for(int e0 = 0; e0 < (1 << bits); ++e0) {
+            const int a = expand(e0);
+            for(int e1 = 0; e1 < (1 << bits); ++e1) {
+                const int b = expand(e1);
+                const int error = abs(interpolate(a, b) - 3 * v) * 1024 + abs(a - b);
+                if (error < best) {
+                    best = error;
+                    table.endpoints[v][0] = (uint8_t)e0;
+                    table.endpoints[v][1] = (uint8_t)e1;
+                }
+            }
+        }
+    }
+    return table;
+}
+
+// BC1 index 2 is 2/3 of color0 plus 1/3 of color1; interpolants are in thirds.
+int Bc1Interpolate(int a, int b) {
+    return 2 * a + b;
+}
+int Expand5(int x) { return (x << 3) | (x >> 2); }
+int Expand6(int x) { return (x << 2) | (x >> 4); }
+
+const EndpointTable& Bc1Table5() {
+    static const EndpointTable table = BuildEndpointTable(5, Expand5, Bc1Interpolate);
+    return table;
+}
+const EndpointTable& Bc1Table6() {
+    static const EndpointTable table = BuildEndpointTable(6, Expand6, Bc1Interpolate);
+    return table;
+}
+void PutLe16(uint8_t* dst, uint32_t value) {
+    dst[0] = (uint8_t)value;
+    dst[1] = (uint8_t)(value >> 8);
+}
+
+void EncodeConstantColorBlock(const uint8_t rgba[4], uint8_t* dst) {
+    const EndpointTable& t5 = Bc1Table5();
+    const EndpointTable& t6 = Bc1Table6();
+    uint32_t color0 = (t5.endpoints[rgba[0]][0] << 11) | (t6.endpoints[rgba[1]][0] << 5) | t5.endpoints[rgba[2]][0];
+    uint32_t color1 = (t5.endpoints[rgba[0]][1] << 11) | (t6.endpoints[rgba[1]][1] << 5) | t5.endpoints[rgba[2]][1];
+    uint32_t indices = 0xAAAAAAAA;  // index 2 everywhere
+    if (color0 == color1) {
+        indices = 0;  // valid in both 3- and 4-color mode
+    } else if (color0 < color1) {
+        // Stay in 4-color mode; index 3 is 1/3 of color0 plus 2/3 of color1.
+        const uint32_t swap = color0;
+        color0 = color1;
+        color1 = swap;
+        indices = 0xFFFFFFFF;
+    }
+    PutLe16(dst + 0, color0);
+    PutLe16(dst + 2, color1);
+    PutLe16(dst + 4, indices);
+    PutLe16(dst + 6, indices >> 16);
+}
+
+void EncodeConstantChannelBlock(uint8_t value, uint8_t* dst) {
+    dst[0] = value;
+    dst[1] = value;
+    memset(dst + 2, 0, 6);  // index 0 everywhere
+}
+
+void EncodeConstantBC1(const uint8_t rgba[4], uint8_t* dst) {
+    EncodeConstantColorBlock(rgba, dst);
+}
+
+void EncodeConstantBC1a(const uint8_t rgba[4], uint8_t* dst) {
+    if (rgba[3] < 128) {
+        // 3-color mode (color0 <= color1), index 3 (transparent black) everywhere.
+        memset(dst, 0, 4);
+        memset(dst + 4, 0xFF, 4);
+    } else {
+        EncodeConstantColorBlock(rgba, dst);
+    }
+}
+
+void EncodeConstantBC3(const uint8_t rgba[4], uint8_t* dst) {
+    EncodeConstantChannelBlock(rgba[3], dst);
+    EncodeConstantColorBlock(rgba, dst + 8);
+}
+
+void EncodeConstantBC4(const uint8_t rgba[4], uint8_t* dst) {
+    EncodeConstantChannelBlock(rgba[0], dst);
+}
+
+void EncodeConstantBC5(const uint8_t rgba[4], uint8_t* dst) {
+    EncodeConstantChannelBlock(rgba[0], dst);
+    EncodeConstantChannelBlock(rgba[1], dst + 8);
+}
+
+}  // namespace
+
+int FindConstantBlocks(const uint8_t* pixels, int stride, int block_dim_x, int block_dim_y, int block_count,
+        uint8_t* constant) {
+    static const FindConstantBlocksFunc find = SelectFindConstantBlocks();
+    int done = find(pixels, stride, block_dim_x, block_dim_y, block_count, constant);
+    if (done < block_count) {
+        FindConstantBlocksScalar(pixels + done * block_dim_x * 4, stride, block_dim_x, block_dim_y,
+                block_count - done, constant + done);
+    }
+    int count = 0;
+    for(int b = 0; b < block_count; ++b) {
+        count += constant[b];
+    }
+    return count;
+}
+
+ConstantBlockFunc FindConstantBlockEncoder(const GlFormatInfo* format_info) {
+    const char* name = format_info->name;
+    if (strcmp(name, "BC1") == 0) {
+        return EncodeConstantBC1;
+    } else if (strcmp(name, "BC1a") == 0) {
+        return EncodeConstantBC1a;
+    } else if (strcmp(name, "BC3") == 0) {
+        return EncodeConstantBC3;
+    } else if (strcmp(name, "BC4") == 0) {
+        return EncodeConstantBC4;
+    } else if (strcmp(name, "BC5") == 0) {
+        return EncodeConstantBC5;
+    }
+    return nullptr;
+}
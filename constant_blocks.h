@@ -0,0 +1,23 @@
+#pragma once
+
+#include "encoders.h"
+
+#include <cstdint>
+
+// Blocks whose pixels all have the same color (flat or fully transparent
+// areas of atlases and UI textures, and edge padding) have a fixed best
+// encoding in BC1-BC5, so CompressSurface() writes those directly and only
+// hands the remaining blocks to the encoders.
+
+// Sets constant[i] to 1 if every pixel of block i of one row of block_count
+// blocks at pixels (row pitch stride bytes) is the same, else to 0. Returns
+// the number of constant blocks.
+int FindConstantBlocks(const uint8_t* pixels, int stride, int block_dim_x, int block_dim_y, int block_count,
+        uint8_t* constant);
+
+// Writes the encoding of a block whose pixels are all rgba to dst.
+typedef void (*ConstantBlockFunc)(const uint8_t rgba[4], uint8_t* dst);
+
+// Returns null for formats without a constant-block encoding: RGBA, and BC7
+// and ASTC, whose ispc_texcomp encoders have not been measured with the pass.
+ConstantBlockFunc FindConstantBlockEncoder(const GlFormatInfo* format_info);
@@ -0,0 +1,1085 @@
+#include "converter.h"
+
+#include "build_version.h"
+
+#include "animated_gif.h"
+#include "hash64.h"
+#include "mapped_file.h"
+#include "memory_stats.h"
+#include "mip_cache.h"
+#include "quality_scheduler.h"
+#include "supercompress.h"
+#include "tiled_convert.h"
+#include "worker_pool.h"
+
+#pragma warning(push,3)
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#pragma warning(disable:4702)  // unreachable code
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#define STBI_MALLOC(sz) malloc(sz)
+#define STBI_REALLOC(p,newsz) realloc(p,newsz)
+#define STBI_FREE(p) free(p)
+#include <stb_image_resize.h>
+#pragma warning(pop)
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define qprintf(msg, ...) if (!quiet_mode) { printf( (msg), __VA_ARGS__); }
+
+namespace {
+
+// The resources of a Converter that every job shares.
+struct JobContext {
+    WorkerPool* pool;
+    MipCache* cache;  // null without a cache_dir
+    BufferPool* buffers;
+    BufferUsage* buffer_usage;  // this job's share of buffers
+};
+
+// One layer (or cube face) of the output: an input image, or one frame of a GIF.
+struct InputLayer {
+    std::string name;  // the input name, plus "#frame" for GIF frames
+    const char* filename;  // the input name, for messages
+    const ConvertInput* source;
+    std::shared_ptr<GifFrames> gif;  // null for other formats
+    int frame;
+};
+
+// Reads the size and component count of an input without decoding its pixels.
+bool ProbeInput(const ConvertInput& input, int* width, int* height, int* components) {
+    if (input.width > 0) {
+        *width = input.width;
+        *height = input.height;
+        *components = 4;
+        return true;
+    }
+    if (input.data) {
+        return input.size <= INT_MAX && stbi_info_from_memory(input.data, (int)input.size, width, height, components);
+    }
+    return stbi_info(input.filename.c_str(), width, height, components) != 0;
+}
+
+// Decodes an encoded input (not raw pixels) to RGBA, from its file or from memory.
+stbi_uc* DecodeInput(const ConvertInput& input, int* width, int* height, int* components) {
+    if (input.data) {
+        return input.size <= INT_MAX
+            ? stbi_load_from_memory(input.data, (int)input.size, width, height, components, 4) : nullptr;
+    }
+    return stbi_load(input.filename.c_str(), width, height, components, 4);
+}
+
+// Bytes per row of a raw pixel input.
+size_t RawRowPitch(const ConvertInput& input) {
+    return input.row_pitch ? input.row_pitch : (size_t)input.width * 4;
+}
+
+// Blocks -f auto samples across all layers of a job, and at least from each layer.
+const int kAutoFormatSampleBlocks = 4096;
+const int kAutoFormatMinLayerBlocks = 64;
+
+// -f auto: decodes every layer once more on the pool and samples it. Held GIF
+// frames would add nothing, so they are skipped. Returns 0, or the exit code
+// for a decoding error.
+int SampleLayersForAutoFormat(const std::vector<InputLayer>& inputs, WorkerPool& pool, AutoFormatSample* sample) {
+    const int blocks_per_layer = std::max(kAutoFormatMinLayerBlocks, kAutoFormatSampleBlocks / (int)inputs.size());
+    std::vector<AutoFormatSample> samples(inputs.size());
+    std::vector<char> failed(inputs.size(), 0);
+    TaskGroup tasks;
+    for(size_t layer = 0; layer < inputs.size(); ++layer) {
+        const InputLayer& input = inputs[layer];
+        if (input.gif && input.gif->SameAsPreviousFrame(input.frame)) {
+            continue;
+        }
+        pool.Submit([&input, &samples, &failed, layer, blocks_per_layer]() {
+            if (input.gif) {
+                samples[layer].AddImage(input.gif->Frame(input.frame), input.gif->Width(), input.gif->Height(),
+                        (size_t)input.gif->Width() * 4, blocks_per_layer);
+                return;
+            }
+            if (input.source->width > 0) {
+                samples[layer].AddImage(input.source->data, input.source->width, input.source->height,
+                        RawRowPitch(*input.source), blocks_per_layer);
+                return;
+            }
+            int width = 0, height = 0, components = 0;
+            stbi_uc* pixels = DecodeInput(*input.source, &width, &height, &components);
+            if (!pixels) {
+                failed[layer] = 1;
+                return;
+            }
+            samples[layer].AddImage(pixels, width, height, (size_t)width * 4, blocks_per_layer);
+            stbi_image_free(pixels);
+        }, &tasks);
+    }
+    pool.Wait(tasks);
+    for(size_t layer = 0; layer < inputs.size(); ++layer) {
+        if (failed[layer]) {
+            fprintf(stderr, "Error loading input '%s'\n", inputs[layer].filename);
+            return 2;
+        }
+        sample->Append(samples[layer]);
+    }
+    return 0;
+}
+
+// Converts one set of inputs into one KTX file, running all of its work on
+// ctx.pool. Several jobs may share one context concurrently. Fills in the
+// per-layer and per-mip parts of stats; Converter::Convert() fills in the
+// rest. Returns 0 on success, or the process exit code for the first error.
+int RunJob(const ConvertOptions& opts, const JobContext& ctx, JobStats* stats) {
+    WorkerPool& pool = *ctx.pool;
+    MipCache* cache = ctx.cache;
+    BufferPool* buffers = ctx.buffers;
+    BufferUsage* buffer_usage = ctx.buffer_usage;
+    // Inputs in memory need not have a name; give them one for messages.
+    std::vector<std::string> input_names;
+    for(size_t i = 0; i < opts.inputs.size(); ++i) {
+        input_names.push_back(opts.inputs[i].filename.empty()
+            ? "(input " + std::to_string(i) + ")" : opts.inputs[i].filename);
+    }
+    std::vector<const char*> input_filenames;
+    for(const auto& name : input_names) {
+        input_filenames.push_back(name.c_str());
+    }
+    // With an output_buffer, the file is built in memory as if through --mmap.
+    const bool memory_output = (bool)opts.output_buffer;
+    const bool update = !opts.update_filename.empty();
+    const std::string& output_path = update ? opts.update_filename : opts.output_filename;
+    const char *output_filename = (memory_output && output_path.empty()) ? "(memory)" : output_path.c_str();
+    const char *output_format_name = opts.output_format_name.c_str();
+    const bool generate_mipmaps = opts.generate_mipmaps;
+    const MipFilter mip_filter = opts.mip_filter;
+    const bool linear_mips = opts.linear_mips;
+    const bool output_as_cubemap = opts.output_as_cubemap;
+    const bool quiet_mode = opts.quiet_mode;
+    const bool base_resize_enable = opts.base_resize_enable;
+    const int base_resize_width = opts.base_resize_width, base_resize_height = opts.base_resize_height;
+    const int thread_count = pool.ThreadCount();
+    int max_layers_in_flight = opts.max_layers_in_flight;
+    const EncoderQuality quality = opts.quality;
+    const double time_budget_seconds = opts.time_budget_seconds;
+    const double job_start_time = NowSeconds();
+    const bool tiled = opts.tiled;
+    const bool fused = opts.fused;
+    const bool mmap_output = opts.mmap_output || tiled || memory_output;  // tiled bands are written in place
+
+    // Probe the input file(s). Only the headers are read here; pixels are
+    // decoded one layer at a time by the pipeline below. GIFs are the
+    // exception: stb_image can only count their frames by decoding all of
+    // them, so each GIF is decoded here, and each frame becomes one layer.
+    int base_width = 0, base_height = 0;
+    int input_components = 4; // the encoders require 32-bit RGBA input
+    int original_components = 0;
+    std::vector<InputLayer> inputs;
+    std::vector<double> gif_decode_seconds;  // per layer; charged to each GIF's first frame
+    for(size_t i = 0; i < input_filenames.size(); ++i) {
+        const ConvertInput& source = opts.inputs[i];
+        int bw = 0, bh = 0, oc = 0, frame_count = 1;
+        std::shared_ptr<GifFrames> gif;
+        const double decode_start = NowSeconds();
+        const bool is_gif = source.width == 0 &&
+            (source.data ? IsGifData(source.data, source.size) : IsGifFile(source.filename));
+        if (is_gif) {
+            gif = std::make_shared<GifFrames>();
+            if (!(source.data ? gif->LoadFromMemory(source.data, source.size) : gif->Load(source.filename))) {
+                fprintf(stderr, "Error loading input '%s'\n", input_filenames[i]);
+                return 2;
+            }
+            bw = gif->Width();
+            bh = gif->Height();
+            oc = gif->Components();
+            frame_count = gif->FrameCount();
+            stats->bytes_allocated += (uint64_t)bw * bh * 4 * frame_count;
+            qprintf("Decoded %d frames of %s\n", frame_count, input_filenames[i]);
+        } else if (!ProbeInput(source, &bw, &bh, &oc)) {
+            fprintf(stderr, "Error loading input '%s'\n", input_filenames[i]);
+            return 2;
+        }
+        if (i == 0) {
+            base_width = bw;
+            base_height = bh;
+            original_components = oc;
+            if (output_as_cubemap && base_width != base_height) {
+                fprintf(stderr, "Error: when generating cubemaps, input width/height must be equal.\n");
+                fprintf(stderr, "  %s: %d x %d\n", input_filenames[0], base_width, base_height);
+                return 4;
+            }
+        } else if (bw != base_width || bh != base_height) {
+            // Subsequent files must match dimensions of the first
+            fprintf(stderr, "Error: input image dimensions do not match.\n");
+            fprintf(stderr, "  %s: %d x %d\n", input_filenames[0], base_width, base_height);
+            fprintf(stderr, "  %s: %d x %d\n", input_filenames[i], bw, bh);
+            return 3;
+        }
+        for(int frame = 0; frame < frame_count; ++frame) {
+            InputLayer input;
+            input.name = gif ? std::string(input_filenames[i]) + "#" + std::to_string(frame) : input_filenames[i];
+            input.filename = input_filenames[i];
+            input.source = &source;
+            input.gif = gif;
+            input.frame = frame;
+            inputs.push_back(input);
+            gif_decode_seconds.push_back((gif && frame == 0) ? NowSeconds() - decode_start : 0);
+        }
+    }
+    if (output_as_cubemap && (inputs.size() % 6) != 0) {
+        fprintf(stderr, "Error: when generating cubemaps, six images are required per cube.\n");
+        return 4;
+    }
+    // Look up the output format info. -f auto chooses it from a sample of the inputs.
+    const GlFormatInfo *format_info = NULL;
+    if (strcmp(output_format_name, "auto") == 0) {
+        const double sample_start = NowSeconds();
+        AutoFormatSample sample;
+        const int sample_result = SampleLayersForAutoFormat(inputs, pool, &sample);
+        if (sample_result != 0) {
+            return sample_result;
+        }
+        std::vector<AutoFormatTrial> trials;
+        format_info = ChooseAutoFormat(sample, original_components, quality, opts.auto_target_psnr, &trials);
+        output_format_name = format_info->name;
+        stats->format = output_format_name;
+        stats->auto_target_psnr = opts.auto_target_psnr;
+        stats->auto_sampled_blocks = sample.BlockCount();
+        std::string tried;
+        for(const AutoFormatTrial& trial : trials) {
+            char text[64];
+            if (trial.measured) {
+                snprintf(text, sizeof(text), "%s %s %.2f dB", tried.empty() ? "" : ",", trial.format_info->name,
+                        trial.psnr);
+            } else {
+                snprintf(text, sizeof(text), "%s %s (not measured)", tried.empty() ? "" : ",", trial.format_info->name);
+            }
+            tried += text;
+            AutoFormatTrialStats trial_stats;
+            trial_stats.format = trial.format_info->name;
+            trial_stats.psnr = trial.psnr;
+            trial_stats.measured = trial.measured;
+            stats->auto_trials.push_back(trial_stats);
+        }
+        qprintf("Chose format %s for a PSNR target of %.1f dB from %d sampled blocks in %.3f s:%s\n",
+                output_format_name, opts.auto_target_psnr, sample.BlockCount(), NowSeconds() - sample_start,
+                tried.c_str());
+    } else {
+        for(size_t f = 0; f < g_format_count; ++f) {
+            if (strcmp(g_formats[f].name, output_format_name) == 0) {
+                format_info = g_formats + f;
+                break;
+            }
+        }
+    }
+    if (format_info == NULL) {
+        fprintf(stderr, "Error: format %s not supported\n", output_format_name);
+        return 1;
+    }
+    if (!FormatAvailable(format_info)) {
+        fprintf(stderr, "Error: format %s requires ispc_texcomp, which this build of img2ktx does not include\n",
+                output_format_name);
+        return 1;
+    }
+    const int bytes_per_block = format_info->block_bytes;
+    const int block_dim_x = format_info->block_dim_x;
+    const int block_dim_y = format_info->block_dim_y;
+
+    const int input_width = base_width, input_height = base_height;
+    // Optionally, resize the input images
+    if (base_resize_enable) {
+        qprintf("Resizing inputs (old: width=%d height=%d, new: width=%d height=%d, filter=%s)\n",
+                base_width, base_height, base_resize_width, base_resize_height,
+                ResizeFilterName(opts.resize_filter));
+        base_width = base_resize_width;
+        base_height = base_resize_height;
+    }
+
+    // Determine mip chain properties
+    int mip_levels = 1;
+    if (generate_mipmaps) {
+        int mip_w = base_width, mip_h = base_height;
+        while (mip_w > 1 || mip_h > 1) {
+            mip_levels += 1;
+            mip_w = std::max(1, mip_w / 2);
+            mip_h = std::max(1, mip_h / 2);
+        }
+    }
+    stats->width = base_width;
+    stats->height = base_height;
+    stats->mip_levels = mip_levels;
+    std::vector<uint32_t> output_mip_sizes(mip_levels);
+    size_t layer_footprint = 0;  // approximate bytes held by one in-flight layer
+    {
+        int mip_width  = base_width;
+        int mip_height = base_height;
+        for(int mip=0; mip<mip_levels; ++mip) {
+            int num_blocks = ((mip_width  + block_dim_x - 1) / block_dim_x)
+                * ((mip_height + block_dim_y - 1) / block_dim_y);
+            output_mip_sizes[mip] = num_blocks * bytes_per_block;
+            // --fused only holds bands of the levels after the first.
+            const size_t input_bytes = (size_t)num_blocks * block_dim_x * block_dim_y * input_components;
+            layer_footprint += ((fused && mip > 0) ? 0 : input_bytes) + (mmap_output ? 0 : output_mip_sizes[mip]);
+            mip_width  = std::max(1, mip_width  / 2);
+            mip_height = std::max(1, mip_height / 2);
+        }
+    }
+    if (max_layers_in_flight == 0) {
+        max_layers_in_flight = std::max(2, (int)std::min<size_t>(thread_count + 1,
+                opts.in_flight_bytes / std::max<size_t>(layer_footprint, 1)));
+    }
+
+    // Lay out the KTX file
+    KtxHeader header = {};
+    const uint8_t ktx_magic_id[12] = {
+        0xAB, 0x4B, 0x54, 0x58,
+        0x20, 0x31, 0x31, 0xBB,
+        0x0D, 0x0A, 0x1A, 0x0A
+    };
+    memcpy(header.identifier, ktx_magic_id, 12);
+    header.endianness = 0x04030201;
+    header.glType = format_info->gl_type;
+    header.glTypeSize = format_info->gl_type_size;
+    header.glFormat = format_info->gl_format;
+    header.glInternalFormat = format_info->internal_format;
+    header.glBaseInternalFormat = format_info->base_format;
+    header.pixelWidth = base_width;
+    header.pixelHeight = base_height;
+    header.pixelDepth = 0; // must be 0 for 2D/cubemap textures
+    uint32_t real_array_element_count = (uint32_t)(inputs.size() / (output_as_cubemap ? 6 : 1));
+    // KTX spec says this field must be 0 for non-array textures
+    header.numberOfArrayElements = (real_array_element_count > 1) ? real_array_element_count : 0;
+    header.numberOfFaces = output_as_cubemap ? 6 : 1;
+    header.numberOfMipmapLevels = mip_levels;
+    const bool output_ktx2 = opts.ktx2;
+    // KTX1 files store a hash of every layer's input as key/value data, for
+    // --update. The hashes are filled in once every layer is written. Tiled
+    // layers are never held in memory whole, so they are not hashed.
+    const bool store_layer_hashes = !output_ktx2 && !tiled;
+    std::vector<LayerHash> layer_hashes(inputs.size(), LayerHash{0, 0});
+    std::vector<uint8_t> key_value_data;
+    if (store_layer_hashes) {
+        key_value_data = BuildLayerHashKeyValueData(layer_hashes);
+    }
+    header.bytesOfKeyValueData = (uint32_t)key_value_data.size();
+    Ktx2Description ktx2_desc = {};
+    ktx2_desc.format_info = format_info;
+    ktx2_desc.width = header.pixelWidth;
+    ktx2_desc.height = header.pixelHeight;
+    ktx2_desc.layer_count = header.numberOfArrayElements;
+    ktx2_desc.face_count = header.numberOfFaces;
+    ktx2_desc.supercompression = opts.supercompression;
+    ktx2_desc.writer = std::string("img2ktx ") + img2ktx_build_version;
+    if (output_ktx2 && !Ktx2SupportsFormat(format_info)) {
+        fprintf(stderr, "Error: format %s not supported in KTX2 files\n", output_format_name);
+        return 1;
+    }
+    const KtxLayout layout = output_ktx2
+        ? ComputeKtx2Layout(ktx2_desc, output_mip_sizes)
+        : ComputeKtxLayout(header, output_mip_sizes, key_value_data);
+    // Supercompressed files can only be laid out once every level is
+    // compressed, so the pipeline writes an uncompressed KTX2 file next to the
+    // output first.
+    const bool supercompress = output_ktx2 && opts.supercompression != kKtx2SupercompressionNone;
+    const std::string layer_filename = supercompress ? output_path + ".partial" : output_path;
+
+    // With --mmap, every level is compressed straight into its place in the
+    // mapped file. Otherwise the file is opened for reading too, so the writer
+    // can copy already-written duplicate layers.
+    MappedFile output_map;
+    uint8_t* output_memory = nullptr;  // from opts.output_buffer
+    FILE *output_file = nullptr;
+    std::vector<LayerHash> existing_hashes;  // --update: the hashes stored in the file
+    if (update) {
+        // Patch the existing file in place. Its hashes are zeroed first, so an
+        // update that fails part way is redone in full next time.
+        output_file = fopen(output_filename, "r+b");
+        if (!output_file) {
+            fprintf(stderr, "Error opening '%s' for update\n", output_filename);
+            return 3;
+        }
+        std::string mismatch;
+        if (!ReadKtxForUpdate(output_file, header, layout, &existing_hashes, &mismatch)) {
+            fprintf(stderr, "Error: cannot update '%s': %s\n", output_filename, mismatch.c_str());
+            fclose(output_file);
+            return 3;
+        }
+        if (SeekOutput(output_file, sizeof(KtxHeader)) != 0 ||
+                fwrite(key_value_data.data(), 1, key_value_data.size(), output_file) != key_value_data.size() ||
+                fflush(output_file) != 0) {
+            fprintf(stderr, "Error writing output '%s'\n", output_filename);
+            fclose(output_file);
+            return 3;
+        }
+    } else if (memory_output) {
+        output_memory = opts.output_buffer(layout.file_size);
+        if (!output_memory) {
+            fprintf(stderr, "Error: no output buffer for %llu bytes\n", (unsigned long long)layout.file_size);
+            return 3;
+        }
+        // Padding must be zero, as it is in a new mapped file.
+        memset(output_memory, 0, (size_t)layout.file_size);
+        WriteKtxSkeleton(output_memory, layout);
+    } else if (mmap_output) {
+        if (!output_map.Create(layer_filename, layout.file_size)) {
+            fprintf(stderr, "Error mapping output '%s' (%llu bytes)\n", layer_filename.c_str(),
+                    (unsigned long long)layout.file_size);
+            remove(layer_filename.c_str());
+            return 3;
+        }
+        WriteKtxSkeleton(output_map.data(), layout);
+    } else {
+        output_file = fopen(layer_filename.c_str(), "w+b");
+        if (!output_file) {
+            fprintf(stderr, "Error opening output '%s'\n", layer_filename.c_str());
+            return 3;
+        }
+        if (!WriteKtxSkeleton(output_file, layout)) {
+            fprintf(stderr, "Error writing output '%s'\n", layer_filename.c_str());
+            fclose(output_file);
+            remove(layer_filename.c_str());
+            return 3;
+        }
+    }
+    uint8_t* const mapped_output = memory_output ? output_memory : output_map.data();
+
+    // Run the pipeline. This thread decodes (and optionally resizes) one layer
+    // at a time; the worker pool builds each layer's mip chain and compresses it
+    // in strips; the writer thread stores each finished layer at its offset in
+    // the output file and frees it. At most max_layers_in_flight layers are held
+    // in memory at once, regardless of the total layer count.
+    std::vector<ImagePixels> images(inputs.size());
+    TaskGroup tasks;
+    stats->layers.resize(images.size());
+    for(size_t layer = 0; layer < images.size(); ++layer) {
+        stats->layers[layer].input = inputs[layer].name;
+        stats->layers[layer].mips.resize(mip_levels);
+    }
+    // Summed over strips by the workers; copied into stats once all are done.
+    std::unique_ptr<std::atomic<uint64_t>[]> compress_nanoseconds(
+            new std::atomic<uint64_t>[images.size() * mip_levels]());
+    // The RGBA "encoder" is a copy, so there is nothing worth caching.
+    const bool use_cache = cache && strcmp(output_format_name, "RGBA") != 0;
+    std::vector<std::string> encoder_descriptions;
+    for(int q = 0; q < kEncoderQualityCount; ++q) {
+        encoder_descriptions.push_back(EncoderDescription(format_info, original_components, (EncoderQuality)q));
+    }
+    // With --time-budget, levels are assigned qualities as they are queued.
+    std::unique_ptr<QualityScheduler> scheduler;
+    uint64_t blocks_per_layer = 0;
+    for(int mip=0; mip<mip_levels; ++mip) {
+        blocks_per_layer += output_mip_sizes[mip] / bytes_per_block;
+    }
+    if (time_budget_seconds > 0) {
+        if (FormatHasQualityLevels(format_info)) {
+            scheduler.reset(new QualityScheduler(time_budget_seconds - (NowSeconds() - job_start_time),
+                    blocks_per_layer * images.size(), thread_count));
+        } else {
+            qprintf("Note: --time-budget has no effect on format %s\n", output_format_name);
+        }
+    }
+    std::atomic<int> cache_hits(0), cache_misses(0);
+    // Decoded layers that are exact duplicates of an earlier layer are not
+    // compressed at all. Keys are 128-bit hashes of the decoded (and resized)
+    // base level; all layers have the same dimensions.
+    std::map<std::pair<uint64_t, uint64_t>, int> unique_layers;
+    int duplicate_layer_count = 0;
+    int unchanged_layer_count = 0;
+    // Layer hashes also cover the settings that affect a layer's output, so
+    // that --update recompresses everything when those change.
+    // --tiled and --fused build the chain a band at a time, whose box filter
+    // folds odd rows and columns instead of falling back to stb_image_resize,
+    // so their levels can differ from the default path's.
+    char mip_settings[96];
+    snprintf(mip_settings, sizeof(mip_settings), ";mips=%d;mip_filter=%d;linear_mips=%d%s",
+            mip_levels, (int)mip_filter, linear_mips ? 1 : 0, (tiled || fused) ? ";mip_path=banded" : "");
+    const std::string layer_settings = EncoderDescription(format_info, original_components, quality) + mip_settings;
+    const uint64_t layer_hash_seed = Hash64(layer_settings.data(), layer_settings.size());
+    bool scheduler_calibrated = false;
+    std::mutex slot_mutex;
+    int layers_in_flight = 0;
+    auto on_layer_written = [&]() {
+        {
+            std::lock_guard<std::mutex> lock(slot_mutex);
+            layers_in_flight -= 1;
+        }
+        pool.Notify();  // wakes the decode thread's HelpUntil() below
+    };
+    std::unique_ptr<LayerWriter> writer(mapped_output
+        ? new LayerWriter(mapped_output, layout, images, on_layer_written)
+        : new LayerWriter(output_file, layout, images, on_layer_written));
+    // Compressed levels go to their final offset in the mapped file if there
+    // is one, else to a pool buffer that the writer copies out.
+    auto allocate_output = [&](int layer, int mip) {
+        PixelBuffer& output = images[layer].output_mips[mip].bytes;
+        if (mapped_output) {
+            output.Wrap(mapped_output + layout.DataOffset(mip, layer), output_mip_sizes[mip]);
+        } else {
+            output.Allocate(output_mip_sizes[mip], buffers, buffer_usage);
+        }
+    };
+
+    // Frees a layer that will not be compressed. It holds no memory, so its
+    // slot is free again.
+    auto skip_layer = [&](int layer) {
+        stats->layers[layer].mips.clear();
+        if (scheduler) {
+            scheduler->Skip(blocks_per_layer);
+        }
+        std::vector<MipLevel>().swap(images[layer].input_mips);
+        std::vector<MipLevel>().swap(images[layer].output_mips);
+        std::lock_guard<std::mutex> lock(slot_mutex);
+        layers_in_flight -= 1;
+    };
+    // Stores layer as a copy of the already compressed source_layer.
+    auto push_duplicate = [&](int layer, int source_layer) {
+        qprintf("layer %d is a duplicate of layer %d\n", layer, source_layer);
+        stats->layers[layer].duplicate_of = source_layer;
+        duplicate_layer_count += 1;
+        writer->PushDuplicate(layer, source_layer);
+        skip_layer(layer);
+    };
+    // --update: leaves a layer whose hash has not changed as it is in the file.
+    auto push_unchanged = [&](int layer) {
+        qprintf("layer %d is unchanged\n", layer);
+        stats->layers[layer].unchanged = true;
+        unchanged_layer_count += 1;
+        writer->PushUnchanged(layer);
+        skip_layer(layer);
+    };
+
+    // --tiled and --fused: the settings for compressing one layer a band at a
+    // time, except for where each level goes.
+    auto tiled_layer_settings = [&](int layer) {
+        TiledLayerSettings tiled_settings;
+        tiled_settings.format_info = format_info;
+        tiled_settings.original_components = original_components;
+        tiled_settings.quality = quality;
+        tiled_settings.linear_mips = linear_mips;
+        tiled_settings.mip_levels = mip_levels;
+        tiled_settings.max_bands_in_flight = thread_count * 2;
+        tiled_settings.buffers = buffers;
+        tiled_settings.buffer_usage = buffer_usage;
+        int mip_width = base_width, mip_height = base_height;
+        for(int mip = 0; mip < mip_levels; ++mip) {
+            tiled_settings.compress_nanoseconds.push_back(&compress_nanoseconds[layer * mip_levels + mip]);
+            MipStats& mip_stats = stats->layers[layer].mips[mip];
+            mip_stats.width = mip_width;
+            mip_stats.height = mip_height;
+            mip_stats.profile = EncoderProfileName(format_info, original_components, quality);
+            mip_stats.output_bytes = output_mip_sizes[mip];
+            mip_width  = std::max(1, mip_width  / 2);
+            mip_height = std::max(1, mip_height / 2);
+        }
+        return tiled_settings;
+    };
+
+    int result = 0;
+    for(int layer = 0; layer < (int)images.size(); ++layer) {
+        LayerStats& layer_stats = stats->layers[layer];
+        double stage_start = NowSeconds();
+        if (tiled) {
+            // The layer streams through CompressTiledLayer() a band at a time, so
+            // there is no decoded image to hash, cache or hand to the writer.
+            // Reading, downsampling and compression overlap; all of it counts
+            // as decode time.
+            PnmImage image;
+            if (!image.Open(inputs[layer].filename)) {
+                fprintf(stderr, "Error: --tiled input '%s' is not a binary PGM/PPM file with maxval 255\n",
+                        inputs[layer].filename);
+                result = 2;
+                break;
+            }
+            if (image.Width() != input_width || image.Height() != input_height) {
+                fprintf(stderr, "Error: input image dimensions do not match.\n");
+                fprintf(stderr, "  %s: %d x %d\n", input_filenames[0], input_width, input_height);
+                fprintf(stderr, "  %s: %d x %d\n", inputs[layer].filename, image.Width(), image.Height());
+                result = 3;
+                break;
+            }
+            qprintf("Converting %s in bands -- width=%d height=%d comp=%d\n",
+                    inputs[layer].filename, image.Width(), image.Height(), image.Components());
+            TiledLayerSettings tiled_settings = tiled_layer_settings(layer);
+            for(int mip = 0; mip < mip_levels; ++mip) {
+                tiled_settings.mip_outputs.push_back(mapped_output + layout.DataOffset(mip, layer));
+            }
+            CompressTiledLayer(image, tiled_settings, pool);
+            layer_stats.decode_seconds = NowSeconds() - stage_start;
+            continue;
+        }
+        // Wait for a free slot. While waiting, run pool tasks (including
+        // other batch jobs' work) so that this thread is never idle while
+        // work is queued.
+        pool.HelpUntil([&]() {
+            std::lock_guard<std::mutex> lock(slot_mutex);
+            return layers_in_flight < max_layers_in_flight;
+        });
+        {
+            std::lock_guard<std::mutex> lock(slot_mutex);
+            layers_in_flight += 1;
+        }
+        layer_stats.wait_seconds = NowSeconds() - stage_start;
+
+        auto& img = images[layer];
+        // GIF frames were all decoded up front. This layer's reference to its
+        // GIF is dropped at the end of the iteration, so the frames are freed
+        // once the last of them is done.
+        const std::shared_ptr<GifFrames> gif = std::move(inputs[layer].gif);
+        if (gif && gif->SameAsPreviousFrame(inputs[layer].frame)) {
+            // Held frames are common in animations; catch them before the
+            // frame is copied, resized and hashed.
+            layer_hashes[layer] = layer_hashes[layer - 1];
+            const int previous_source = stats->layers[layer - 1].duplicate_of;
+            if (update && layer_hashes[layer] == existing_hashes[layer]) {
+                push_unchanged(layer);
+            } else {
+                push_duplicate(layer, previous_source >= 0 ? previous_source : layer - 1);
+            }
+            continue;
+        }
+        const ConvertInput& source = *inputs[layer].source;
+        int bw = 0, bh = 0, oc = 0;
+        stbi_uc* decoded = nullptr;  // owned pixels, if this layer has its own
+        const stbi_uc* pixels = nullptr;
+        size_t pixels_pitch = 0;
+        stage_start = NowSeconds();
+        if (gif) {
+            bw = gif->Width();
+            bh = gif->Height();
+            oc = gif->Components();
+            pixels = gif->Frame(inputs[layer].frame);
+            pixels_pitch = (size_t)bw * input_components;
+            layer_stats.decode_seconds = gif_decode_seconds[layer];
+        } else if (source.width > 0) {
+            bw = source.width;
+            bh = source.height;
+            oc = input_components;
+            pixels = source.data;
+            pixels_pitch = RawRowPitch(source);
+        } else {
+            decoded = DecodeInput(source, &bw, &bh, &oc);
+            pixels = decoded;
+            pixels_pitch = (size_t)bw * input_components;
+            if (decoded) {
+                stats->bytes_allocated += (uint64_t)bw * bh * input_components;
+            }
+            layer_stats.decode_seconds = NowSeconds() - stage_start;
+        }
+        if (!pixels) {
+            fprintf(stderr, "Error loading input '%s'\n", inputs[layer].filename);
+            result = 2;
+            break;
+        }
+        if (bw != input_width || bh != input_height) {
+            fprintf(stderr, "Error: input image dimensions do not match.\n");
+            fprintf(stderr, "  %s: %d x %d\n", input_filenames[0], input_width, input_height);
+            fprintf(stderr, "  %s: %d x %d\n", inputs[layer].filename, bw, bh);
+            stbi_image_free(decoded);
+            result = 3;
+            break;
+        }
+        qprintf("Loaded %s -- width=%d height=%d comp=%d\n",
+                inputs[layer].name.c_str(), bw, bh, oc);
+
+        // Build the padded input mip level 0. Its width and height must be
+        // padded up to a multiple of the output block dimensions.
+        img.input_mips.resize(mip_levels);
+        img.output_mips.resize(mip_levels);
+        PixelBuffer& level0 = img.input_mips[0].bytes;
+        const int pitch_x0 = ((base_width  + block_dim_x - 1) / block_dim_x) * block_dim_x;
+        const int pitch_y0 = ((base_height + block_dim_y - 1) / block_dim_y) * block_dim_y;
+        const size_t level0_bytes = (size_t)pitch_x0 * pitch_y0 * input_components;
+        stage_start = NowSeconds();
+        if (base_resize_enable) {
+            // Resize straight into the padded buffer, in strips on the pool.
+            level0.Allocate(level0_bytes, buffers, buffer_usage);
+            ResizeImage(pixels, input_width, input_height, pixels_pitch,
+                    level0.data(), base_resize_width, base_resize_height, (size_t)pitch_x0 * input_components,
+                    opts.resize_filter, pool);
+            stbi_image_free(decoded);
+        } else if (!decoded || !buffers->UsesMalloc()) {
+            // The pixels belong to a GIF or the caller, or the pool cannot
+            // adopt the decoder's buffer; copy them out at the padded pitch.
+            level0.Allocate(level0_bytes, buffers, buffer_usage);
+            for(int y = 0; y < base_height; ++y) {
+                memcpy(level0.data() + (size_t)y * pitch_x0 * input_components,
+                        pixels + (size_t)y * pixels_pitch, base_width * input_components);
+            }
+            stbi_image_free(decoded);
+        } else {
+            // Grow the decoder's buffer in place and spread its rows out to the
+            // padded pitch. Rows only move forward, so go from last to first.
+            stbi_uc* padded = (stbi_uc*)realloc(decoded, level0_bytes);
+            if (!padded) {
+                fprintf(stderr, "Error: out of memory loading input '%s'\n", inputs[layer].filename);
+                stbi_image_free(decoded);
+                result = 2;
+                break;
+            }
+            if (pitch_x0 != base_width) {
+                for(int y = base_height - 1; y > 0; --y) {
+                    memmove(padded + (size_t)y * pitch_x0 * input_components,
+                            padded + (size_t)y * base_width * input_components,
+                            base_width * input_components);
+                }
+            }
+            level0.Adopt(padded, level0_bytes, buffers);
+            stats->bytes_allocated += level0_bytes - (size_t)bw * bh * input_components;  // realloc() growth
+        }
+        layer_stats.resize_seconds = NowSeconds() - stage_start;
+        stage_start = NowSeconds();
+        PadSurfaceEdges(level0.data(), base_width, base_height, pitch_x0, pitch_y0);
+        layer_stats.pad_seconds = NowSeconds() - stage_start;
+
+        {
+            stage_start = NowSeconds();
+            const uint64_t lo = Hash64(level0.data(), level0.size(), layer_hash_seed);
+            const uint64_t hi = Hash64(level0.data(), level0.size(), lo);
+            layer_stats.hash_seconds = NowSeconds() - stage_start;
+            layer_hashes[layer] = LayerHash{lo, hi};
+            auto inserted = unique_layers.insert(std::make_pair(std::make_pair(hi, lo), layer));
+            if (update && layer_hashes[layer] == existing_hashes[layer]) {
+                push_unchanged(layer);
+                continue;
+            }
+            if (!inserted.second) {
+                push_duplicate(layer, inserted.first->second);
+                continue;
+            }
+        }
+
+        if (fused) {
+            // Compress level 0 a band at a time, downsampling each band into
+            // the next level while it is still in cache. The other input
+            // levels are never allocated. As with --tiled, this thread drives
+            // the bands and runs pool tasks while it waits for them, so no
+            // pool task ever blocks.
+            TiledLayerSettings fused_settings = tiled_layer_settings(layer);
+            for(int mip = 0; mip < mip_levels; ++mip) {
+                allocate_output(layer, mip);
+                fused_settings.mip_outputs.push_back(img.output_mips[mip].bytes.data());
+            }
+            CompressTiledLayer(level0.data(), base_width, base_height, (size_t)pitch_x0 * input_components,
+                    fused_settings, pool);
+            std::vector<MipLevel>().swap(img.input_mips);
+            writer->Push(layer);
+            continue;
+        }
+
+        if (scheduler && !scheduler_calibrated) {
+            // Time each quality on (up to) a 64x64 corner of the first unique layer.
+            rgba_surface sample = { level0.data(),
+                std::max(block_dim_x, (std::min(pitch_x0, 64) / block_dim_x) * block_dim_x),
+                std::max(block_dim_y, (std::min(pitch_y0, 64) / block_dim_y) * block_dim_y),
+                pitch_x0 * input_components };
+            scheduler->Calibrate(sample, format_info, original_components);
+            scheduler_calibrated = true;
+        }
+
+        pool.Submit([&, layer]() {
+            // At every level, the input width and height must be padded up to a
+            // multiple of the output block dimensions.
+            int mip_width  = base_width;
+            int mip_height = base_height;
+            int mip_pitch_x = ((mip_width  + block_dim_x - 1) / block_dim_x) * block_dim_x;
+            int mip_pitch_y = ((mip_height + block_dim_y - 1) / block_dim_y) * block_dim_y;
+
+            auto& img = images[layer];
+            std::vector<MipStats>& mip_stats = stats->layers[layer].mips;
+            mip_stats[0].width = mip_width;
+            mip_stats[0].height = mip_height;
+            // Generate additional mips, if necessary
+            for(int mip=1; mip<mip_levels; ++mip) {
+                const double generate_start = NowSeconds();
+                int src_width  = mip_width;
+                int src_height = mip_height;
+                int src_pitch_x = mip_pitch_x;
+                //int src_pitch_y = mip_pitch_y;
+                mip_width  = std::max(1, mip_width  / 2);
+                mip_height = std::max(1, mip_height / 2);
+                mip_pitch_x = ((mip_width  + block_dim_x - 1) / block_dim_x) * block_dim_x;
+                mip_pitch_y = ((mip_height + block_dim_y - 1) / block_dim_y) * block_dim_y;
+                if (mapped_output && block_dim_x == 1 && block_dim_y == 1) {
+                    // Uncompressed output is the level itself: downsample straight into the file.
+                    allocate_output(layer, mip);
+                    img.input_mips[mip].bytes = std::move(img.output_mips[mip].bytes);
+                } else {
+                    img.input_mips[mip].bytes.Allocate((size_t)mip_pitch_x * mip_pitch_y * input_components, buffers,
+                            buffer_usage);
+                }
+                //printf("mip %u: width=%d height=%d\n", i, mip_width, mip_height);
+                DownsampleMip(
+                    img.input_mips[mip-1].bytes.data(), src_width, src_height, src_pitch_x * input_components,
+                    img.input_mips[mip].bytes.data(), mip_width, mip_height, mip_pitch_x * input_components,
+                    mip_filter, linear_mips);
+                PadSurfaceEdges(img.input_mips[mip].bytes.data(), mip_width, mip_height, mip_pitch_x, mip_pitch_y);
+                mip_stats[mip].width = mip_width;
+                mip_stats[mip].height = mip_height;
+                mip_stats[mip].generate_seconds = NowSeconds() - generate_start;
+            }
+
+            // Queue compression of each mip level, split into strips of block rows.
+            // Once every level is done, the layer moves on to the writer.
+            auto mips_remaining = std::make_shared<std::atomic<int>>(mip_levels);
+            mip_width = base_width;
+            mip_height = base_height;
+            for(int mip=0; mip<mip_levels; ++mip) {
+                rgba_surface input_surface = {};
+                input_surface.ptr = img.input_mips[mip].bytes.data();
+                input_surface.width  = ((mip_width  + block_dim_x - 1) / block_dim_x) * block_dim_x;
+                input_surface.height = ((mip_height + block_dim_y - 1) / block_dim_y) * block_dim_y;
+                input_surface.stride = input_surface.width * input_components;
+                qprintf("compressing mip %u layer %d: width=%d height=%d pitch_x=%d pitch_y=%d\n",
+                        mip, layer, mip_width, mip_height, input_surface.width, input_surface.height);
+                mip_stats[mip].output_bytes = output_mip_sizes[mip];
+                std::atomic<uint64_t>* mip_compress_nanoseconds = &compress_nanoseconds[layer * mip_levels + mip];
+                const uint64_t mip_blocks = output_mip_sizes[mip] / bytes_per_block;
+                EncoderQuality mip_quality = quality;
+                double reserved_seconds = 0;
+                if (scheduler) {
+                    mip_quality = scheduler->Choose(mip_blocks, &reserved_seconds);
+                }
+                mip_stats[mip].profile = EncoderProfileName(format_info, original_components, mip_quality);
+
+                auto finish_mip = [&, layer, mip, mips_remaining, mip_quality, mip_blocks, reserved_seconds,
+                        mip_compress_nanoseconds]() {
+                    if (scheduler) {
+                        scheduler->Finish(mip_quality, mip_blocks, reserved_seconds,
+                                mip_compress_nanoseconds->load() * 1e-9);
+                    }
+                    // The padded input is no longer needed once this level is compressed.
+                    images[layer].input_mips[mip].bytes.Reset();
+                    if (mips_remaining->fetch_sub(1) == 1) {
+                        std::vector<MipLevel>().swap(images[layer].input_mips);
+                        writer->Push(layer);
+                    }
+                };
+                if (block_dim_x == 1 && block_dim_y == 1) {
+                    // Uncompressed output is the (unpadded) input itself; hand the buffer over.
+                    img.output_mips[mip].bytes = std::move(img.input_mips[mip].bytes);
+                    finish_mip();
+                } else if (!use_cache) {
+                    allocate_output(layer, mip);
+                    SubmitCompressSurface(pool, input_surface, img.output_mips[mip].bytes.data(),
+                            format_info, original_components, mip_quality, &tasks, finish_mip, mip_compress_nanoseconds);
+                } else {
+                    allocate_output(layer, mip);
+                    const double cache_start = NowSeconds();
+                    const MipCacheKey cache_key = MipCache::MakeKey(input_surface.ptr,
+                            img.input_mips[mip].bytes.size(), input_surface.width, input_surface.height,
+                            encoder_descriptions[mip_quality]);
+                    if (cache->Load(cache_key, img.output_mips[mip].bytes.data(), output_mip_sizes[mip])) {
+                        cache_hits += 1;
+                        mip_stats[mip].cache = "hit";
+                        mip_stats[mip].cache_seconds = NowSeconds() - cache_start;
+                        finish_mip();
+                    } else {
+                        cache_misses += 1;
+                        mip_stats[mip].cache = "miss";
+                        mip_stats[mip].cache_seconds = NowSeconds() - cache_start;
+                        SubmitCompressSurface(pool, input_surface, img.output_mips[mip].bytes.data(),
+                                format_info, original_components, mip_quality, &tasks,
+                                [&, layer, mip, cache_key, finish_mip]() {
+                            const double store_start = NowSeconds();
+                            cache->Store(cache_key, images[layer].output_mips[mip].bytes.data(),
+                                    output_mip_sizes[mip]);
+                            stats->layers[layer].mips[mip].cache_seconds += NowSeconds() - store_start;
+                            finish_mip();
+                        }, mip_compress_nanoseconds);
+                    }
+                }
+                mip_width  = std::max(1, mip_width  / 2);
+                mip_height = std::max(1, mip_height / 2);
+            }
+        }, &tasks);
+    }
+    const double finish_start = NowSeconds();
+    pool.Wait(tasks);
+    bool write_ok = writer->Finish();
+    if (store_layer_hashes && write_ok && result == 0) {
+        key_value_data = BuildLayerHashKeyValueData(layer_hashes);
+        if (mapped_output) {
+            memcpy(mapped_output + sizeof(KtxHeader), key_value_data.data(), key_value_data.size());
+        } else {
+            write_ok = SeekOutput(output_file, sizeof(KtxHeader)) == 0 &&
+                fwrite(key_value_data.data(), 1, key_value_data.size(), output_file) == key_value_data.size();
+        }
+    }
+    if (mapped_output && !memory_output) {
+        write_ok = output_map.Close() && write_ok;
+    }
+    stats->finish_seconds = NowSeconds() - finish_start;
+    uint64_t output_file_size = layout.file_size;
+    if (supercompress && write_ok && result == 0) {
+        const double supercompress_start = NowSeconds();
+        if (!output_file) {
+            output_file = fopen(layer_filename.c_str(), "rb");  // written through a mapping
+        }
+        FILE* final_file = fopen(output_filename, "wb");
+        write_ok = output_file && final_file && WriteSupercompressedKtx2(output_file, layout, ktx2_desc,
+                opts.supercompress_level, pool, final_file, &output_file_size);
+        if (final_file) {
+            write_ok = (fclose(final_file) == 0) && write_ok;
+        }
+        if (!write_ok) {
+            remove(output_filename);
+        }
+        stats->supercompress_seconds = NowSeconds() - supercompress_start;
+    }
+    if (output_file) {
+        write_ok = (fclose(output_file) == 0) && write_ok;
+    }
+    if (supercompress) {
+        remove(layer_filename.c_str());
+    }
+    for(size_t layer = 0; layer < images.size(); ++layer) {
+        stats->layers[layer].write_seconds = writer->LayerWriteSeconds((int)layer);
+        for(size_t mip = 0; mip < stats->layers[layer].mips.size(); ++mip) {
+            stats->layers[layer].mips[mip].compress_seconds =
+                compress_nanoseconds[layer * mip_levels + mip].load() * 1e-9;
+        }
+    }
+    stats->cache_hits = cache_hits.load();
+    stats->cache_misses = cache_misses.load();
+    stats->duplicate_layers = duplicate_layer_count;
+    stats->unchanged_layers = unchanged_layer_count;
+    // A failed update leaves the file in place, with its hashes zeroed.
+    if (result != 0) {
+        if (!update && !memory_output) {
+            remove(layer_filename.c_str());
+        }
+        return result;
+    }
+    if (!write_ok) {
+        fprintf(stderr, "Error writing output '%s'\n", output_filename);
+        if (!update && !memory_output) {
+            remove(layer_filename.c_str());
+        }
+        return 3;
+    }
+    stats->output_file_bytes = output_file_size;
+    if (update) {
+        qprintf("Updated %s: %d of %d layers unchanged\n", output_filename, unchanged_layer_count,
+                (int)images.size());
+    }
+    qprintf("Wrote %s (format=%s, mips=%u, layers=%u, faces=%u, size=%llu)\n", output_filename,
+            output_format_name, mip_levels, real_array_element_count, header.numberOfFaces,
+            (unsigned long long)output_file_size);
+    if (supercompress) {
+        qprintf("Supercompressed with %s: %llu bytes before, %.1f%%\n",
+                SupercompressionName(opts.supercompression), (unsigned long long)layout.file_size,
+                100.0 * output_file_size / std::max<uint64_t>(layout.file_size, 1));
+    }
+    if (use_cache) {
+        qprintf("Cache: %d hits, %d misses\n", cache_hits.load(), cache_misses.load());
+    }
+    if (duplicate_layer_count > 0) {
+        qprintf("Deduplicated %d of %d layers (skipped compressing %llu blocks, %.1f%% of the work)\n",
+                duplicate_layer_count, (int)images.size(),
+                (unsigned long long)(blocks_per_layer * duplicate_layer_count),
+                100.0 * duplicate_layer_count / images.size());
+    }
+    
+    return 0;
+}
+
+}  // namespace
+
+const char* CheckConvertOptions(const ConvertOptions& opts, bool use_cache) {
+    if (opts.inputs.empty()) {
+        return "no inputs.";
+    }
+    if (opts.output_format_name.empty()) {
+        return "no output format.";
+    }
+    if (opts.output_filename.empty() && opts.update_filename.empty() && !opts.output_buffer) {
+        return "no output file or buffer.";
+    }
+    if (!opts.update_filename.empty() && (opts.ktx2 || opts.tiled || opts.mmap_output ||
+            opts.time_budget_seconds > 0)) {
+        return "--update requires a .ktx file, and cannot be combined with --tiled, --mmap or --time-budget.";
+    }
+    if (opts.base_resize_enable && (opts.base_resize_width < 1 || opts.base_resize_height < 1)) {
+        return "resize width and height must both be >= 1.";
+    }
+    if (opts.tiled && (opts.base_resize_enable || opts.mip_filter != kMipFilterBox)) {
+        return "--tiled cannot be combined with -r or --mip-filter stb.";
+    }
+    if (opts.fused && (opts.tiled || opts.mip_filter != kMipFilterBox)) {
+        return "--fused cannot be combined with --tiled or --mip-filter stb.";
+    }
+    if ((opts.tiled || opts.fused) && (use_cache || opts.time_budget_seconds > 0)) {
+        // Both compress bands, not whole levels, so there is nothing to cache
+        // or to schedule per level.
+        return "--tiled and --fused cannot be combined with --cache-dir or --time-budget.";
+    }
+    if (opts.tiled && opts.output_format_name == "auto") {
+        return "--tiled cannot be combined with -f auto.";
+    }
+    if (opts.supercompression != kKtx2SupercompressionNone && !opts.ktx2) {
+        return "--supercompress requires a .ktx2 output file.";
+    }
+    if (opts.output_buffer && (opts.mmap_output || opts.tiled || !opts.update_filename.empty() ||
+            opts.supercompression != kKtx2SupercompressionNone)) {
+        return "an output buffer cannot be combined with --mmap, --tiled, --update or --supercompress.";
+    }
+    for(const ConvertInput& input : opts.inputs) {
+        if (input.width > 0 && (!input.data || input.height < 1 || RawRowPitch(input) < (size_t)input.width * 4)) {
+            return "raw inputs need pixels, a height >= 1 and a row pitch of at least width * 4 bytes.";
+        }
+        if (input.width == 0 && (input.data ? input.size == 0 : input.filename.empty())) {
+            return "every input needs a file name, encoded data or raw pixels.";
+        }
+        if (opts.tiled && input.data) {
+            return "--tiled inputs must be files.";
+        }
+    }
+    return nullptr;
+}
+
+Converter::Converter(WorkerPool& pool, const ConverterSettings& settings)
+    : m_pool(pool), m_buffers(settings.buffer_cache_bytes, settings.allocator) {
+    if (!settings.cache_dir.empty()) {
+        m_cache.reset(new MipCache(settings.cache_dir, settings.cache_max_bytes));
+    }
+}
+
+Converter::~Converter() {
+}
+
+// Fills in the parts of stats that RunJob() does not: totals for the whole job
+// and memory use. Buffer pool counts are this job's own, even when other
+// conversions share the pool; peak memory is process-wide.
+int Converter::Convert(const ConvertOptions& opts, JobStats* stats) {
+    JobStats local_stats;
+    if (!stats) {
+        stats = &local_stats;
+    }
+    stats->output = opts.update_filename.empty() ? opts.output_filename : opts.update_filename;
+    stats->format = opts.output_format_name;
+    const char* error = CheckConvertOptions(opts, m_cache != nullptr);
+    if (error) {
+        fprintf(stderr, "Error: %s\n", error);
+        stats->exit_code = -1;
+        return stats->exit_code;
+    }
+    const double start = NowSeconds();
+    BufferUsage buffer_usage;
+    const JobContext ctx = { &m_pool, m_cache.get(), &m_buffers, &buffer_usage };
+    stats->exit_code = RunJob(opts, ctx, stats);
+    stats->total_seconds = NowSeconds() - start;
+    stats->bytes_allocated += buffer_usage.allocated_bytes;
+    stats->bytes_reused = buffer_usage.reused_bytes;
+    stats->peak_rss_bytes = PeakResidentBytes();
+    return stats->exit_code;
+}
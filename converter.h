@@ -0,0 +1,108 @@
+#pragma once
+
+#include "auto_format.h"
+#include "buffer_pool.h"
+#include "encoders.h"
+#include "job_stats.h"
+#include "ktx_file.h"
+#include "mip_downsample.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+class MipCache;
+class WorkerPool;
+
+// The C++ API of libimg2ktx: the whole conversion pipeline, from input images
+// (files, or images already in memory) to a KTX or KTX2 file (on disk, or in a
+// buffer the caller provides). The img2ktx command-line tool is a wrapper
+// around it; the C API in img2ktx.h is another.
+
+// Default memory budget for layers in flight, when max_layers_in_flight is 0.
+const size_t kDefaultInFlightBytes = size_t(1) << 30;
+// Default number of freed pixel buffer bytes a Converter keeps for reuse.
+const size_t kDefaultBufferCacheBytes = size_t(256) << 20;
+// Default size limit of the MipCache directory.
+const uint64_t kDefaultCacheMaxBytes = uint64_t(4) << 30;
+
+// One input image: a file, an encoded image in memory (anything stb_image
+// reads, including animated GIFs), or raw RGBA8 pixels. Memory is owned by the
+// caller and must stay valid until Convert() returns.
+struct ConvertInput {
+    std::string filename;  // the file to read; just a name for messages if data is set
+    const uint8_t* data = nullptr;
+    size_t size = 0;  // encoded image: byte count
+    int width = 0, height = 0;  // raw pixels: the image size; 0 for encoded images
+    size_t row_pitch = 0;  // raw pixels: bytes per row, or 0 for width * 4
+};
+
+struct ConvertOptions {
+    std::vector<ConvertInput> inputs;
+    std::string output_filename;
+    // If set, the file is built in memory instead of being written to
+    // output_filename: called once, with the file size, before anything is
+    // written; returns a caller-owned buffer of that size, or null to fail.
+    // Not compatible with mmap_output, tiled, update_filename or supercompression.
+    std::function<uint8_t*(uint64_t size)> output_buffer;
+    bool ktx2 = false;  // write KTX2 instead of KTX
+    std::string output_format_name;  // a g_formats name, or "auto"
+    double auto_target_psnr = kDefaultAutoFormatPsnr;
+    bool generate_mipmaps = false;
+    MipFilter mip_filter = kMipFilterStb;  // tiled and fused require kMipFilterBox
+    bool linear_mips = false;
+    bool output_as_cubemap = false;
+    bool quiet_mode = false;
+    bool base_resize_enable = false;
+    int base_resize_width = 0, base_resize_height = 0;
+    ResizeFilter resize_filter = kResizeFilterDefault;
+    int max_layers_in_flight = 0;  // 0 = choose from in_flight_bytes
+    size_t in_flight_bytes = kDefaultInFlightBytes;
+    bool mmap_output = false;
+    bool tiled = false;
+    bool fused = false;  // build and compress the mip chain a band at a time
+    std::string update_filename;  // update this file in place; also the output filename
+    EncoderQuality quality = kDefaultEncoderQuality;
+    double time_budget_seconds = 0;  // 0 = no budget
+    Ktx2Supercompression supercompression = kKtx2SupercompressionNone;
+    int supercompress_level = 0;  // 0 = library default
+};
+
+// Returns a description of the first invalid combination of options, or null.
+// use_cache: the conversion will run with a ConverterSettings::cache_dir.
+const char* CheckConvertOptions(const ConvertOptions& opts, bool use_cache = false);
+
+struct ConverterSettings {
+    BufferAllocator allocator;  // for pixel buffers
+    size_t buffer_cache_bytes = kDefaultBufferCacheBytes;
+    std::string cache_dir;  // MipCache directory; none if empty
+    uint64_t cache_max_bytes = kDefaultCacheMaxBytes;
+};
+
+// Everything that outlives a single conversion: the caller's worker pool, the
+// pixel buffers freed by earlier conversions, and the optional MipCache.
+// Keeping one Converter across calls (e.g. for every hot reload) saves
+// reallocating those buffers each time. Convert() may run on several threads
+// at once; all of their work shares the pool.
+class Converter {
+public:
+    Converter(WorkerPool& pool, const ConverterSettings& settings = ConverterSettings());
+    ~Converter();
+    Converter(const Converter&) = delete;
+    Converter& operator=(const Converter&) = delete;
+
+    // Runs one conversion. Errors are reported on stderr. Returns 0 on
+    // success, or the img2ktx exit code for the first error. If stats is
+    // non-null, it receives the timings and counters --stats writes.
+    int Convert(const ConvertOptions& opts, JobStats* stats = nullptr);
+
+    WorkerPool& Pool() { return m_pool; }
+    MipCache* Cache() { return m_cache.get(); }  // null without a cache_dir
+
+private:
+    WorkerPool& m_pool;
+    BufferPool m_buffers;
+    std::unique_ptr<MipCache> m_cache;
+};
@@ -0,0 +1,77 @@
+#include "cpu_features.h"
+
+#include <cstdint>
+
+#if defined(IMG2KTX_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+namespace {
+void Cpuid(int leaf, int subleaf, uint32_t regs[4]) {
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuidex(r, leaf, subleaf);
+    for(int i = 0; i < 4; ++i) {
+        regs[i] = (uint32_t)r[i];
+    }
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+IMG2KTX_TARGET("xsave") uint64_t ReadXcr0() {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+CpuFeatures DetectCpuFeatures() {
+    CpuFeatures f = {};
+    uint32_t regs[4];
+    Cpuid(0, 0, regs);
+    const uint32_t max_leaf = regs[0];
+    if (max_leaf < 1) {
+        return f;
+    }
+    Cpuid(1, 0, regs);
+    f.sse2  = (regs[3] & (1u << 26)) != 0;
+    f.sse41 = (regs[2] & (1u << 19)) != 0;
+    const bool osxsave = (regs[2] & (1u << 27)) != 0;
+    const bool avx = (regs[2] & (1u << 28)) != 0;
+    if (!osxsave || !avx || max_leaf < 7) {
+        return f;
+    }
+    const uint64_t xcr0 = ReadXcr0();
+    const bool os_saves_ymm = (xcr0 & 0x6) == 0x6;
+    const bool os_saves_zmm = (xcr0 & 0xE6) == 0xE6;
+    Cpuid(7, 0, regs);
+    f.avx2 = os_saves_ymm && (regs[1] & (1u << 5)) != 0;
+    const bool avx512f  = (regs[1] & (1u << 16)) != 0;
+    const bool avx512bw = (regs[1] & (1u << 30)) != 0;
+    const bool avx512vl = (regs[1] & (1u << 31)) != 0;
+    f.avx512f = os_saves_zmm && avx512f;
+    f.avx512bw = f.avx512f && avx512bw && avx512vl;
+    return f;
+}
+}  // namespace
+
+const CpuFeatures& GetCpuFeatures() {
+    static const CpuFeatures features = DetectCpuFeatures();
+    return features;
+}
+
+#else  // !IMG2KTX_X86
+
+const CpuFeatures& GetCpuFeatures() {
+    static const CpuFeatures features = {};
+    return features;
+}
+
+#endif
@@ -0,0 +1,31 @@
+#pragma once
+
+// Compile-time architecture detection and runtime CPU feature queries, used to
+// pick SIMD kernels. Kernels for instruction sets beyond the compiler's
+// baseline are compiled with IMG2KTX_TARGET() and only called when the
+// corresponding CpuFeatures flag is set.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define IMG2KTX_X86 1
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define IMG2KTX_NEON 1
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define IMG2KTX_TARGET(isa) __attribute__((target(isa)))
+#else
+#define IMG2KTX_TARGET(isa)  // MSVC allows any intrinsic in any function
+#endif
+
+struct CpuFeatures {
+    bool sse2;
+    bool sse41;
+    bool avx2;
+    bool avx512f;   // AVX-512 F
+    bool avx512bw;  // AVX-512 F + BW + VL
+};
+
+// Detected once, on first use. Flags are only set if the OS also saves the
+// corresponding register state.
+const CpuFeatures& GetCpuFeatures();
@@ -0,0 +1,345 @@
+#include "encoders.h"
+
+#include "bc_encoder.h"
+#include "build_version.h"
+#include "constant_blocks.h"
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+const GlFormatInfo g_formats[] = {
+    { "RGBA",    IMG2KTX_GL_RGBA8,                          IMG2KTX_GL_RGBA,  IMG2KTX_GL_RGBA, IMG2KTX_GL_UNSIGNED_BYTE, 1, 1, 1,  4 },
+    { "BC1",     IMG2KTX_GL_COMPRESSED_RGB_S3TC_DXT1_EXT,   IMG2KTX_GL_RGB,   0,               0,                        1, 4, 4,  8 },
+    { "BC1a",    IMG2KTX_GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,  IMG2KTX_GL_RGBA,  0,               0,                        1, 4, 4,  8 },
+    { "BC3",     IMG2KTX_GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,  IMG2KTX_GL_RGBA,  0,               0,                        1, 4, 4, 16 },
+    { "BC4",     IMG2KTX_GL_COMPRESSED_RED_RGTC1,           IMG2KTX_GL_RED,   0,               0,                        1, 4, 4,  8 },
+    { "BC5",     IMG2KTX_GL_COMPRESSED_RG_RGTC2,            IMG2KTX_GL_RG,    0,               0,                        1, 4, 4, 16 },
+    { "BC7",     IMG2KTX_GL_COMPRESSED_RGBA_BPTC_UNORM_ARB, IMG2KTX_GL_RGBA,  0,               0,                        1, 4, 4, 16 },
+    { "ASTC4x4", IMG2KTX_GL_COMPRESSED_RGBA_ASTC_4x4_KHR,   IMG2KTX_GL_RGBA,  0,               0,                        1, 4, 4, 16 },
+    { "ASTC5x4", IMG2KTX_GL_COMPRESSED_RGBA_ASTC_5x4_KHR,   IMG2KTX_GL_RGBA,  0,               0,                        1, 5, 4, 16 },
+    { "ASTC5x5", IMG2KTX_GL_COMPRESSED_RGBA_ASTC_5x5_KHR,   IMG2KTX_GL_RGBA,  0,               0,                        1, 5, 5, 16 },
+    { "ASTC6x5", IMG2KTX_GL_COMPRESSED_RGBA_ASTC_6x5_KHR,   IMG2KTX_GL_RGBA,  0,               0,                        1, 6, 5, 16 },
+    { "ASTC6x6", IMG2KTX_GL_COMPRESSED_RGBA_ASTC_6x6_KHR,   IMG2KTX_GL_RGBA,  0,               0,                        1, 6, 6, 16 },
+    { "ASTC8x5", IMG2KTX_GL_COMPRESSED_RGBA_ASTC_8x5_KHR,   IMG2KTX_GL_RGBA,  0,               0,                        1, 8, 5, 16 },
+    { "ASTC8x6", IMG2KTX_GL_COMPRESSED_RGBA_ASTC_8x6_KHR,   IMG2KTX_GL_RGBA,  0,               0,                        1, 8, 6, 16 },
+    { "ASTC8x8", IMG2KTX_GL_COMPRESSED_RGBA_ASTC_8x8_KHR,   IMG2KTX_GL_RGBA,  0,               0,                        1, 8, 8, 16 },
+};
+const size_t g_format_count = sizeof(g_formats) / sizeof(g_formats[0]);
+
+namespace {
+
+const char* const kQualityNames[kEncoderQualityCount] = {
+    "ultrafast", "veryfast", "fast", "basic", "slow",
+};
+
+#if defined(IMG2KTX_HAVE_ISPC_TEXCOMP)
+struct Bc7Profile {
+    const char* name;
+    void (*get_settings)(bc7_enc_settings* settings);
+};
+const Bc7Profile kBc7Profiles[kEncoderQualityCount] = {
+    { "ultrafast", GetProfile_ultrafast },
+    { "veryfast",  GetProfile_veryfast },
+    { "fast",      GetProfile_fast },
+    { "basic",     GetProfile_basic },
+    { "slow",      GetProfile_slow },
+};
+const Bc7Profile kBc7AlphaProfiles[kEncoderQualityCount] = {
+    { "alpha_ultrafast", GetProfile_alpha_ultrafast },
+    { "alpha_veryfast",  GetProfile_alpha_veryfast },
+    { "alpha_fast",      GetProfile_alpha_fast },
+    { "alpha_basic",     GetProfile_alpha_basic },
+    { "alpha_slow",      GetProfile_alpha_slow },
+};
+
+// ispc_texcomp has only one RGB ASTC profile and two RGBA ones. The slow RGB
+// setting reuses astc_alpha_slow's search settings with the alpha channel ignored.
+struct AstcProfile {
+    const char* name;
+    void (*get_settings)(astc_enc_settings* settings, int block_width, int block_height);
+    int channels;
+};
+const AstcProfile kAstcProfiles[kEncoderQualityCount] = {
+    { "astc_fast",     GetProfile_astc_fast, 3 },
+    { "astc_fast",     GetProfile_astc_fast, 3 },
+    { "astc_fast",     GetProfile_astc_fast, 3 },
+    { "astc_fast",     GetProfile_astc_fast, 3 },
+    { "astc_slow_rgb", GetProfile_astc_alpha_slow, 3 },
+};
+const AstcProfile kAstcAlphaProfiles[kEncoderQualityCount] = {
+    { "astc_alpha_fast", GetProfile_astc_alpha_fast, 4 },
+    { "astc_alpha_fast", GetProfile_astc_alpha_fast, 4 },
+    { "astc_alpha_fast", GetProfile_astc_alpha_fast, 4 },
+    { "astc_alpha_fast", GetProfile_astc_alpha_fast, 4 },
+    { "astc_alpha_slow", GetProfile_astc_alpha_slow, 4 },
+};
+
+// Profiles only exist for RGB and RGBA inputs; other inputs (grey, grey+alpha)
+// get zeroed settings, as they always have.
+const Bc7Profile* FindBc7Profile(int original_components, EncoderQuality quality) {
+    return (original_components == 3) ? &kBc7Profiles[quality]
+        : (original_components == 4) ? &kBc7AlphaProfiles[quality] : nullptr;
+}
+const AstcProfile* FindAstcProfile(int original_components, EncoderQuality quality) {
+    return (original_components == 3) ? &kAstcProfiles[quality]
+        : (original_components == 4) ? &kAstcAlphaProfiles[quality] : nullptr;
+}
+
+// The settings of every profile, filled in once per process instead of on
+// every call: a converter embedded in a long-running program compresses many
+// small strips and levels with the same few settings. Index 0 of the
+// component dimension holds the zeroed settings for other inputs.
+struct EncoderSettingsTable {
+    bc7_enc_settings bc7[3][kEncoderQualityCount];
+    std::vector<astc_enc_settings> astc;  // [format][components][quality]; only ASTC formats are filled
+
+    EncoderSettingsTable() : bc7(), astc(g_format_count * 3 * kEncoderQualityCount, astc_enc_settings()) {
+        for(int c = 0; c < 3; ++c) {
+            for(int q = 0; q < kEncoderQualityCount; ++q) {
+                if (const Bc7Profile* profile = FindBc7Profile(c + 2, (EncoderQuality)q)) {
+                    profile->get_settings(&bc7[c][q]);
+                }
+                for(size_t f = 0; f < g_format_count; ++f) {
+                    const AstcProfile* profile = FindAstcProfile(c + 2, (EncoderQuality)q);
+                    if (profile && strncmp(g_formats[f].name, "ASTC", 4) == 0) {
+                        astc_enc_settings& settings = astc[(f * 3 + c) * kEncoderQualityCount + q];
+                        profile->get_settings(&settings, g_formats[f].block_dim_x, g_formats[f].block_dim_y);
+                        settings.channels = profile->channels;
+                    }
+                }
+            }
+        }
+    }
+};
+
+const EncoderSettingsTable& GetEncoderSettings() {
+    static const EncoderSettingsTable table;
+    return table;
+}
+
+// Row of EncoderSettingsTable for original_components: 1 for RGB, 2 for RGBA, else 0.
+int SettingsComponentIndex(int original_components) {
+    return (original_components == 3 || original_components == 4) ? original_components - 2 : 0;
+}
+#endif
+
+}  // namespace
+
+const char* EncoderQualityName(EncoderQuality quality) {
+    return kQualityNames[quality];
+}
+
+bool ParseEncoderQuality(const char* name, EncoderQuality* quality) {
+    for(int q = 0; q < kEncoderQualityCount; ++q) {
+        if (strcmp(name, kQualityNames[q]) == 0) {
+            *quality = (EncoderQuality)q;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HaveIspcTexcomp() {
+#if defined(IMG2KTX_HAVE_ISPC_TEXCOMP)
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool FormatAvailable(const GlFormatInfo* format_info) {
+    BcFormat bc_format;
+    if (strcmp(format_info->name, "RGBA") == 0 || FindBcFormat(format_info->name, &bc_format)) {
+        return true;
+    }
+    return HaveIspcTexcomp();
+}
+
+bool FormatHasQualityLevels(const GlFormatInfo* format_info) {
+    return strcmp(format_info->name, "BC7") == 0 || strncmp(format_info->name, "ASTC", 4) == 0;
+}
+
+namespace {
+
+std::atomic<bool> g_constant_block_pass{true};
+
+// Runs the encoder for format_info on every block of input_surface.
+void EncodeBlocks(const rgba_surface* input_surface, uint8_t* dst,
+        const GlFormatInfo* format_info, int original_components, EncoderQuality quality) {
+    const char* output_format_name = format_info->name;
+    BcFormat bc_format;
+    if (FindBcFormat(output_format_name, &bc_format)) {
+        EncodeBcBlocks(input_surface, dst, bc_format);
+#if defined(IMG2KTX_HAVE_ISPC_TEXCOMP)
+    } else if (strcmp(output_format_name, "BC7") == 0) {
+        // ispc_texcomp takes non-const settings, but does not modify them.
+        bc7_enc_settings* enc_settings = const_cast<bc7_enc_settings*>(
+                &GetEncoderSettings().bc7[SettingsComponentIndex(original_components)][quality]);
+        CompressBlocksBC7(input_surface, dst, enc_settings);
+    } else if (strncmp(output_format_name, "ASTC", 4) == 0) {
+        size_t f = 0;
+        while (f + 1 < g_format_count && strcmp(g_formats[f].name, output_format_name) != 0) {
+            ++f;
+        }
+        astc_enc_settings* enc_settings = const_cast<astc_enc_settings*>(&GetEncoderSettings().astc[
+                (f * 3 + SettingsComponentIndex(original_components)) * kEncoderQualityCount + quality]);
+        CompressBlocksASTC(input_surface, dst, enc_settings);
+#else
+    } else {
+        (void)original_components;
+        (void)quality;
+#endif
+    }
+}
+
+}  // namespace
+
+void ForceConstantBlockPass(bool enabled) {
+    g_constant_block_pass.store(enabled, std::memory_order_relaxed);
+}
+
+void CompressSurface(const rgba_surface* input_surface, uint8_t* dst,
+        const GlFormatInfo* format_info, int original_components, EncoderQuality quality) {
+    if (strcmp(format_info->name, "RGBA") == 0) {
+        for(int y = 0; y < input_surface->height; ++y) {
+            memcpy(dst + y * input_surface->width * 4,
+                    input_surface->ptr + y * input_surface->stride,
+                    input_surface->width * 4);
+        }
+        return;
+    }
+    const ConstantBlockFunc encode_constant = g_constant_block_pass.load(std::memory_order_relaxed)
+        ? FindConstantBlockEncoder(format_info) : nullptr;
+    const int block_dim_x = format_info->block_dim_x;
+    const int block_dim_y = format_info->block_dim_y;
+    const int block_bytes = format_info->block_bytes;
+    const int blocks_x = input_surface->width / block_dim_x;
+    const int block_rows = input_surface->height / block_dim_y;
+    const int block_count = blocks_x * block_rows;
+    std::vector<uint8_t> constant(encode_constant ? block_count : 0);
+    int constant_count = 0;
+    for(int row = 0; row < block_rows && encode_constant; ++row) {
+        constant_count += FindConstantBlocks(input_surface->ptr + (size_t)row * block_dim_y * input_surface->stride,
+                input_surface->stride, block_dim_x, block_dim_y, blocks_x, constant.data() + row * blocks_x);
+    }
+    if (constant_count == 0) {
+        EncodeBlocks(input_surface, dst, format_info, original_components, quality);
+        return;
+    }
+    // Constant blocks are written directly. The others are gathered into one
+    // row of blocks, encoded in one call and scattered back, so the encoder
+    // sees the whole strip at once however the constant blocks break it up.
+    const int gathered_count = block_count - constant_count;
+    const size_t block_row_pixel_bytes = (size_t)block_dim_x * 4;
+    const int gathered_stride = gathered_count * block_dim_x * 4;
+    std::vector<uint8_t> gathered((size_t)gathered_stride * block_dim_y);
+    std::vector<uint8_t> encoded((size_t)gathered_count * block_bytes);
+    int g = 0;
+    for(int b = 0; b < block_count; ++b) {
+        const uint8_t* block_pixels = input_surface->ptr +
+            (size_t)(b / blocks_x) * block_dim_y * input_surface->stride + (b % blocks_x) * block_row_pixel_bytes;
+        if (constant[b]) {
+            encode_constant(block_pixels, dst + (size_t)b * block_bytes);
+            continue;
+        }
+        for(int y = 0; y < block_dim_y; ++y) {
+            memcpy(&gathered[(size_t)y * gathered_stride + g * block_row_pixel_bytes],
+                    block_pixels + (size_t)y * input_surface->stride, block_row_pixel_bytes);
+        }
+        g += 1;
+    }
+    if (gathered_count > 0) {
+        rgba_surface gathered_surface = { gathered.data(), gathered_count * block_dim_x, block_dim_y, gathered_stride };
+        EncodeBlocks(&gathered_surface, encoded.data(), format_info, original_components, quality);
+    }
+    g = 0;
+    for(int b = 0; b < block_count; ++b) {
+        if (!constant[b]) {
+            memcpy(dst + (size_t)b * block_bytes, &encoded[(size_t)g * block_bytes], block_bytes);
+            g += 1;
+        }
+    }
+}
+
+void PadSurfaceEdges(uint8_t* pixels, int width, int height, int pitch_x, int pitch_y) {
+    const size_t row_bytes = (size_t)pitch_x * 4;
+    if (pitch_x > width) {
+        for(int y = 0; y < height; ++y) {
+            uint8_t* row = pixels + y * row_bytes;
+            for(int x = width; x < pitch_x; ++x) {
+                memcpy(row + x * 4, row + (width - 1) * 4, 4);
+            }
+        }
+    }
+    const uint8_t* last_row = pixels + (size_t)(height - 1) * row_bytes;
+    for(int y = height; y < pitch_y; ++y) {
+        memcpy(pixels + y * row_bytes, last_row, row_bytes);
+    }
+}
+
+const char* EncoderProfileName(const GlFormatInfo* format_info, int original_components,
+        EncoderQuality quality) {
+#if defined(IMG2KTX_HAVE_ISPC_TEXCOMP)
+    if (strcmp(format_info->name, "BC7") == 0) {
+        const Bc7Profile* profile = FindBc7Profile(original_components, quality);
+        return profile ? profile->name : "none";
+    } else if (strncmp(format_info->name, "ASTC", 4) == 0) {
+        const AstcProfile* profile = FindAstcProfile(original_components, quality);
+        return profile ? profile->name : "none";
+    }
+#else
+    (void)original_components;
+    (void)quality;
+#endif
+    return "default";
+}
+
+std::string EncoderDescription(const GlFormatInfo* format_info, int original_components,
+        EncoderQuality quality) {
+    char desc[256];
+    snprintf(desc, sizeof(desc), "img2ktx %s;format=%s/0x%04X/%ux%u/%u;profile=%s",
+            img2ktx_build_version, format_info->name, format_info->internal_format,
+            format_info->block_dim_x, format_info->block_dim_y, format_info->block_bytes,
+            EncoderProfileName(format_info, original_components, quality));
+    return desc;
+}
+
+// Target number of input pixels per compression strip. Large enough to amortize
+// task overhead, small enough that a single big surface spreads across all workers.
+const int kStripTargetPixels = 64 * 1024;
+
+void SubmitCompressSurface(WorkerPool& pool, const rgba_surface& input_surface, uint8_t* dst,
+        const GlFormatInfo* format_info, int original_components, EncoderQuality quality, TaskGroup* group,
+        std::function<void()> on_complete, std::atomic<uint64_t>* busy_nanoseconds) {
+    const int block_dim_x = format_info->block_dim_x;
+    const int block_dim_y = format_info->block_dim_y;
+    const int block_rows = input_surface.height / block_dim_y;
+    const size_t block_row_bytes = (size_t)(input_surface.width / block_dim_x) * format_info->block_bytes;
+    const int strip_block_rows = std::max(1, kStripTargetPixels / (input_surface.width * block_dim_y));
+    const int strip_count = (block_rows + strip_block_rows - 1) / strip_block_rows;
+    auto strips_remaining = std::make_shared<std::atomic<int>>(strip_count);
+    for(int strip = 0; strip < strip_count; ++strip) {
+        const int first_block_row = strip * strip_block_rows;
+        rgba_surface strip_surface = input_surface;
+        strip_surface.ptr = input_surface.ptr + (size_t)first_block_row * block_dim_y * input_surface.stride;
+        strip_surface.height = std::min(strip_block_rows, block_rows - first_block_row) * block_dim_y;
+        uint8_t* strip_dst = dst + first_block_row * block_row_bytes;
+        pool.Submit([=]() {
+            const auto start = std::chrono::steady_clock::now();
+            CompressSurface(&strip_surface, strip_dst, format_info, original_components, quality);
+            if (busy_nanoseconds) {
+                *busy_nanoseconds += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start).count();
+            }
+            if (strips_remaining->fetch_sub(1) == 1 && on_complete) {
+                on_complete();
+            }
+        }, group);
+    }
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "ispc_texcomp.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+class TaskGroup;
+class WorkerPool;
+
+enum {
+    // For glFormat
+    IMG2KTX_GL_RED                           = 0x1903,
+    IMG2KTX_GL_RG                            = 0x8227,
+    IMG2KTX_GL_RGB                           = 0x1907,
+    IMG2KTX_GL_RGBA                          = 0x1908,
+
+    // For glType
+    IMG2KTX_GL_UNSIGNED_BYTE                 = 0x1401,
+    
+    // For glInternalFormat
+    IMG2KTX_GL_RGBA8                                  = 0x8058,
+    IMG2KTX_GL_COMPRESSED_RGB_S3TC_DXT1_EXT           = 0x83F0, // BC1 (no alpha)
+    IMG2KTX_GL_COMPRESSED_RGBA_S3TC_DXT1_EXT          = 0x83F1, // BC1 (alpha)
+    IMG2KTX_GL_COMPRESSED_RGBA_S3TC_DXT5_EXT          = 0x83F3, // BC3
+    IMG2KTX_GL_COMPRESSED_RED_RGTC1                   = 0x8DBB, // BC4
+    IMG2KTX_GL_COMPRESSED_RG_RGTC2                    = 0x8DBD, // BC5
+    IMG2KTX_GL_COMPRESSED_RGBA_BPTC_UNORM_ARB         = 0x8E8C, // BC7
+    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_4x4_KHR           = 0x93B0,
+    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_5x4_KHR           = 0x93B1,
+    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_5x5_KHR           = 0x93B2,
+    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_6x5_KHR           = 0x93B3,
+    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_6x6_KHR           = 0x93B4,
+    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_8x5_KHR           = 0x93B5,
+    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_8x6_KHR           = 0x93B6,
+    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_8x8_KHR           = 0x93B7,
+    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_10x5_KHR          = 0x93B8,
+    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_10x6_KHR          = 0x93B9,
+    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_10x8_KHR          = 0x93BA,
+    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_10x10_KHR         = 0x93BB,
+    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_12x10_KHR         = 0x93BC,
+    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_12x12_KHR         = 0x93BD,
+    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR   = 0x93D0,
+    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_5x4_KHR   = 0x93D1,
+    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_5x5_KHR   = 0x93D2,
+    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_6x5_KHR   = 0x93D3,
+    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_6x6_KHR   = 0x93D4,
+    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_8x5_KHR   = 0x93D5,
+    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_8x6_KHR   = 0x93D6,
+    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_8x8_KHR   = 0x93D7,
+    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_10x5_KHR  = 0x93D8,
+    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_10x6_KHR  = 0x93D9,
+    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_10x8_KHR  = 0x93DA,
+    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_10x10_KHR = 0x93DB,
+    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_12x10_KHR = 0x93DC,
+    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_12x12_KHR = 0x93DD,
+};
+
+struct GlFormatInfo {
+    const char *name;
+    uint32_t internal_format;
+    uint32_t base_format;
+    uint32_t gl_format;     // channel count, effectively (RGB, RGBA, etc). For compressed formats, format=0.
+    uint32_t gl_type;       // type of each channel. For compressed formats, type=0.
+    uint32_t gl_type_size;  // size in bytes of gl_type for endianness conversion. for compressed types, size=1.
+    uint32_t block_dim_x;
+    uint32_t block_dim_y;
+    uint32_t block_bytes;
+};
+extern const GlFormatInfo g_formats[];
+extern const size_t g_format_count;
+
+// Speed/quality trade-off for encoders that have profiles (BC7 and ASTC), in
+// order of increasing quality. Other formats ignore it.
+enum EncoderQuality {
+    kQualityUltrafast,
+    kQualityVeryfast,
+    kQualityFast,
+    kQualityBasic,
+    kQualitySlow,
+    kEncoderQualityCount,
+};
+const EncoderQuality kDefaultEncoderQuality = kQualityBasic;
+
+const char* EncoderQualityName(EncoderQuality quality);
+// Returns false if name is not one of the EncoderQualityName() strings.
+bool ParseEncoderQuality(const char* name, EncoderQuality* quality);
+// True if img2ktx was built with ispc_texcomp.
+bool HaveIspcTexcomp();
+// False for formats that need ispc_texcomp (BC7, ASTC) when img2ktx was built
+// without it.
+bool FormatAvailable(const GlFormatInfo* format_info);
+// True if EncoderQuality affects the output of this format.
+bool FormatHasQualityLevels(const GlFormatInfo* format_info);
+
+// Compresses one padded input surface into dst, which must have room for every
+// block of the surface. Safe to call concurrently on disjoint outputs.
+void CompressSurface(const rgba_surface* input_surface, uint8_t* dst,
+        const GlFormatInfo* format_info, int original_components, EncoderQuality quality);
+// Turns CompressSurface()'s constant-block pass (see constant_blocks.h) on,
+// the default, or off. Meant for benchmarks; must not be called while
+// surfaces are being compressed.
+void ForceConstantBlockPass(bool enabled);
+
+// Fills the padding of a block-padded RGBA surface (everything outside the
+// top-left width x height pixels) by replicating the last valid column and row.
+void PadSurfaceEdges(uint8_t* pixels, int width, int height, int pitch_x, int pitch_y);
+
+// Names the encoder profile CompressSurface() uses for these parameters.
+const char* EncoderProfileName(const GlFormatInfo* format_info, int original_components,
+        EncoderQuality quality);
+
+// Identifies everything besides the input pixels that determines the output of
+// CompressSurface(), for use in MipCache keys.
+std::string EncoderDescription(const GlFormatInfo* format_info, int original_components,
+        EncoderQuality quality);
+
+// Splits a padded input surface into horizontal strips of whole block rows and
+// queues one compression task per strip in group. Each strip writes a disjoint
+// range of dst. on_complete (if any) runs on whichever thread finishes the last strip.
+// If busy_nanoseconds is non-null, each strip adds the time it spent encoding.
+void SubmitCompressSurface(WorkerPool& pool, const rgba_surface& input_surface, uint8_t* dst,
+        const GlFormatInfo* format_info, int original_components, EncoderQuality quality, TaskGroup* group,
+        std::function<void()> on_complete, std::atomic<uint64_t>* busy_nanoseconds = nullptr);
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// 64-bit non-cryptographic hash of a byte range (the XXH64 algorithm).
+// Fast enough to run over every decoded pixel; used to identify content.
+uint64_t Hash64(const void* data, size_t len, uint64_t seed = 0);
@@ -1,437 +1,520 @@
-#include "build_version.h"
-
-#include "ispc_texcomp.h"
-
-#pragma warning(push,3)
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
-
-#pragma warning(disable:4702)  // unreachable code
-#define STB_IMAGE_RESIZE_IMPLEMENTATION
-#define STBI_MALLOC(sz) malloc(sz)
-#define STBI_REALLOC(p,newsz) realloc(p,newsz)
-#define STBI_FREE(p) free(p)
-#include <stb_image_resize.h>
-#pragma warning(pop)
-
-#include <algorithm>
-#include <cassert>
-#include <cstdio>
-#include <cstdlib>
-#include <vector>
-
-enum {
-    // For glFormat
-    IMG2KTX_GL_RED                           = 0x1903,
-    IMG2KTX_GL_RG                            = 0x8227,
-    IMG2KTX_GL_RGB                           = 0x1907,
-    IMG2KTX_GL_RGBA                          = 0x1908,
-
-    // For glType
-    IMG2KTX_GL_UNSIGNED_BYTE                 = 0x1401,
-    
-    // For glInternalFormat
-    IMG2KTX_GL_RGBA8                                  = 0x8058,
-    IMG2KTX_GL_COMPRESSED_RGB_S3TC_DXT1_EXT           = 0x83F0, // BC1 (no alpha)
-    IMG2KTX_GL_COMPRESSED_RGBA_S3TC_DXT1_EXT          = 0x83F1, // BC1 (alpha)
-    IMG2KTX_GL_COMPRESSED_RGBA_S3TC_DXT5_EXT          = 0x83F3, // BC3
-    IMG2KTX_GL_COMPRESSED_RGBA_BPTC_UNORM_ARB         = 0x8E8C, // BC7
-    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_4x4_KHR           = 0x93B0,
-    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_5x4_KHR           = 0x93B1,
-    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_5x5_KHR           = 0x93B2,
-    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_6x5_KHR           = 0x93B3,
-    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_6x6_KHR           = 0x93B4,
-    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_8x5_KHR           = 0x93B5,
-    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_8x6_KHR           = 0x93B6,
-    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_8x8_KHR           = 0x93B7,
-    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_10x5_KHR          = 0x93B8,
-    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_10x6_KHR          = 0x93B9,
-    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_10x8_KHR          = 0x93BA,
-    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_10x10_KHR         = 0x93BB,
-    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_12x10_KHR         = 0x93BC,
-    IMG2KTX_GL_COMPRESSED_RGBA_ASTC_12x12_KHR         = 0x93BD,
-    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR   = 0x93D0,
-    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_5x4_KHR   = 0x93D1,
-    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_5x5_KHR   = 0x93D2,
-    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_6x5_KHR   = 0x93D3,
-    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_6x6_KHR   = 0x93D4,
-    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_8x5_KHR   = 0x93D5,
-    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_8x6_KHR   = 0x93D6,
-    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_8x8_KHR   = 0x93D7,
-    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_10x5_KHR  = 0x93D8,
-    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_10x6_KHR  = 0x93D9,
-    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_10x8_KHR  = 0x93DA,
-    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_10x10_KHR = 0x93DB,
-    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_12x10_KHR = 0x93DC,
-    IMG2KTX_GL_COMPRESSED_SRGB8_ALPHA8_ASTC_12x12_KHR = 0x93DD,
-};
-
-struct GlFormatInfo {
-    const char *name;
-    uint32_t internal_format;
-    uint32_t base_format;
-    uint32_t gl_format;     // channel count, effectively (RGB, RGBA, etc). For compressed formats, format=0.
-    uint32_t gl_type;       // type of each channel. For compressed formats, type=0.
-    uint32_t gl_type_size;  // size in bytes of gl_type for endianness conversion. for compressed types, size=1.
-    uint32_t block_dim_x;
-    uint32_t block_dim_y;
-    uint32_t block_bytes;
-};
-const GlFormatInfo g_formats[] = {
-    { "RGBA",    IMG2KTX_GL_RGBA8,                          IMG2KTX_GL_RGBA,  IMG2KTX_GL_RGBA, IMG2KTX_GL_UNSIGNED_BYTE, 1, 1, 1,  4 },
-    { "BC1",     IMG2KTX_GL_COMPRESSED_RGB_S3TC_DXT1_EXT,   IMG2KTX_GL_RGB,   0,               0,                        1, 4, 4,  8 },
-    { "BC1a",    IMG2KTX_GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,  IMG2KTX_GL_RGBA,  0,               0,                        1, 4, 4, 16 },
-    { "BC3",     IMG2KTX_GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,  IMG2KTX_GL_RGBA,  0,               0,                        1, 4, 4, 16 },
-    { "BC7",     IMG2KTX_GL_COMPRESSED_RGBA_BPTC_UNORM_ARB, IMG2KTX_GL_RGBA,  0,               0,                        1, 4, 4, 16 },
-    { "ASTC4x4", IMG2KTX_GL_COMPRESSED_RGBA_ASTC_4x4_KHR,   IMG2KTX_GL_RGBA,  0,               0,                        1, 4, 4, 16 },
-    { "ASTC5x4", IMG2KTX_GL_COMPRESSED_RGBA_ASTC_5x4_KHR,   IMG2KTX_GL_RGBA,  0,               0,                        1, 5, 4, 16 },
-    { "ASTC5x5", IMG2KTX_GL_COMPRESSED_RGBA_ASTC_5x5_KHR,   IMG2KTX_GL_RGBA,  0,               0,                        1, 5, 5, 16 },
-    { "ASTC6x5", IMG2KTX_GL_COMPRESSED_RGBA_ASTC_6x5_KHR,   IMG2KTX_GL_RGBA,  0,               0,                        1, 6, 5, 16 },
-    { "ASTC6x6", IMG2KTX_GL_COMPRESSED_RGBA_ASTC_6x6_KHR,   IMG2KTX_GL_RGBA,  0,               0,                        1, 6, 6, 16 },
-    { "ASTC8x5", IMG2KTX_GL_COMPRESSED_RGBA_ASTC_8x5_KHR,   IMG2KTX_GL_RGBA,  0,               0,                        1, 8, 5, 16 },
-    { "ASTC8x6", IMG2KTX_GL_COMPRESSED_RGBA_ASTC_8x6_KHR,   IMG2KTX_GL_RGBA,  0,               0,                        1, 8, 6, 16 },
-    { "ASTC8x8", IMG2KTX_GL_COMPRESSED_RGBA_ASTC_8x8_KHR,   IMG2KTX_GL_RGBA,  0,               0,                        1, 8, 8, 16 },
-};
-const size_t g_format_count = sizeof(g_formats) / sizeof(g_formats[0]);
-
-struct MipLevel {
-    std::vector<uint8_t> bytes;
-};
-struct ImagePixels {
-    stbi_uc* packed;  // base mip level only, tightly packed
-    std::vector<MipLevel> input_mips;  // padded
-    std::vector<MipLevel> output_mips;
-};
-
-
-struct KtxHeader {
-    uint8_t identifier[12];
-    uint32_t endianness;
-    uint32_t glType;
-    uint32_t glTypeSize;
-    uint32_t glFormat;
-    uint32_t glInternalFormat;
-    uint32_t glBaseInternalFormat;
-    uint32_t pixelWidth;
-    uint32_t pixelHeight;
-    uint32_t pixelDepth;
-    uint32_t numberOfArrayElements;
-    uint32_t numberOfFaces;
-    uint32_t numberOfMipmapLevels;
-    uint32_t bytesOfKeyValueData;
-};
-
-void PrintVersion() {
-  fprintf(stdout, "img2ktx %s\n", img2ktx_build_version);
-}
-
-void PrintUsage(char *argv[]) {
-    PrintVersion();
-    fprintf(stdout, "Usage: %s [options] [input]\n", argv[0]);
-    fprintf(stdout, R"options(options:
-  -o [out.ktx]      Output file [required]
-  -f [format]       Output format [required]
-  -r [width height] Resize input to width x height before conversion.
-                    Provided dimensions must both be >= 1.
-  -m                Enable mipmap generation
-  -c                Enable cubemap output. Each set of six input images will be
-                    treated as one cubemap. Face order is +X -X +Y -Y +Z -Z.
-  -q                Enable quiet mode (suppress non-error console output)
-  -h                Displays this help message
-  -v                Displays version information\)options");
-    fprintf(stdout, "formats:\n  ");
-    for(int i=0; i<g_format_count; ++i) {
-        fprintf(stdout, "%s ", g_formats[i].name);
-    }
-    fprintf(stdout, "\n");
-}
-
-#define qprintf(msg, ...) if (!quiet_mode) { printf( (msg), __VA_ARGS__); }
-
-int main(int argc, char *argv[]) {
-    std::vector<char*> input_filenames;
-    const char *output_filename = nullptr;
-    const char *output_format_name = nullptr;
-    bool generate_mipmaps = false;
-    bool output_as_cubemap = false;
-    bool quiet_mode = false;
-    bool base_resize_enable = false;
-    int base_resize_width = 0, base_resize_height = 0;
-    for(int a = 1; a < argc; ++a) {
-        if (strcmp("-o", argv[a]) == 0 && a+1 < argc) {
-            output_filename = argv[++a];
-        } else if (strcmp("-f", argv[a]) == 0 && a+1 < argc) {
-            output_format_name = argv[++a];
-        } else if (strcmp("-r", argv[a]) == 0 && a+2 < argc) {
-            base_resize_enable = true;
-            base_resize_width = (int)strtol(argv[++a], nullptr, 10);
-            base_resize_height = (int)strtol(argv[++a], nullptr, 10);
-        } else if (strcmp("-m", argv[a]) == 0) {
-            generate_mipmaps = true;
-        } else if (strcmp("-c", argv[a]) == 0) {
-            output_as_cubemap = true;
-        } else if (strcmp("-q", argv[a]) == 0) {
-            quiet_mode = true;
-        } else if (strcmp("-h", argv[a]) == 0) {
-            PrintUsage(argv);
-            return 0;
-        }
-        else if (strcmp("-v", argv[a]) == 0) {
-          PrintVersion();
-          return 0;
-        } else {
-            // All remaining params are input filenames
-            input_filenames.insert(input_filenames.end(), argv+a, argv+argc);
-            break;
-        }
-    }
-    if (!output_filename || !output_format_name || input_filenames.empty()) {
-        PrintUsage(argv);
-        return -1;
-    }
-    if (output_as_cubemap && (input_filenames.size() % 6) != 0) {
-        fprintf(stderr, "Error: when generating cubemaps, six images are required per cube.\n");
-        return -1;
-    }
-    if (base_resize_enable && (base_resize_width < 1 || base_resize_height < 1)) {
-        fprintf(stderr, "Error: resize width (%d) and height (%d) must both be >= 1.\n",
-                base_resize_width, base_resize_height);
-        return -1;
-    }
-
-    // Look up the output format info
-    const GlFormatInfo *format_info = NULL;
-    for(int f = 0; f < g_format_count; ++f) {
-        if (strcmp(g_formats[f].name, output_format_name) == 0) {
-            format_info = g_formats + f;
-            break;
-        }
-    }
-    if (format_info == NULL) {
-        fprintf(stderr, "Error: format %s not supported\n", output_format_name);
-        return 1;
-    }
-    const int bytes_per_block = format_info->block_bytes;
-    const int block_dim_x = format_info->block_dim_x;
-    const int block_dim_y = format_info->block_dim_y;
-
-    // Load the input file(s)
-    int base_width = 0, base_height = 0;
-    int input_components = 4; // ispc_texcomp requires 32-bit RGBA input
-    int original_components = 0;
-    std::vector<ImagePixels> images(input_filenames.size());
-    images[0].packed = stbi_load(input_filenames[0], &base_width,
-            &base_height, &original_components, input_components);
-    if (!images[0].packed) {
-        fprintf(stderr, "Error loading input '%s'\n", input_filenames[0]);
-        return 2;
-    }
-    if (output_as_cubemap && base_width != base_height) {
-        fprintf(stderr, "Error: when generating cubemaps, input width/height must be equal.\n");
-        fprintf(stderr, "  %s: %d x %d\n", input_filenames[0], base_width, base_height);
-        return 4;
-    }
-    qprintf("Loaded %s -- width=%d height=%d comp=%d\n",
-            input_filenames[0], base_width, base_height,
-            original_components);
-    // Subsequent files must match dimensions of the first
-    for(size_t i = 1; i < input_filenames.size(); ++i) {
-        int bw = 0, bh = 0, oc = 0;
-        images[i].packed = stbi_load(input_filenames[i], &bw, &bh, &oc, input_components);
-        if (!images[i].packed) {
-            fprintf(stderr, "Error loading input '%s'\n", input_filenames[i]);
-            return 2;
-        }
-        if (bw != base_width || bh != base_height) {
-            fprintf(stderr, "Error: input image dimensions do not match.\n");
-            fprintf(stderr, "  %s: %d x %d\n", input_filenames[0], base_width, base_height);
-            fprintf(stderr, "  %s: %d x %d\n", input_filenames[i], bw, bh);
-            return 3;
-        }
-        qprintf("Loaded %s -- width=%d height=%d comp=%d\n",
-                input_filenames[i], bw, bh, oc);
-    }
-    // Optionally, resize the input images
-    if (base_resize_enable) {
-        for(int layer = 0; layer < (int)images.size(); ++layer) {
-            auto& img = images[layer];
-            stbi_uc* resized_packed = (stbi_uc*)STBI_MALLOC(base_resize_width * base_resize_height * input_components);
-            stbir_resize_uint8(
-                img.packed, base_width, base_height, base_width * input_components,
-                resized_packed, base_resize_width, base_resize_height, base_resize_width * input_components,
-                input_components);
-            stbi_image_free(img.packed);
-            img.packed = resized_packed;
-        }
-        qprintf("Resized inputs (old: width=%d height=%d, new: width=%d height=%d\n",
-                base_width, base_height, base_resize_width, base_resize_height);
-        base_width = base_resize_width;
-        base_height = base_resize_height;
-    }
-
-    // Determine mip chain properties
-    int mip_levels = 1;
-    if (generate_mipmaps) {
-        int mip_w = base_width, mip_h = base_height;
-        while (mip_w > 1 || mip_h > 1) {
-            mip_levels += 1;
-            mip_w = std::max(1, mip_w / 2);
-            mip_h = std::max(1, mip_h / 2);
-        }
-    }
-    std::vector<uint32_t> output_mip_sizes(mip_levels);
-
-    // Generate the input mipmap chain(s). At every level, the input
-    // width and height must be padded up to a multiple of the output
-    // block dimensions.
-    for(int layer = 0; layer < (int)images.size(); ++layer) {
-        int mip_width  = base_width;
-        int mip_height = base_height;
-        int mip_pitch_x = ((mip_width  + block_dim_x - 1) / block_dim_x) * block_dim_x;
-        int mip_pitch_y = ((mip_height + block_dim_y - 1) / block_dim_y) * block_dim_y;
-        
-        auto& img = images[layer];
-        img.input_mips.resize(mip_levels);
-        img.output_mips.resize(mip_levels);
-        // Populate padded input mip level 0
-        img.input_mips[0].bytes.resize(mip_pitch_x * mip_pitch_y * input_components);
-        // memset(img.input_mips[0].bytes.data(), 0, mip_pitch_x * mip_pitch_y * input_components);
-        for(int y=0; y<base_height; ++y) {
-            memcpy(img.input_mips[0].bytes.data() + y * mip_width * input_components,
-                    img.packed + y * base_width * input_components,
-                    base_width * input_components);
-        }
-        // Technically STBI_FREE() should suffice in both cases, but just to be safe...
-        if (base_resize_enable) {
-            STBI_FREE(img.packed);
-        } else {
-            stbi_image_free(img.packed);
-        }
-        img.packed = nullptr;
-        // Generate additional mips, if necessary
-        for(int mip=1; mip<mip_levels; ++mip) {
-            int src_width  = mip_width;
-            int src_height = mip_height;
-            int src_pitch_x = mip_pitch_x;
-            //int src_pitch_y = mip_pitch_y;
-            mip_width  = std::max(1, mip_width  / 2);
-            mip_height = std::max(1, mip_height / 2);
-            mip_pitch_x = ((mip_width  + block_dim_x - 1) / block_dim_x) * block_dim_x;
-            mip_pitch_y = ((mip_height + block_dim_y - 1) / block_dim_y) * block_dim_y;
-            img.input_mips[mip].bytes.resize(mip_pitch_x * mip_pitch_y * input_components);
-            // memset(img.input_mips[mip].bytes.data(), 0, mip_pitch_x * mip_pitch_y * num_components);
-            //printf("mip %u: width=%d height=%d\n", i, mip_width, mip_height);
-            stbir_resize_uint8(
-                img.input_mips[mip-1].bytes.data(), src_width, src_height, src_pitch_x * input_components,
-                img.input_mips[mip].bytes.data(), mip_width, mip_height, mip_pitch_x * input_components,
-                input_components);
-        }
-
-        // Generate output mip chain
-        mip_width = base_width;
-        mip_height = base_height;
-        for(int mip=0; mip<mip_levels; ++mip) {
-            rgba_surface input_surface = {};
-            input_surface.ptr = img.input_mips[mip].bytes.data();
-            input_surface.width  = ((mip_width  + block_dim_x - 1) / block_dim_x) * block_dim_x;
-            input_surface.height = ((mip_height + block_dim_y - 1) / block_dim_y) * block_dim_y;
-            input_surface.stride = input_surface.width * input_components;
-            qprintf("compressing mip %u layer %d: width=%d height=%d pitch_x=%d pitch_y=%d\n",
-                    mip, layer, mip_width, mip_height, input_surface.width, input_surface.height);
-            
-            int num_blocks = (input_surface.width / block_dim_x)
-                * (input_surface.height / block_dim_y);
-            output_mip_sizes[mip] = num_blocks * bytes_per_block;
-            img.output_mips[mip].bytes.resize(output_mip_sizes[mip]);
-            if (strcmp(output_format_name, "RGBA") == 0) {
-                img.output_mips[mip] = img.input_mips[mip];
-            } else if ((strcmp(output_format_name, "BC1")  == 0) ||
-                    (   strcmp(output_format_name, "BC1a") == 0)) {
-                CompressBlocksBC1(&input_surface, img.output_mips[mip].bytes.data());
-            } else if (strcmp(output_format_name, "BC3") == 0) {
-                CompressBlocksBC3(&input_surface, img.output_mips[mip].bytes.data());
-            } else if (strcmp(output_format_name, "BC7") == 0) {
-                bc7_enc_settings enc_settings = {};
-                if (original_components == 3) {
-                    GetProfile_basic(&enc_settings);
-                } else if (original_components == 4) {
-                    GetProfile_alpha_basic(&enc_settings);
-                }
-                CompressBlocksBC7(&input_surface, img.output_mips[mip].bytes.data(),
-                        &enc_settings);
-            } else if (strncmp(output_format_name, "ASTC", 4) == 0) {
-                astc_enc_settings enc_settings = {};
-                if (original_components == 3) {
-                    GetProfile_astc_fast(&enc_settings,
-                            format_info->block_dim_x, format_info->block_dim_y);
-                } else if (original_components == 4) {
-                    GetProfile_astc_alpha_fast(&enc_settings,
-                            format_info->block_dim_x, format_info->block_dim_y);
-                }
-                CompressBlocksASTC(&input_surface, img.output_mips[mip].bytes.data(),
-                        &enc_settings);
-            }
-            mip_width  = std::max(1, mip_width  / 2);
-            mip_height = std::max(1, mip_height / 2);
-        }
-    }
-
-    // Output to KTX
-    KtxHeader header = {};
-    const uint8_t ktx_magic_id[12] = {
-        0xAB, 0x4B, 0x54, 0x58,
-        0x20, 0x31, 0x31, 0xBB,
-        0x0D, 0x0A, 0x1A, 0x0A
-    };
-    memcpy(header.identifier, ktx_magic_id, 12);
-    header.endianness = 0x04030201;
-    header.glType = format_info->gl_type;
-    header.glTypeSize = format_info->gl_type_size;
-    header.glFormat = format_info->gl_format;
-    header.glInternalFormat = format_info->internal_format;
-    header.glBaseInternalFormat = format_info->base_format;
-    header.pixelWidth = base_width;
-    header.pixelHeight = base_height;
-    header.pixelDepth = 0; // must be 0 for 2D/cubemap textures
-    uint32_t real_array_element_count = (uint32_t)(images.size() / (output_as_cubemap ? 6 : 1));
-    // KTX spec says this field must be 0 for non-array textures
-    header.numberOfArrayElements = (real_array_element_count > 1) ? real_array_element_count : 0;
-    header.numberOfFaces = output_as_cubemap ? 6 : 1;
-    header.numberOfMipmapLevels = mip_levels;
-    header.bytesOfKeyValueData = 0;
-    FILE *output_file = fopen(output_filename, "wb");
-    if (!output_file) {
-        fprintf(stderr, "Error opening output '%s'\n", output_filename);
-        return 3;
-    }
-    fwrite(&header, 1, sizeof(KtxHeader), output_file);
-    uint32_t zero = 0;
-    for(int mip=0; mip<mip_levels; ++mip) {
-        uint32_t image_size = (output_as_cubemap && header.numberOfArrayElements == 0)
-            ? output_mip_sizes[mip]  // non-array cubemaps store the unpadded size of one face
-            : output_mip_sizes[mip] * real_array_element_count;  // all others store the size of all elems/faces/slices for the whole mip
-        //printf("mip=%u offset=%u image_size=%u\n", mip, (uint32_t)ftell(output_file), image_size);
-        fwrite(&image_size, 1, sizeof(uint32_t), output_file);
-        for(uint32_t array_elem = 0; array_elem < real_array_element_count; ++array_elem) {
-            for(uint32_t face = 0; face < header.numberOfFaces; ++face) {
-                const auto& img = images[array_elem * header.numberOfFaces + face];
-                //printf("mip=%u array=%u face=%u offset=%u size=%u\n", mip, array_elem, face,
-                //        (uint32_t)ftell(output_file), output_mip_sizes[mip]);
-                fwrite(img.output_mips[mip].bytes.data(), 1, output_mip_sizes[mip], output_file);
-                if (output_as_cubemap && header.numberOfArrayElements == 0) {
-                    uint32_t cube_padding = (4 - (ftell(output_file) % 4)) % 4;
-                    fwrite(&zero, 1, cube_padding, output_file);
-                }
-            }
-        }
-        uint32_t mip_padding = (4 - (ftell(output_file) % 4)) % 4;
-        fwrite(&zero, 1, mip_padding, output_file);
-    }
-    size_t output_file_size = ftell(output_file);
-    fclose(output_file);
-    qprintf("Wrote %s (format=%s, mips=%u, layers=%u, faces=%u, size=%u)\n", output_filename,
-            output_format_name, mip_levels, real_array_element_count, header.numberOfFaces,
-            (uint32_t)output_file_size);
-    
-    return 0;
-}
+#include "build_version.h"
+
+#include "converter.h"
+#include "job_stats.h"
+#include "mip_cache.h"
+#include "supercompress.h"
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+void PrintVersion() {
+  fprintf(stdout, "img2ktx %s\n", img2ktx_build_version);
+}
+
+void PrintUsage(char *argv[]) {
+    PrintVersion();
+    fprintf(stdout, "Usage: %s [options] [input]\n", argv[0]);
+    fprintf(stdout, "Each input image becomes one array layer (or cubemap face). Each frame of an\n"
+                    "animated GIF becomes one layer; frames identical to an earlier frame are\n"
+                    "stored as copies of it instead of being compressed again.\n");
+    fprintf(stdout, R"options(options:
+  -o [out.ktx]      Output file [required]. Written as KTX2 if the name ends
+                    in ".ktx2"; KTX2 stores the mip levels smallest first.
+  -f [format]       Output format [required]. BC4 stores the red channel and
+                    BC5 red and green; BC1a gives pixels with alpha < 128
+                    1-bit transparency. "auto" picks the smallest of BC1 (for
+                    opaque inputs), BC1a (alpha only 0 or 255) and BC3 whose
+                    PSNR on a sample of blocks from every layer meets
+                    --auto-psnr, else BC7 (or RGBA without ispc_texcomp), and
+                    reports the error it measured. Every input is decoded
+                    once more to take the sample. Not compatible with --tiled.
+  --auto-psnr [dB]  PSNR target for -f auto, over RGB and any alpha.
+                    Default: 40.
+  -r [width height] Resize input to width x height before conversion.
+                    Provided dimensions must both be >= 1. Each layer is
+                    resized in strips of rows on all -j threads.
+  --resize-filter [f]
+                    Filter for -r: "default" (stb_image_resize's choice:
+                    catmullrom when enlarging, mitchell when shrinking),
+                    "box", "triangle", "cubicbspline", "catmullrom" or
+                    "mitchell".
+  -m                Enable mipmap generation
+  --mip-filter [f]  Filter used to generate mipmaps: "stb" (default) uses
+                    stb_image_resize's default (Mitchell) filter. "box" is
+                    faster: it averages each 2x2 block of the previous level
+                    when its dimensions halve exactly, and falls back to "stb"
+                    otherwise. --tiled and --fused default to "box".
+  --linear-mips     Treat color channels as sRGB and filter mipmaps in linear
+                    light. Alpha is always filtered linearly.
+  -c                Enable cubemap output. Each set of six input images will be
+                    treated as one cubemap. Face order is +X -X +Y -Y +Z -Z.
+  -j [N]            Compress using N worker threads. Defaults to the number of
+                    hardware threads. Output is identical for every N.
+  --mmap            Size the output file up front, map it into memory and have
+                    the encoders write each level straight to its final
+                    offset, instead of staging levels and writing them out.
+  --tiled           For inputs too large to decode into memory: read each
+                    input in place through a memory-mapped file and convert it
+                    a band of block rows at a time, writing every band straight
+                    to its offset in the (memory-mapped) output. Memory use
+                    does not grow with image height. Inputs must be binary
+                    PGM/PPM files (P5/P6, maxval 255). Mipmaps use the box
+                    filter; odd sizes fold the leftover row/column into the
+                    last one. Not compatible with -r, --mip-filter stb,
+                    --cache-dir or --time-budget.
+  --fused           Build and compress each layer's mip chain in one pass, a
+                    band of block rows at a time: each band is compressed and
+                    downsampled into the next level while it is still in
+                    cache, so mip levels are never held in memory whole.
+                    Mipmaps use the box filter as with --tiled. Not compatible
+                    with --tiled, --mip-filter stb, --cache-dir or
+                    --time-budget.
+  --update [in.ktx] Instead of -o: update a KTX file written by img2ktx from
+                    the same number of inputs with the same format, size and
+                    mip count. Only layers whose input pixels or settings
+                    changed are recompressed, and only their bytes in the file
+                    are rewritten. Not compatible with KTX2, --tiled, --mmap
+                    or --time-budget.
+  -l [N]            Hold at most N layers in memory at once. Each layer is
+                    decoded, compressed and written to the output file before
+                    its memory is reused. Defaults to a value based on -j and
+                    the layer size.
+  --batch [file]    Run every job listed in a manifest file, one job per line.
+                    Each line holds the options and inputs for one conversion,
+                    exactly as on the command line. -j, --batch, --cache-dir
+                    and --cache-size apply to the whole batch, so a line that
+                    gives them fails; every other option except --stats and
+                    -q must be on the manifest lines, not next to --batch.
+                    All jobs share -j threads in total.
+                    Failed jobs are reported and skipped; the exit code is 5
+                    if any failed.
+  --cache-dir [dir] Store compressed mip levels in dir, keyed by a hash of the
+                    input pixels, format, encoder profile and img2ktx version.
+                    Levels found in the cache are not recompressed. The
+                    directory may be shared by concurrent img2ktx processes.
+  --cache-size [MB] Evict least recently used cache entries above this size.
+                    Default: 4096.
+  --quality [q]     Encoder speed/quality for BC7 and ASTC: ultrafast, veryfast,
+                    fast, basic (default) or slow. ASTC has fewer profiles;
+                    ultrafast through basic all use its fast profile.
+  --time-budget [s] Choose the quality of each mip level of each layer so that
+                    the whole conversion takes about s seconds, using the best
+                    quality that fits. Overrides --quality. Output depends on
+                    machine speed and load.
+  --stats [file]    Write timings of each stage per layer and mip level, bytes
+                    allocated, peak memory and output size to file as JSON.
+                    With --batch, file covers every job; a --stats option on a
+                    manifest line writes that job's stats to its own file.
+  --supercompress [s]
+                    KTX2 only: compress each mip level with "zstd" or "zlib"
+                    (if img2ktx was built with that library), or "none"
+                    (default). Levels are compressed in parallel.
+  --supercompress-level [N]
+                    zstd or zlib compression level. Default: the library's
+                    default level.
+  -q                Enable quiet mode (suppress non-error console output)
+  -h                Displays this help message
+  -v                Displays version information\)options");
+    fprintf(stdout, "formats:\n  ");
+    for(size_t i=0; i<g_format_count; ++i) {
+        if (FormatAvailable(&g_formats[i])) {
+            fprintf(stdout, "%s ", g_formats[i].name);
+        }
+    }
+    fprintf(stdout, "\n");
+}
+
+#define qprintf(msg, ...) if (!quiet_mode) { printf( (msg), __VA_ARGS__); }
+
+// The command line: one conversion, plus the options that only the tool has.
+struct CommandLineOptions : ConvertOptions {
+    int thread_count = WorkerPool::DefaultThreadCount();
+    std::string batch_filename;
+    std::string cache_dir;
+    uint64_t cache_max_bytes = kDefaultCacheMaxBytes;
+    std::string stats_filename;
+    // The first option given that only applies to a whole process (-j,
+    // --batch, --cache-dir or --cache-size), for rejecting it in a manifest.
+    const char* process_option = nullptr;
+    // The first option or input given that only applies to one conversion
+    // (anything but the options above, --stats and -q), for rejecting it
+    // next to --batch.
+    const char* job_option = nullptr;
+};
+
+bool IsBatchWideOption(const char* arg) {
+    static const char* const kOptions[] = { "-j", "--batch", "--cache-dir", "--cache-size", "--stats", "-q" };
+    for(const char* option : kOptions) {
+        if (strcmp(option, arg) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool IsKtx2Filename(const std::string& filename) {
+    const std::string extension = ".ktx2";
+    if (filename.size() < extension.size()) {
+        return false;
+    }
+    for(size_t i = 0; i < extension.size(); ++i) {
+        if (tolower((unsigned char)filename[filename.size() - extension.size() + i]) != extension[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+enum ParseResult {
+    kParseOk,
+    kParseExit,   // -h or -v was handled; exit successfully
+    kParseError,  // an error was reported; exit with -1
+};
+
+// Parses command-line arguments (argv[0] is the program name). Also used for
+// each line of a --batch manifest.
+ParseResult ParseArgs(int argc, char *argv[], CommandLineOptions* opts) {
+    bool mip_filter_given = false;
+    for(int a = 1; a < argc; ++a) {
+        if (!opts->job_option && !IsBatchWideOption(argv[a])) {
+            opts->job_option = argv[a];
+        }
+        if (strcmp("-o", argv[a]) == 0 && a+1 < argc) {
+            opts->output_filename = argv[++a];
+        } else if (strcmp("-f", argv[a]) == 0 && a+1 < argc) {
+            opts->output_format_name = argv[++a];
+        } else if (strcmp("--auto-psnr", argv[a]) == 0 && a+1 < argc) {
+            opts->auto_target_psnr = strtod(argv[++a], nullptr);
+            if (!(opts->auto_target_psnr > 0)) {
+                fprintf(stderr, "Error: PSNR target (%s) must be > 0 dB.\n", argv[a]);
+                return kParseError;
+            }
+        } else if (strcmp("-r", argv[a]) == 0 && a+2 < argc) {
+            opts->base_resize_enable = true;
+            opts->base_resize_width = (int)strtol(argv[++a], nullptr, 10);
+            opts->base_resize_height = (int)strtol(argv[++a], nullptr, 10);
+        } else if (strcmp("--resize-filter", argv[a]) == 0 && a+1 < argc) {
+            if (!ParseResizeFilter(argv[++a], &opts->resize_filter)) {
+                fprintf(stderr, "Error: unknown resize filter '%s'.\n", argv[a]);
+                return kParseError;
+            }
+        } else if (strcmp("-m", argv[a]) == 0) {
+            opts->generate_mipmaps = true;
+        } else if (strcmp("--mip-filter", argv[a]) == 0 && a+1 < argc) {
+            mip_filter_given = true;
+            const char* filter_name = argv[++a];
+            if (strcmp(filter_name, "box") == 0) {
+                opts->mip_filter = kMipFilterBox;
+            } else if (strcmp(filter_name, "stb") == 0) {
+                opts->mip_filter = kMipFilterStb;
+            } else {
+                fprintf(stderr, "Error: unknown mip filter '%s'.\n", filter_name);
+                return kParseError;
+            }
+        } else if (strcmp("--linear-mips", argv[a]) == 0) {
+            opts->linear_mips = true;
+        } else if (strcmp("-c", argv[a]) == 0) {
+            opts->output_as_cubemap = true;
+        } else if (strcmp("-j", argv[a]) == 0 && a+1 < argc) {
+            opts->process_option = opts->process_option ? opts->process_option : "-j";
+            opts->thread_count = (int)strtol(argv[++a], nullptr, 10);
+        } else if (strcmp("-l", argv[a]) == 0 && a+1 < argc) {
+            opts->max_layers_in_flight = (int)strtol(argv[++a], nullptr, 10);
+            if (opts->max_layers_in_flight < 1) {
+                fprintf(stderr, "Error: layers in flight (%d) must be >= 1.\n", opts->max_layers_in_flight);
+                return kParseError;
+            }
+        } else if (strcmp("--mmap", argv[a]) == 0) {
+            opts->mmap_output = true;
+        } else if (strcmp("--tiled", argv[a]) == 0) {
+            opts->tiled = true;
+        } else if (strcmp("--fused", argv[a]) == 0) {
+            opts->fused = true;
+        } else if (strcmp("--update", argv[a]) == 0 && a+1 < argc) {
+            opts->update_filename = argv[++a];
+        } else if (strcmp("--batch", argv[a]) == 0 && a+1 < argc) {
+            opts->process_option = opts->process_option ? opts->process_option : "--batch";
+            opts->batch_filename = argv[++a];
+        } else if (strcmp("--cache-dir", argv[a]) == 0 && a+1 < argc) {
+            opts->process_option = opts->process_option ? opts->process_option : "--cache-dir";
+            opts->cache_dir = argv[++a];
+        } else if (strcmp("--cache-size", argv[a]) == 0 && a+1 < argc) {
+            opts->process_option = opts->process_option ? opts->process_option : "--cache-size";
+            long long cache_mb = strtoll(argv[++a], nullptr, 10);
+            if (cache_mb < 1) {
+                fprintf(stderr, "Error: cache size (%lld MB) must be >= 1.\n", cache_mb);
+                return kParseError;
+            }
+            opts->cache_max_bytes = (uint64_t)cache_mb << 20;
+        } else if (strcmp("--quality", argv[a]) == 0 && a+1 < argc) {
+            if (!ParseEncoderQuality(argv[++a], &opts->quality)) {
+                fprintf(stderr, "Error: unknown quality '%s'.\n", argv[a]);
+                return kParseError;
+            }
+        } else if (strcmp("--time-budget", argv[a]) == 0 && a+1 < argc) {
+            opts->time_budget_seconds = strtod(argv[++a], nullptr);
+            if (!(opts->time_budget_seconds > 0)) {
+                fprintf(stderr, "Error: time budget (%s) must be > 0 seconds.\n", argv[a]);
+                return kParseError;
+            }
+        } else if (strcmp("--stats", argv[a]) == 0 && a+1 < argc) {
+            opts->stats_filename = argv[++a];
+        } else if (strcmp("--supercompress", argv[a]) == 0 && a+1 < argc) {
+            const char* scheme_name = argv[++a];
+            if (strcmp(scheme_name, "none") == 0) {
+                opts->supercompression = kKtx2SupercompressionNone;
+            } else if (strcmp(scheme_name, "zstd") == 0) {
+                opts->supercompression = kKtx2SupercompressionZstd;
+            } else if (strcmp(scheme_name, "zlib") == 0) {
+                opts->supercompression = kKtx2SupercompressionZlib;
+            } else {
+                fprintf(stderr, "Error: unknown supercompression scheme '%s'.\n", scheme_name);
+                return kParseError;
+            }
+            if (!SupercompressionAvailable(opts->supercompression)) {
+                fprintf(stderr, "Error: this build of img2ktx does not support %s supercompression.\n",
+                        scheme_name);
+                return kParseError;
+            }
+        } else if (strcmp("--supercompress-level", argv[a]) == 0 && a+1 < argc) {
+            opts->supercompress_level = (int)strtol(argv[++a], nullptr, 10);
+        } else if (strcmp("-q", argv[a]) == 0) {
+            opts->quiet_mode = true;
+        } else if (strcmp("-h", argv[a]) == 0) {
+            PrintUsage(argv);
+            return kParseExit;
+        }
+        else if (strcmp("-v", argv[a]) == 0) {
+          PrintVersion();
+          return kParseExit;
+        } else {
+            // All remaining params are input filenames
+            for(; a < argc; ++a) {
+                ConvertInput input;
+                input.filename = argv[a];
+                opts->inputs.push_back(input);
+            }
+            break;
+        }
+    }
+    if (opts->thread_count < 1) {
+        fprintf(stderr, "Error: thread count (%d) must be >= 1.\n", opts->thread_count);
+        return kParseError;
+    }
+    if (!opts->batch_filename.empty()) {
+        if (opts->job_option) {
+            fprintf(stderr, "Error: %s cannot be combined with --batch; give it on each manifest line instead.\n",
+                    opts->job_option);
+            return kParseError;
+        }
+        return kParseOk;  // per-job options come from the manifest
+    }
+    if (!opts->update_filename.empty()) {
+        if (!opts->output_filename.empty()) {
+            fprintf(stderr, "Error: --update and -o cannot be combined.\n");
+            return kParseError;
+        }
+        opts->output_filename = opts->update_filename;
+    }
+    if (opts->output_filename.empty() || opts->output_format_name.empty() || opts->inputs.empty()) {
+        PrintUsage(argv);
+        return kParseError;
+    }
+    if (opts->base_resize_enable && (opts->base_resize_width < 1 || opts->base_resize_height < 1)) {
+        fprintf(stderr, "Error: resize width (%d) and height (%d) must both be >= 1.\n",
+                opts->base_resize_width, opts->base_resize_height);
+        return kParseError;
+    }
+    if ((opts->tiled || opts->fused) && !mip_filter_given) {
+        opts->mip_filter = kMipFilterBox;  // their banded mip chains are box-filtered
+    }
+    opts->ktx2 = IsKtx2Filename(opts->output_filename);
+    const char* error = CheckConvertOptions(*opts, !opts->cache_dir.empty());
+    if (error) {
+        fprintf(stderr, "Error: %s\n", error);
+        return kParseError;
+    }
+    return kParseOk;
+}
+
+// Runs one conversion and writes its --stats file, if any.
+int ConvertWithStats(Converter& converter, const CommandLineOptions& opts, JobStats* stats) {
+    const int result = converter.Convert(opts, stats);
+    if (!opts.stats_filename.empty() && !WriteStatsJson(opts.stats_filename, std::vector<JobStats>(1, *stats))) {
+        fprintf(stderr, "Error writing stats '%s'\n", opts.stats_filename.c_str());
+    }
+    return result;
+}
+
+// Applies the cache size limit once all jobs are done, and reports totals.
+void TrimCache(MipCache* cache, bool quiet_mode) {
+    cache->Trim();
+    qprintf("Cache totals: %llu hits, %llu misses, %llu evictions\n",
+            (unsigned long long)cache->Hits(), (unsigned long long)cache->Misses(),
+            (unsigned long long)cache->Evictions());
+}
+
+// Splits one manifest line into arguments. Arguments are separated by
+// whitespace; double quotes group an argument that contains spaces.
+std::vector<std::string> TokenizeManifestLine(const std::string& line) {
+    std::vector<std::string> tokens;
+    size_t i = 0;
+    while (i < line.size()) {
+        while (i < line.size() && isspace((unsigned char)line[i])) {
+            ++i;
+        }
+        if (i == line.size()) {
+            break;
+        }
+        std::string token;
+        bool quoted = false;
+        for(; i < line.size() && (quoted || !isspace((unsigned char)line[i])); ++i) {
+            if (line[i] == '"') {
+                quoted = !quoted;
+            } else {
+                token += line[i];
+            }
+        }
+        tokens.push_back(token);
+    }
+    return tokens;
+}
+
+// Runs every job listed in a manifest file on one shared worker pool. Each
+// non-empty line that does not start with '#' holds the arguments for one job,
+// exactly as they would be passed on the command line. Up to one job per
+// thread runs at a time, each on its own runner thread; the pool only starts
+// enough workers to bring the total to -j. Their tasks share the pool, so idle
+// threads (including runners that have run out of jobs) pick up work from
+// whichever job has some. A failed job is reported and skipped.
+int RunBatch(const CommandLineOptions& batch_opts, char* argv0) {
+    FILE* manifest = fopen(batch_opts.batch_filename.c_str(), "r");
+    if (!manifest) {
+        fprintf(stderr, "Error opening batch manifest '%s'\n", batch_opts.batch_filename.c_str());
+        return 2;
+    }
+    struct BatchJob {
+        int line_number;
+        std::vector<std::string> args;
+    };
+    std::vector<BatchJob> jobs;
+    std::string line;
+    int line_number = 0;
+    for(int c = fgetc(manifest); ; c = fgetc(manifest)) {
+        if (c == '\n' || c == EOF) {
+            ++line_number;
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            std::vector<std::string> args = TokenizeManifestLine(line);
+            if (!args.empty() && args[0][0] != '#') {
+                jobs.push_back(BatchJob{line_number, args});
+            }
+            line.clear();
+            if (c == EOF) {
+                break;
+            }
+        } else {
+            line += (char)c;
+        }
+    }
+    fclose(manifest);
+
+    const bool quiet_mode = batch_opts.quiet_mode;
+    const int concurrent_jobs = std::max(1, std::min(batch_opts.thread_count, (int)jobs.size()));
+    WorkerPool pool(batch_opts.thread_count, concurrent_jobs);
+    ConverterSettings settings;
+    settings.cache_dir = batch_opts.cache_dir;
+    settings.cache_max_bytes = batch_opts.cache_max_bytes;
+    Converter converter(pool, settings);
+    std::vector<int> results(jobs.size(), 0);
+    std::vector<JobStats> job_stats(jobs.size());
+    std::atomic<size_t> next_job(0);
+    std::atomic<size_t> finished_jobs(0);
+    std::mutex report_mutex;
+    auto job_runner = [&]() {
+        for(size_t j = next_job++; j < jobs.size(); j = next_job++) {
+            std::vector<char*> job_argv(1, argv0);
+            for(auto& arg : jobs[j].args) {
+                job_argv.push_back(&arg[0]);
+            }
+            CommandLineOptions opts;
+            opts.quiet_mode = batch_opts.quiet_mode;
+            opts.in_flight_bytes = kDefaultInFlightBytes / concurrent_jobs;
+            int result = -1;
+            ParseResult parsed = ParseArgs((int)job_argv.size(), job_argv.data(), &opts);
+            if (parsed == kParseOk && opts.process_option) {
+                std::lock_guard<std::mutex> lock(report_mutex);
+                fprintf(stderr, "Error: %s applies to the whole batch; give it on the command line, not on "
+                        "manifest line %d.\n", opts.process_option, jobs[j].line_number);
+                job_stats[j].exit_code = result;
+            } else if (parsed == kParseOk) {
+                result = ConvertWithStats(converter, opts, &job_stats[j]);
+            } else {
+                job_stats[j].exit_code = result;
+            }
+            results[j] = result;
+            if (result != 0) {
+                std::lock_guard<std::mutex> lock(report_mutex);
+                fprintf(stderr, "Error: batch job on line %d (%s) failed with code %d\n",
+                        jobs[j].line_number, opts.output_filename.c_str(), result);
+            }
+            finished_jobs += 1;
+            pool.Notify();
+        }
+        // Out of jobs: help the jobs still running until they are all done.
+        pool.HelpUntil([&]() { return finished_jobs == jobs.size(); });
+    };
+    std::vector<std::thread> runners;
+    for(int r = 1; r < concurrent_jobs; ++r) {
+        runners.emplace_back(job_runner);
+    }
+    job_runner();
+    for(auto& t : runners) {
+        t.join();
+    }
+
+    int failed_count = (int)std::count_if(results.begin(), results.end(), [](int r) { return r != 0; });
+    qprintf("Batch complete: %d jobs, %d succeeded, %d failed\n",
+            (int)jobs.size(), (int)jobs.size() - failed_count, failed_count);
+    if (converter.Cache()) {
+        TrimCache(converter.Cache(), quiet_mode);
+    }
+    if (!batch_opts.stats_filename.empty() && !WriteStatsJson(batch_opts.stats_filename, job_stats)) {
+        fprintf(stderr, "Error writing stats '%s'\n", batch_opts.stats_filename.c_str());
+    }
+    return (failed_count > 0) ? 5 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    CommandLineOptions opts;
+    ParseResult parsed = ParseArgs(argc, argv, &opts);
+    if (parsed != kParseOk) {
+        return (parsed == kParseExit) ? 0 : -1;
+    }
+    if (!opts.batch_filename.empty()) {
+        return RunBatch(opts, argv[0]);
+    }
+    WorkerPool pool(opts.thread_count);
+    ConverterSettings settings;
+    settings.cache_dir = opts.cache_dir;
+    settings.cache_max_bytes = opts.cache_max_bytes;
+    Converter converter(pool, settings);
+    JobStats stats;
+    int result = ConvertWithStats(converter, opts, &stats);
+    if (converter.Cache()) {
+        TrimCache(converter.Cache(), opts.quiet_mode);
+    }
+    return result;
+}
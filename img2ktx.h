@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The C API of libimg2ktx: converts images in memory to a KTX or KTX2 file in
+// memory, without temporary files or a separate process. A context holds the
+// worker threads and the buffers reused between conversions, so a program
+// that converts often (e.g. on every hot reload) should keep one around. The
+// C++ API in converter.h offers every option of the command-line tool.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Where a context gets its pixel buffers; malloc() and free() if null.
+typedef struct img2ktx_allocator {
+    void* (*allocate)(void* user, size_t size);
+    void (*free)(void* user, void* ptr);
+    void* user;
+} img2ktx_allocator;
+
+typedef struct img2ktx_context img2ktx_context;
+
+// thread_count 0 uses one worker thread per hardware thread. Returns null on
+// failure.
+img2ktx_context* img2ktx_context_create(int thread_count, const img2ktx_allocator* allocator);
+void img2ktx_context_destroy(img2ktx_context* context);
+
+// One input image: an encoded image file in memory (any format stb_image
+// reads, including animated GIFs, whose frames become layers) if width is 0,
+// else raw RGBA8 pixels with rows row_pitch bytes apart (0: width * 4).
+typedef struct img2ktx_image {
+    const void* data;
+    size_t size;  // encoded images only
+    int width, height;
+    size_t row_pitch;
+} img2ktx_image;
+
+typedef struct img2ktx_options {
+    const char* format;  // an img2ktx -f format name, or "auto"
+    int ktx2;  // write KTX2 instead of KTX
+    int mipmaps;  // generate mipmaps
+    int linear_mips;  // filter color in linear light
+    int cubemap;  // every six images are one cubemap
+    int quality;  // 0 (ultrafast) to 4 (slow), as --quality
+    int resize_width, resize_height;  // resize inputs first, if both are > 0
+    const char* resize_filter;  // an img2ktx --resize-filter name; null for the default
+    int quiet;  // suppress console output; errors still go to stderr
+} img2ktx_options;
+
+// Fills in the command-line tool's defaults, with quiet set.
+void img2ktx_options_init(img2ktx_options* options);
+
+// Returns a buffer of size bytes for the output file, or null to fail.
+typedef void* (*img2ktx_output_func)(void* user, size_t size);
+
+// Converts image_count images, one per layer (or cube face), to one file,
+// which is written to the buffer output returns. Every image must be the same
+// size. Several threads may convert with one context at once. Returns 0 on
+// success, or the img2ktx exit code for the first error.
+int img2ktx_convert(img2ktx_context* context, const img2ktx_image* images, int image_count,
+        const img2ktx_options* options, img2ktx_output_func output, void* user);
+
+#ifdef __cplusplus
+}
+#endif
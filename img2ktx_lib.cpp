@@ -0,0 +1,77 @@
+#include "img2ktx.h"
+
+#include "converter.h"
+#include "worker_pool.h"
+
+#include <memory>
+#include <new>
+#include <cstdio>
+
+struct img2ktx_context {
+    std::unique_ptr<WorkerPool> pool;
+    std::unique_ptr<Converter> converter;
+};
+
+img2ktx_context* img2ktx_context_create(int thread_count, const img2ktx_allocator* allocator) {
+    ConverterSettings settings;
+    if (allocator && allocator->allocate && allocator->free) {
+        settings.allocator.allocate = allocator->allocate;
+        settings.allocator.free = allocator->free;
+        settings.allocator.user = allocator->user;
+    }
+    img2ktx_context* context = new(std::nothrow) img2ktx_context;
+    if (!context) {
+        return nullptr;
+    }
+    context->pool.reset(new WorkerPool(thread_count > 0 ? thread_count : WorkerPool::DefaultThreadCount()));
+    context->converter.reset(new Converter(*context->pool, settings));
+    return context;
+}
+
+void img2ktx_context_destroy(img2ktx_context* context) {
+    delete context;
+}
+
+void img2ktx_options_init(img2ktx_options* options) {
+    *options = img2ktx_options();
+    options->quality = kDefaultEncoderQuality;
+    options->quiet = 1;
+}
+
+int img2ktx_convert(img2ktx_context* context, const img2ktx_image* images, int image_count,
+        const img2ktx_options* options, img2ktx_output_func output, void* user) {
+    ConvertOptions opts;
+    for(int i = 0; i < image_count; ++i) {
+        ConvertInput input;
+        input.data = (const uint8_t*)images[i].data;
+        input.size = images[i].size;
+        input.width = images[i].width;
+        input.height = images[i].height;
+        input.row_pitch = images[i].row_pitch;
+        opts.inputs.push_back(input);
+    }
+    opts.output_buffer = [output, user](uint64_t size) {
+        return (size == (size_t)size) ? (uint8_t*)output(user, (size_t)size) : nullptr;
+    };
+    opts.ktx2 = options->ktx2 != 0;
+    opts.output_format_name = options->format ? options->format : "";
+    opts.generate_mipmaps = options->mipmaps != 0;
+    opts.linear_mips = options->linear_mips != 0;
+    opts.output_as_cubemap = options->cubemap != 0;
+    if (options->quality < 0 || options->quality >= kEncoderQualityCount) {
+        fprintf(stderr, "Error: quality (%d) must be 0 to %d.\n", options->quality, kEncoderQualityCount - 1);
+        return 1;
+    }
+    opts.quality = (EncoderQuality)options->quality;
+    if (options->resize_width > 0 && options->resize_height > 0) {
+        opts.base_resize_enable = true;
+        opts.base_resize_width = options->resize_width;
+        opts.base_resize_height = options->resize_height;
+    }
+    if (options->resize_filter && !ParseResizeFilter(options->resize_filter, &opts.resize_filter)) {
+        fprintf(stderr, "Error: unknown resize filter '%s'.\n", options->resize_filter);
+        return 1;
+    }
+    opts.quiet_mode = options->quiet != 0;
+    return context->converter->Convert(opts);
+}
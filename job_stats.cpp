@@ -0,0 +1,102 @@
+#include "job_stats.h"
+
+#include "build_version.h"
+
+#include <chrono>
+#include <cstdio>
+
+namespace {
+
+std::string JsonString(const std::string& s) {
+    std::string out = "\"";
+    for(char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char)c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+void WriteMip(FILE* f, const MipStats& m, bool last) {
+    fprintf(f, "            {\"width\": %d, \"height\": %d, \"generate_seconds\": %.6f, \"cache_seconds\": %.6f, "
+            "\"compress_seconds\": %.6f, \"cache\": \"%s\", \"profile\": \"%s\", \"output_bytes\": %u}%s\n",
+            m.width, m.height, m.generate_seconds, m.cache_seconds, m.compress_seconds,
+            m.cache, m.profile, m.output_bytes, last ? "" : ",");
+}
+
+void WriteLayer(FILE* f, const LayerStats& l, bool last) {
+    fprintf(f, "        {\"input\": %s, \"wait_seconds\": %.6f, \"decode_seconds\": %.6f, \"resize_seconds\": %.6f, "
+            "\"pad_seconds\": %.6f, \"hash_seconds\": %.6f, \"write_seconds\": %.6f, \"duplicate_of\": %d, "
+            "\"unchanged\": %s, \"mips\": [\n",
+            JsonString(l.input).c_str(), l.wait_seconds, l.decode_seconds, l.resize_seconds,
+            l.pad_seconds, l.hash_seconds, l.write_seconds, l.duplicate_of, l.unchanged ? "true" : "false");
+    for(size_t i = 0; i < l.mips.size(); ++i) {
+        WriteMip(f, l.mips[i], i + 1 == l.mips.size());
+    }
+    fprintf(f, "        ]}%s\n", last ? "" : ",");
+}
+
+void WriteJob(FILE* f, const JobStats& j, bool last) {
+    fprintf(f, "    {\n");
+    fprintf(f, "      \"output\": %s,\n", JsonString(j.output).c_str());
+    fprintf(f, "      \"format\": %s,\n", JsonString(j.format).c_str());
+    if (!j.auto_trials.empty()) {
+        fprintf(f, "      \"auto_format\": {\"target_psnr\": %.3f, \"sampled_blocks\": %d, \"trials\": [",
+                j.auto_target_psnr, j.auto_sampled_blocks);
+        for(size_t i = 0; i < j.auto_trials.size(); ++i) {
+            const AutoFormatTrialStats& t = j.auto_trials[i];
+            char psnr[32] = "null";
+            if (t.measured) {
+                snprintf(psnr, sizeof(psnr), "%.3f", t.psnr);
+            }
+            fprintf(f, "%s{\"format\": %s, \"psnr\": %s}", i ? ", " : "", JsonString(t.format).c_str(), psnr);
+        }
+        fprintf(f, "]},\n");
+    }
+    fprintf(f, "      \"exit_code\": %d,\n", j.exit_code);
+    fprintf(f, "      \"width\": %d, \"height\": %d, \"mip_levels\": %d, \"layer_count\": %d,\n",
+            j.width, j.height, j.mip_levels, (int)j.layers.size());
+    fprintf(f, "      \"total_seconds\": %.6f, \"finish_seconds\": %.6f, \"supercompress_seconds\": %.6f,\n",
+            j.total_seconds, j.finish_seconds, j.supercompress_seconds);
+    fprintf(f, "      \"bytes_allocated\": %llu, \"bytes_reused\": %llu, \"peak_rss_bytes\": %llu,\n",
+            (unsigned long long)j.bytes_allocated, (unsigned long long)j.bytes_reused,
+            (unsigned long long)j.peak_rss_bytes);
+    fprintf(f, "      \"output_file_bytes\": %llu,\n", (unsigned long long)j.output_file_bytes);
+    fprintf(f, "      \"cache_hits\": %d, \"cache_misses\": %d, \"duplicate_layers\": %d, \"unchanged_layers\": %d,\n",
+            j.cache_hits, j.cache_misses, j.duplicate_layers, j.unchanged_layers);
+    fprintf(f, "      \"layers\": [\n");
+    for(size_t i = 0; i < j.layers.size(); ++i) {
+        WriteLayer(f, j.layers[i], i + 1 == j.layers.size());
+    }
+    fprintf(f, "      ]\n");
+    fprintf(f, "    }%s\n", last ? "" : ",");
+}
+
+}  // namespace
+
+double NowSeconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool WriteStatsJson(const std::string& filename, const std::vector<JobStats>& jobs) {
+    FILE* f = fopen(filename.c_str(), "w");
+    if (!f) {
+        return false;
+    }
+    fprintf(f, "{\n");
+    fprintf(f, "  \"img2ktx_version\": %s,\n", JsonString(img2ktx_build_version).c_str());
+    fprintf(f, "  \"jobs\": [\n");
+    for(size_t i = 0; i < jobs.size(); ++i) {
+        WriteJob(f, jobs[i], i + 1 == jobs.size());
+    }
+    fprintf(f, "  ]\n}\n");
+    bool ok = !ferror(f);
+    return (fclose(f) == 0) && ok;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Per-stage timings and counters for one conversion, written by --stats.
+// Stage times are wall-clock seconds on the thread that ran the stage;
+// compress_seconds is summed over all strips of a level, so it can exceed the
+// level's elapsed time when strips run in parallel.
+
+struct MipStats {
+    int width = 0, height = 0;
+    double generate_seconds = 0;  // downsampling from the previous level and edge padding
+    double cache_seconds = 0;  // cache lookup, plus the store after a miss
+    double compress_seconds = 0;
+    const char* cache = "off";  // "off", "hit" or "miss"
+    const char* profile = "";  // encoder profile used
+    uint32_t output_bytes = 0;
+};
+
+struct LayerStats {
+    std::string input;
+    double wait_seconds = 0;  // waiting for a free in-flight slot before decoding
+    double decode_seconds = 0;
+    double resize_seconds = 0;  // -r, or spreading decoded rows out to the padded pitch
+    double pad_seconds = 0;
+    double hash_seconds = 0;
+    double write_seconds = 0;
+    int duplicate_of = -1;  // source layer, if this layer was deduplicated
+    bool unchanged = false;  // --update: the file already held this layer's output
+    std::vector<MipStats> mips;
+};
+
+// One candidate format tried by -f auto.
+struct AutoFormatTrialStats {
+    std::string format;
+    double psnr = 0;
+    bool measured = false;  // false: chosen without measuring its error (BC7)
+};
+
+struct JobStats {
+    std::string output;
+    std::string format;
+    int exit_code = 0;
+    int width = 0, height = 0;
+    int mip_levels = 0;
+    double total_seconds = 0;
+    double finish_seconds = 0;  // after the last decode, until every layer was written
+    double supercompress_seconds = 0;  // KTX2 --supercompress, after every layer was written
+    uint64_t bytes_allocated = 0;  // new pixel memory (decoder output and buffer pool misses)
+    uint64_t bytes_reused = 0;  // pixel memory served from the buffer pool
+    uint64_t peak_rss_bytes = 0;  // process-wide high-water mark when the job finished
+    uint64_t output_file_bytes = 0;
+    int cache_hits = 0, cache_misses = 0;
+    int duplicate_layers = 0;
+    int unchanged_layers = 0;
+    // -f auto only: the target, the size of the sample and every format tried,
+    // the last being the one chosen.
+    double auto_target_psnr = 0;
+    int auto_sampled_blocks = 0;
+    std::vector<AutoFormatTrialStats> auto_trials;
+    std::vector<LayerStats> layers;
+};
+
+// Seconds since an arbitrary fixed point, from a monotonic high-resolution clock.
+double NowSeconds();
+
+// Writes jobs to filename as JSON. Returns false on I/O error.
+bool WriteStatsJson(const std::string& filename, const std::vector<JobStats>& jobs);
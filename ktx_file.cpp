@@ -0,0 +1,548 @@
+#include "ktx_file.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+
+KtxLayout ComputeKtxLayout(const KtxHeader& header, const std::vector<uint32_t>& mip_sizes,
+        const std::vector<uint8_t>& key_value_data) {
+    KtxLayout layout = {};
+    layout.chunks.push_back(KtxLayout::Chunk{0, std::vector<uint8_t>((const uint8_t*)&header,
+            (const uint8_t*)&header + sizeof(KtxHeader))});
+    if (!key_value_data.empty()) {
+        layout.chunks.push_back(KtxLayout::Chunk{sizeof(KtxHeader), key_value_data});
+    }
+    const uint32_t real_array_element_count = std::max(header.numberOfArrayElements, 1U);
+    const bool non_array_cubemap = (header.numberOfFaces == 6 && header.numberOfArrayElements == 0);
+    layout.layer_count = real_array_element_count * header.numberOfFaces;
+    layout.mip_sizes = mip_sizes;
+    layout.data_offsets.resize(mip_sizes.size() * layout.layer_count);
+    uint64_t offset = sizeof(KtxHeader) + header.bytesOfKeyValueData;
+    for(size_t mip = 0; mip < mip_sizes.size(); ++mip) {
+        const uint32_t image_size = non_array_cubemap
+            ? mip_sizes[mip]  // non-array cubemaps store the unpadded size of one face
+            : mip_sizes[mip] * real_array_element_count;  // all others store the size of all elems/faces/slices for the whole mip
+        layout.chunks.push_back(KtxLayout::Chunk{offset, std::vector<uint8_t>((const uint8_t*)&image_size,
+                (const uint8_t*)&image_size + sizeof(uint32_t))});
+        offset += sizeof(uint32_t);
+        for(uint32_t layer = 0; layer < layout.layer_count; ++layer) {
+            layout.data_offsets[mip * layout.layer_count + layer] = offset;
+            offset += mip_sizes[mip];
+            if (non_array_cubemap) {
+                offset = (offset + 3) & ~3ULL;  // cube_padding
+            }
+        }
+        offset = (offset + 3) & ~3ULL;  // mip_padding
+    }
+    layout.file_size = offset;
+    return layout;
+}
+
+namespace {
+
+const char kLayerHashesKey[] = "img2ktx.layerHashes";
+
+}  // namespace
+
+std::vector<uint8_t> BuildLayerHashKeyValueData(const std::vector<LayerHash>& hashes) {
+    // keyAndValueByteSize, the NUL-terminated key, the value, then padding to
+    // a multiple of 4 bytes.
+    const uint32_t key_and_value_bytes = (uint32_t)(sizeof(kLayerHashesKey) + hashes.size() * sizeof(LayerHash));
+    std::vector<uint8_t> out(sizeof(uint32_t) + ((key_and_value_bytes + 3) & ~3U), 0);
+    memcpy(out.data(), &key_and_value_bytes, sizeof(uint32_t));
+    memcpy(out.data() + sizeof(uint32_t), kLayerHashesKey, sizeof(kLayerHashesKey));
+    if (!hashes.empty()) {
+        memcpy(out.data() + sizeof(uint32_t) + sizeof(kLayerHashesKey), hashes.data(),
+                hashes.size() * sizeof(LayerHash));
+    }
+    return out;
+}
+
+bool ReadKtxForUpdate(FILE* f, const KtxHeader& header, const KtxLayout& layout,
+        std::vector<LayerHash>* hashes, std::string* error) {
+    KtxHeader existing = {};
+    if (SeekOutput(f, 0) != 0 || fread(&existing, sizeof(existing), 1, f) != 1 ||
+            memcmp(existing.identifier, header.identifier, sizeof(header.identifier)) != 0 ||
+            existing.endianness != header.endianness) {
+        *error = "not a little-endian KTX 1.1 file";
+        return false;
+    }
+    if (existing.glInternalFormat != header.glInternalFormat) {
+        *error = "its format is different";
+        return false;
+    }
+    if (existing.pixelWidth != header.pixelWidth || existing.pixelHeight != header.pixelHeight) {
+        *error = "its dimensions are different";
+        return false;
+    }
+    if (existing.numberOfMipmapLevels != header.numberOfMipmapLevels) {
+        *error = "its mip level count is different";
+        return false;
+    }
+    if (existing.numberOfArrayElements != header.numberOfArrayElements ||
+            existing.numberOfFaces != header.numberOfFaces) {
+        *error = "its layer or face count is different";
+        return false;
+    }
+    if (memcmp(&existing, &header, sizeof(header)) != 0) {
+        *error = existing.bytesOfKeyValueData != header.bytesOfKeyValueData
+            ? "it has no img2ktx layer hashes"
+            : "its header is different";
+        return false;
+    }
+    // Every other fixed part of the file (the image sizes) must match too.
+    std::vector<uint8_t> bytes;
+    for(const auto& chunk : layout.chunks) {
+        bytes.resize(chunk.bytes.size());
+        if (SeekOutput(f, chunk.offset) != 0 || fread(bytes.data(), 1, bytes.size(), f) != bytes.size()) {
+            *error = "it is truncated";
+            return false;
+        }
+        if (chunk.offset == sizeof(KtxHeader)) {
+            // The key/value data: only the hashes may differ.
+            const size_t key_bytes = sizeof(uint32_t) + sizeof(kLayerHashesKey);
+            if (memcmp(bytes.data(), chunk.bytes.data(), key_bytes) != 0) {
+                *error = "it has no img2ktx layer hashes";
+                return false;
+            }
+            hashes->resize(layout.layer_count);
+            memcpy(hashes->data(), bytes.data() + key_bytes, hashes->size() * sizeof(LayerHash));
+        } else if (bytes != chunk.bytes) {
+            *error = "its mip level sizes are different";
+            return false;
+        }
+    }
+    uint8_t last_byte = 0;
+    if (SeekOutput(f, layout.file_size - 1) != 0 || fread(&last_byte, 1, 1, f) != 1) {
+        *error = "it is truncated";
+        return false;
+    }
+    return true;
+}
+
+namespace {
+
+enum {
+    // VkFormat values
+    VK_FORMAT_R8G8B8A8_UNORM       = 37,
+    VK_FORMAT_BC1_RGB_UNORM_BLOCK  = 131,
+    VK_FORMAT_BC1_RGBA_UNORM_BLOCK = 133,
+    VK_FORMAT_BC3_UNORM_BLOCK      = 137,
+    VK_FORMAT_BC4_UNORM_BLOCK      = 139,
+    VK_FORMAT_BC5_UNORM_BLOCK      = 141,
+    VK_FORMAT_BC7_UNORM_BLOCK      = 145,
+    VK_FORMAT_ASTC_4x4_UNORM_BLOCK = 157,
+    VK_FORMAT_ASTC_5x4_UNORM_BLOCK = 159,
+    VK_FORMAT_ASTC_5x5_UNORM_BLOCK = 161,
+    VK_FORMAT_ASTC_6x5_UNORM_BLOCK = 163,
+    VK_FORMAT_ASTC_6x6_UNORM_BLOCK = 165,
+    VK_FORMAT_ASTC_8x5_UNORM_BLOCK = 167,
+    VK_FORMAT_ASTC_8x6_UNORM_BLOCK = 169,
+    VK_FORMAT_ASTC_8x8_UNORM_BLOCK = 171,
+
+    // Khronos Data Format descriptor fields
+    KHR_DF_MODEL_RGBSDA          = 1,
+    KHR_DF_MODEL_BC1A            = 128,
+    KHR_DF_MODEL_BC3             = 130,
+    KHR_DF_MODEL_BC4             = 131,
+    KHR_DF_MODEL_BC5             = 132,
+    KHR_DF_MODEL_BC7             = 134,
+    KHR_DF_MODEL_ASTC            = 162,
+    KHR_DF_PRIMARIES_BT709       = 1,
+    KHR_DF_TRANSFER_LINEAR       = 1,
+    KHR_DF_CHANNEL_DATA          = 0,  // R for RGBSDA/BC5, color for BC1A/BC3, data for BC4/BC7/ASTC
+    KHR_DF_CHANNEL_BC1A_ALPHA    = 1,  // BC1 with 1-bit alpha
+    KHR_DF_CHANNEL_G             = 1,  // G for RGBSDA/BC5
+    KHR_DF_CHANNEL_B             = 2,
+    KHR_DF_CHANNEL_ALPHA         = 15,
+};
+
+struct Ktx2FormatInfo {
+    uint32_t gl_internal_format;
+    uint32_t vk_format;
+    uint32_t color_model;
+};
+const Ktx2FormatInfo kKtx2Formats[] = {
+    { IMG2KTX_GL_RGBA8,                          VK_FORMAT_R8G8B8A8_UNORM,       KHR_DF_MODEL_RGBSDA },
+    { IMG2KTX_GL_COMPRESSED_RGB_S3TC_DXT1_EXT,   VK_FORMAT_BC1_RGB_UNORM_BLOCK,  KHR_DF_MODEL_BC1A },
+    { IMG2KTX_GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,  VK_FORMAT_BC1_RGBA_UNORM_BLOCK, KHR_DF_MODEL_BC1A },
+    { IMG2KTX_GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,  VK_FORMAT_BC3_UNORM_BLOCK,      KHR_DF_MODEL_BC3 },
+    { IMG2KTX_GL_COMPRESSED_RED_RGTC1,           VK_FORMAT_BC4_UNORM_BLOCK,      KHR_DF_MODEL_BC4 },
+    { IMG2KTX_GL_COMPRESSED_RG_RGTC2,            VK_FORMAT_BC5_UNORM_BLOCK,      KHR_DF_MODEL_BC5 },
+    { IMG2KTX_GL_COMPRESSED_RGBA_BPTC_UNORM_ARB, VK_FORMAT_BC7_UNORM_BLOCK,      KHR_DF_MODEL_BC7 },
+    { IMG2KTX_GL_COMPRESSED_RGBA_ASTC_4x4_KHR,   VK_FORMAT_ASTC_4x4_UNORM_BLOCK, KHR_DF_MODEL_ASTC },
+    { IMG2KTX_GL_COMPRESSED_RGBA_ASTC_5x4_KHR,   VK_FORMAT_ASTC_5x4_UNORM_BLOCK, KHR_DF_MODEL_ASTC },
+    { IMG2KTX_GL_COMPRESSED_RGBA_ASTC_5x5_KHR,   VK_FORMAT_ASTC_5x5_UNORM_BLOCK, KHR_DF_MODEL_ASTC },
+    { IMG2KTX_GL_COMPRESSED_RGBA_ASTC_6x5_KHR,   VK_FORMAT_ASTC_6x5_UNORM_BLOCK, KHR_DF_MODEL_ASTC },
+    { IMG2KTX_GL_COMPRESSED_RGBA_ASTC_6x6_KHR,   VK_FORMAT_ASTC_6x6_UNORM_BLOCK, KHR_DF_MODEL_ASTC },
+    { IMG2KTX_GL_COMPRESSED_RGBA_ASTC_8x5_KHR,   VK_FORMAT_ASTC_8x5_UNORM_BLOCK, KHR_DF_MODEL_ASTC },
+    { IMG2KTX_GL_COMPRESSED_RGBA_ASTC_8x6_KHR,   VK_FORMAT_ASTC_8x6_UNORM_BLOCK, KHR_DF_MODEL_ASTC },
+    { IMG2KTX_GL_COMPRESSED_RGBA_ASTC_8x8_KHR,   VK_FORMAT_ASTC_8x8_UNORM_BLOCK, KHR_DF_MODEL_ASTC },
+};
+
+const Ktx2FormatInfo* FindKtx2Format(const GlFormatInfo* format_info) {
+    for(const Ktx2FormatInfo& info : kKtx2Formats) {
+        if (info.gl_internal_format == format_info->internal_format) {
+            return &info;
+        }
+    }
+    return nullptr;
+}
+
+void AppendU32(std::vector<uint8_t>* out, uint32_t value) {
+    out->insert(out->end(), (const uint8_t*)&value, (const uint8_t*)&value + sizeof(value));
+}
+void AppendU64(std::vector<uint8_t>* out, uint64_t value) {
+    out->insert(out->end(), (const uint8_t*)&value, (const uint8_t*)&value + sizeof(value));
+}
+void PutU64(std::vector<uint8_t>* out, size_t offset, uint64_t value) {
+    memcpy(out->data() + offset, &value, sizeof(value));
+}
+
+// One sample of a basic data format descriptor block.
+void AppendDfdSample(std::vector<uint8_t>* dfd, uint32_t bit_offset, uint32_t bit_length, uint32_t channel,
+        uint32_t upper) {
+    AppendU32(dfd, bit_offset | ((bit_length - 1) << 16) | (channel << 24));
+    AppendU32(dfd, 0);  // sample position
+    AppendU32(dfd, 0);  // sampleLower
+    AppendU32(dfd, upper);  // sampleUpper
+}
+
+// Builds the complete DFD (dfdTotalSize followed by one basic descriptor block).
+std::vector<uint8_t> BuildDfd(const GlFormatInfo* format_info, const Ktx2FormatInfo* ktx2_format,
+        bool supercompressed) {
+    std::vector<uint8_t> samples;
+    switch(ktx2_format->color_model) {
+    case KHR_DF_MODEL_RGBSDA:
+        AppendDfdSample(&samples,  0, 8, KHR_DF_CHANNEL_DATA, 255);
+        AppendDfdSample(&samples,  8, 8, KHR_DF_CHANNEL_G, 255);
+        AppendDfdSample(&samples, 16, 8, KHR_DF_CHANNEL_B, 255);
+        AppendDfdSample(&samples, 24, 8, KHR_DF_CHANNEL_ALPHA, 255);
+        break;
+    case KHR_DF_MODEL_BC1A:
+        AppendDfdSample(&samples, 0, 64, (ktx2_format->vk_format == VK_FORMAT_BC1_RGBA_UNORM_BLOCK)
+                ? KHR_DF_CHANNEL_BC1A_ALPHA : KHR_DF_CHANNEL_DATA, 0xFFFFFFFF);
+        break;
+    case KHR_DF_MODEL_BC3:
+        AppendDfdSample(&samples,  0, 64, KHR_DF_CHANNEL_ALPHA, 0xFFFFFFFF);
+        AppendDfdSample(&samples, 64, 64, KHR_DF_CHANNEL_DATA, 0xFFFFFFFF);
+        break;
+    case KHR_DF_MODEL_BC4:
+        AppendDfdSample(&samples, 0, 64, KHR_DF_CHANNEL_DATA, 0xFFFFFFFF);
+        break;
+    case KHR_DF_MODEL_BC5:
+        AppendDfdSample(&samples,  0, 64, KHR_DF_CHANNEL_DATA, 0xFFFFFFFF);
+        AppendDfdSample(&samples, 64, 64, KHR_DF_CHANNEL_G, 0xFFFFFFFF);
+        break;
+    default:  // BC7, ASTC: a single 128-bit sample
+        AppendDfdSample(&samples, 0, 128, KHR_DF_CHANNEL_DATA, 0xFFFFFFFF);
+        break;
+    }
+    const uint32_t block_size = 24 + (uint32_t)samples.size();
+    std::vector<uint8_t> dfd;
+    AppendU32(&dfd, 4 + block_size);  // dfdTotalSize
+    AppendU32(&dfd, 0);  // vendorId = Khronos, descriptorType = basic
+    AppendU32(&dfd, 2 | (block_size << 16));  // versionNumber, descriptorBlockSize
+    AppendU32(&dfd, ktx2_format->color_model | (KHR_DF_PRIMARIES_BT709 << 8) | (KHR_DF_TRANSFER_LINEAR << 16));
+    const bool block_compressed = format_info->block_dim_x > 1 || format_info->block_dim_y > 1;
+    AppendU32(&dfd, block_compressed ? (format_info->block_dim_x - 1) | ((format_info->block_dim_y - 1) << 8) : 0);
+    AppendU32(&dfd, supercompressed ? 0 : format_info->block_bytes);  // bytesPlane0
+    AppendU32(&dfd, 0);  // bytesPlane4-7
+    dfd.insert(dfd.end(), samples.begin(), samples.end());
+    return dfd;
+}
+
+// Builds everything in front of the level data: identifier, header, index,
+// level index, DFD and key/value data. level_offsets/lengths are in level
+// order (level 0 first).
+std::vector<uint8_t> BuildKtx2Prefix(const Ktx2Description& desc, const std::vector<uint64_t>& level_offsets,
+        const std::vector<uint64_t>& level_lengths, const std::vector<uint64_t>& uncompressed_lengths) {
+    const Ktx2FormatInfo* ktx2_format = FindKtx2Format(desc.format_info);
+    const uint8_t identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+    std::vector<uint8_t> out(identifier, identifier + sizeof(identifier));
+    AppendU32(&out, ktx2_format ? ktx2_format->vk_format : 0);
+    AppendU32(&out, 1);  // typeSize
+    AppendU32(&out, desc.width);
+    AppendU32(&out, desc.height);
+    AppendU32(&out, 0);  // pixelDepth
+    AppendU32(&out, desc.layer_count);
+    AppendU32(&out, desc.face_count);
+    AppendU32(&out, (uint32_t)level_offsets.size());
+    AppendU32(&out, desc.supercompression);
+    const size_t index_offset = out.size();
+    out.resize(out.size() + 4 * sizeof(uint32_t) + 2 * sizeof(uint64_t));  // filled in below
+    for(size_t level = 0; level < level_offsets.size(); ++level) {
+        AppendU64(&out, level_offsets[level]);
+        AppendU64(&out, level_lengths[level]);
+        AppendU64(&out, uncompressed_lengths[level]);
+    }
+    const uint32_t dfd_offset = (uint32_t)out.size();
+    const std::vector<uint8_t> dfd = BuildDfd(desc.format_info, ktx2_format,
+            desc.supercompression != kKtx2SupercompressionNone);
+    out.insert(out.end(), dfd.begin(), dfd.end());
+    const uint32_t kvd_offset = (uint32_t)out.size();
+    const std::string key = "KTXwriter";
+    AppendU32(&out, (uint32_t)(key.size() + 1 + desc.writer.size() + 1));
+    out.insert(out.end(), key.begin(), key.end());
+    out.push_back(0);
+    out.insert(out.end(), desc.writer.begin(), desc.writer.end());
+    out.push_back(0);
+    while(out.size() % 4) {
+        out.push_back(0);
+    }
+    const uint32_t kvd_length = (uint32_t)out.size() - kvd_offset;
+    memcpy(out.data() + index_offset + 0, &dfd_offset, 4);
+    const uint32_t dfd_length = (uint32_t)dfd.size();
+    memcpy(out.data() + index_offset + 4, &dfd_length, 4);
+    memcpy(out.data() + index_offset + 8, &kvd_offset, 4);
+    memcpy(out.data() + index_offset + 12, &kvd_length, 4);
+    PutU64(&out, index_offset + 16, 0);  // sgdByteOffset: no supercompression global data
+    PutU64(&out, index_offset + 24, 0);  // sgdByteLength
+    return out;
+}
+
+// Size of the prefix BuildKtx2Prefix() will produce; it does not depend on the offsets.
+uint64_t Ktx2PrefixSize(const Ktx2Description& desc, size_t level_count) {
+    std::vector<uint64_t> zeros(level_count, 0);
+    return BuildKtx2Prefix(desc, zeros, zeros, zeros).size();
+}
+
+// Lays out KTX2 levels of the given byte lengths after the prefix, smallest
+// level (highest index) first, each aligned to alignment. Returns the file size.
+uint64_t PlaceKtx2Levels(uint64_t prefix_size, const std::vector<uint64_t>& level_lengths, uint64_t alignment,
+        std::vector<uint64_t>* level_offsets) {
+    level_offsets->assign(level_lengths.size(), 0);
+    uint64_t offset = prefix_size;
+    for(size_t level = level_lengths.size(); level-- > 0; ) {
+        offset = (offset + alignment - 1) / alignment * alignment;
+        (*level_offsets)[level] = offset;
+        offset += level_lengths[level];
+    }
+    return offset;
+}
+
+}  // namespace
+
+bool Ktx2SupportsFormat(const GlFormatInfo* format_info) {
+    return FindKtx2Format(format_info) != nullptr;
+}
+
+KtxLayout ComputeKtx2Layout(const Ktx2Description& desc, const std::vector<uint32_t>& mip_sizes) {
+    KtxLayout layout = {};
+    layout.layer_count = std::max(desc.layer_count, 1U) * desc.face_count;
+    layout.mip_sizes = mip_sizes;
+    std::vector<uint64_t> level_lengths(mip_sizes.size());
+    for(size_t mip = 0; mip < mip_sizes.size(); ++mip) {
+        level_lengths[mip] = (uint64_t)mip_sizes[mip] * layout.layer_count;
+    }
+    // Levels start at multiples of lcm(texel block size, 4). Block sizes are 4, 8 or 16.
+    const uint64_t alignment = std::max<uint64_t>(desc.format_info->block_bytes, 4);
+    std::vector<uint64_t> level_offsets;
+    layout.file_size = PlaceKtx2Levels(Ktx2PrefixSize(desc, mip_sizes.size()), level_lengths, alignment,
+            &level_offsets);
+    layout.chunks.push_back(KtxLayout::Chunk{0, BuildKtx2Prefix(desc, level_offsets, level_lengths, level_lengths)});
+    layout.data_offsets.resize(mip_sizes.size() * layout.layer_count);
+    for(size_t mip = 0; mip < mip_sizes.size(); ++mip) {
+        for(uint32_t layer = 0; layer < layout.layer_count; ++layer) {
+            layout.data_offsets[mip * layout.layer_count + layer] = level_offsets[mip] + (uint64_t)layer * mip_sizes[mip];
+        }
+    }
+    return layout;
+}
+
+KtxLayout ComputeSupercompressedKtx2Layout(const Ktx2Description& desc,
+        const std::vector<uint64_t>& level_lengths, const std::vector<uint64_t>& uncompressed_lengths) {
+    KtxLayout layout = {};
+    layout.layer_count = 1;
+    std::vector<uint64_t> level_offsets;
+    layout.file_size = PlaceKtx2Levels(Ktx2PrefixSize(desc, level_lengths.size()), level_lengths, 1,
+            &level_offsets);
+    layout.chunks.push_back(KtxLayout::Chunk{0, BuildKtx2Prefix(desc, level_offsets, level_lengths,
+            uncompressed_lengths)});
+    layout.data_offsets = level_offsets;
+    for(uint64_t length : level_lengths) {
+        layout.mip_sizes.push_back((uint32_t)length);
+    }
+    return layout;
+}
+
+int SeekOutput(FILE* f, uint64_t offset) {
+#if defined(_MSC_VER)
+    return _fseeki64(f, (__int64)offset, SEEK_SET);
+#else
+    return fseeko(f, (off_t)offset, SEEK_SET);
+#endif
+}
+
+bool WriteKtxSkeleton(FILE* f, const KtxLayout& layout) {
+    // Every byte that is not part of a chunk or of layer data is padding.
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;  // [begin, end)
+    for(const auto& chunk : layout.chunks) {
+        ranges.push_back(std::make_pair(chunk.offset, chunk.offset + chunk.bytes.size()));
+    }
+    for(size_t mip = 0; mip < layout.mip_sizes.size(); ++mip) {
+        for(uint32_t layer = 0; layer < layout.layer_count; ++layer) {
+            const uint64_t begin = layout.DataOffset((int)mip, (int)layer);
+            ranges.push_back(std::make_pair(begin, begin + layout.mip_sizes[mip]));
+        }
+    }
+    std::sort(ranges.begin(), ranges.end());
+    ranges.push_back(std::make_pair(layout.file_size, layout.file_size));
+    static const uint8_t zeros[16] = {};
+    bool ok = true;
+    uint64_t covered = 0;
+    for(const auto& range : ranges) {
+        while(ok && covered < range.first) {
+            const size_t gap = (size_t)std::min<uint64_t>(range.first - covered, sizeof(zeros));
+            ok = (SeekOutput(f, covered) == 0) && fwrite(zeros, 1, gap, f) == gap;
+            covered += gap;
+        }
+        covered = std::max(covered, range.second);
+    }
+    for(size_t c = 0; ok && c < layout.chunks.size(); ++c) {
+        const auto& chunk = layout.chunks[c];
+        ok = (SeekOutput(f, chunk.offset) == 0) &&
+            fwrite(chunk.bytes.data(), 1, chunk.bytes.size(), f) == chunk.bytes.size();
+    }
+    return ok;
+}
+
+void WriteKtxSkeleton(uint8_t* mapped_output, const KtxLayout& layout) {
+    for(const auto& chunk : layout.chunks) {
+        memcpy(mapped_output + chunk.offset, chunk.bytes.data(), chunk.bytes.size());
+    }
+}
+
+LayerWriter::LayerWriter(FILE* f, const KtxLayout& layout, std::vector<ImagePixels>& images,
+        std::function<void()> on_layer_written)
+    : m_file(f), m_mapped_output(nullptr), m_layout(layout), m_images(images), m_on_layer_written(on_layer_written),
+      m_written(images.size(), false), m_write_seconds(images.size(), 0.0), m_thread(&LayerWriter::ThreadMain, this) {}
+
+LayerWriter::LayerWriter(uint8_t* mapped_output, const KtxLayout& layout, std::vector<ImagePixels>& images,
+        std::function<void()> on_layer_written)
+    : m_file(nullptr), m_mapped_output(mapped_output), m_layout(layout), m_images(images),
+      m_on_layer_written(on_layer_written), m_written(images.size(), false), m_write_seconds(images.size(), 0.0),
+      m_thread(&LayerWriter::ThreadMain, this) {}
+
+LayerWriter::~LayerWriter() {
+    Finish();
+}
+
+void LayerWriter::Push(int layer) {
+    Enqueue(WriteRequest{layer, -1});
+}
+
+void LayerWriter::PushDuplicate(int layer, int source_layer) {
+    Enqueue(WriteRequest{layer, source_layer});
+}
+
+void LayerWriter::PushUnchanged(int layer) {
+    Enqueue(WriteRequest{layer, layer});
+}
+
+bool LayerWriter::Finish() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+    }
+    m_cv.notify_one();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    return !m_failed;
+}
+
+void LayerWriter::Enqueue(const WriteRequest& request) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(request);
+    }
+    m_cv.notify_one();
+}
+
+void LayerWriter::WriteAt(uint64_t offset, const uint8_t* data, size_t size) {
+    if (m_mapped_output) {
+        if (data != m_mapped_output + offset) {
+            memcpy(m_mapped_output + offset, data, size);
+        }
+        return;
+    }
+    if (SeekOutput(m_file, offset) != 0 || fwrite(data, 1, size, m_file) != size) {
+        m_failed = true;
+    }
+}
+
+void LayerWriter::CopyWrittenLayer(int source_layer, int layer) {
+    if (m_mapped_output) {
+        for(size_t mip = 0; mip < m_layout.mip_sizes.size(); ++mip) {
+            WriteAt(m_layout.DataOffset((int)mip, layer), m_mapped_output + m_layout.DataOffset((int)mip, source_layer),
+                    m_layout.mip_sizes[mip]);
+        }
+        return;
+    }
+    std::vector<uint8_t> scratch;
+    for(size_t mip = 0; mip < m_layout.mip_sizes.size(); ++mip) {
+        scratch.resize(m_layout.mip_sizes[mip]);
+        if (SeekOutput(m_file, m_layout.DataOffset((int)mip, source_layer)) != 0 ||
+                fread(scratch.data(), 1, scratch.size(), m_file) != scratch.size()) {
+            m_failed = true;
+            return;
+        }
+        WriteAt(m_layout.DataOffset((int)mip, layer), scratch.data(), scratch.size());
+    }
+}
+
+void LayerWriter::ThreadMain() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for(;;) {
+        m_cv.wait(lock, [this]{ return m_done || !m_queue.empty(); });
+        if (m_queue.empty()) {
+            return;
+        }
+        WriteRequest request = m_queue.front();
+        m_queue.pop_front();
+        lock.unlock();
+        const int layer = request.layer;
+        const auto start = std::chrono::steady_clock::now();
+        if (request.source_layer == layer) {
+            m_written[layer] = true;
+            auto dups = m_pending_duplicates.find(layer);
+            if (dups != m_pending_duplicates.end()) {
+                for(int dup : dups->second) {
+                    CopyWrittenLayer(layer, dup);
+                }
+                m_pending_duplicates.erase(dups);
+            }
+            m_write_seconds[layer] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        } else if (request.source_layer >= 0) {
+            if (m_written[request.source_layer]) {
+                CopyWrittenLayer(request.source_layer, layer);
+                m_write_seconds[layer] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            } else {
+                m_pending_duplicates[request.source_layer].push_back(layer);
+            }
+        } else {
+            auto& img = m_images[layer];
+            auto dups = m_pending_duplicates.find(layer);
+            for(size_t mip = 0; mip < img.output_mips.size(); ++mip) {
+                WriteAt(m_layout.DataOffset((int)mip, layer),
+                        img.output_mips[mip].bytes.data(), m_layout.mip_sizes[mip]);
+                if (dups != m_pending_duplicates.end()) {
+                    for(int dup : dups->second) {
+                        WriteAt(m_layout.DataOffset((int)mip, dup),
+                                img.output_mips[mip].bytes.data(), m_layout.mip_sizes[mip]);
+                    }
+                }
+            }
+            if (dups != m_pending_duplicates.end()) {
+                m_pending_duplicates.erase(dups);
+            }
+            m_written[layer] = true;
+            m_write_seconds[layer] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::vector<MipLevel>().swap(img.output_mips);
+            m_on_layer_written();
+        }
+        lock.lock();
+    }
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#include "buffer_pool.h"
+#include "encoders.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct MipLevel {
+    PixelBuffer bytes;
+};
+struct ImagePixels {
+    std::vector<MipLevel> input_mips;  // padded
+    std::vector<MipLevel> output_mips;
+};
+
+struct KtxHeader {
+    uint8_t identifier[12];
+    uint32_t endianness;
+    uint32_t glType;
+    uint32_t glTypeSize;
+    uint32_t glFormat;
+    uint32_t glInternalFormat;
+    uint32_t glBaseInternalFormat;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t numberOfArrayElements;
+    uint32_t numberOfFaces;
+    uint32_t numberOfMipmapLevels;
+    uint32_t bytesOfKeyValueData;
+};
+
+// File offsets of every part of a KTX or KTX2 file, computed before any pixel
+// data exists. This lets each layer be written as soon as it is compressed.
+struct KtxLayout {
+    // Bytes at a fixed offset that do not depend on the pixel data (headers,
+    // imageSize fields, level index, ...).
+    struct Chunk {
+        uint64_t offset;
+        std::vector<uint8_t> bytes;
+    };
+    std::vector<Chunk> chunks;
+    uint32_t layer_count;  // array elements * faces
+    std::vector<uint32_t> mip_sizes;  // compressed size of one layer/face at each mip
+    std::vector<uint64_t> data_offsets;  // [mip * layer_count + layer]
+    uint64_t file_size;
+
+    uint64_t DataOffset(int mip, int layer) const { return data_offsets[mip * layer_count + layer]; }
+};
+
+// key_value_data, if any, must be header.bytesOfKeyValueData bytes long.
+KtxLayout ComputeKtxLayout(const KtxHeader& header, const std::vector<uint32_t>& mip_sizes,
+        const std::vector<uint8_t>& key_value_data = std::vector<uint8_t>());
+
+// 128-bit hash of the input of one layer: its padded base level, seeded with
+// the settings that affect its output.
+struct LayerHash {
+    uint64_t lo, hi;
+
+    bool operator==(const LayerHash& other) const { return lo == other.lo && hi == other.hi; }
+};
+
+// KTX1 files written by img2ktx hold a single key/value pair: the LayerHash of
+// every layer, so --update can tell which layers need to be recompressed.
+// Returns the complete key/value data.
+std::vector<uint8_t> BuildLayerHashKeyValueData(const std::vector<LayerHash>& hashes);
+
+// Checks that the KTX1 file f can be updated in place with layout: the same
+// format, dimensions, mip and layer counts, per-mip image sizes and key/value
+// data size as header. On success, reads the layer hashes stored in the file.
+// Returns false (with a description in *error) on mismatch or I/O error.
+bool ReadKtxForUpdate(FILE* f, const KtxHeader& header, const KtxLayout& layout,
+        std::vector<LayerHash>* hashes, std::string* error);
+
+enum Ktx2Supercompression {
+    kKtx2SupercompressionNone = 0,
+    kKtx2SupercompressionZstd = 2,
+    kKtx2SupercompressionZlib = 3,
+};
+
+struct Ktx2Description {
+    const GlFormatInfo* format_info;
+    uint32_t width;
+    uint32_t height;
+    uint32_t layer_count;  // 0 if not an array texture
+    uint32_t face_count;
+    Ktx2Supercompression supercompression;
+    std::string writer;  // stored as the KTXwriter key
+};
+
+// Returns false if the format has no VkFormat equivalent.
+bool Ktx2SupportsFormat(const GlFormatInfo* format_info);
+
+// Layout of a KTX2 file without supercompression. Levels are stored smallest
+// first, so a streaming reader gets the mip tail before the large levels.
+// Within a level, layers/faces are stored in the same order as KTX1.
+KtxLayout ComputeKtx2Layout(const Ktx2Description& desc, const std::vector<uint32_t>& mip_sizes);
+
+// Layout of a supercompressed KTX2 file, once the compressed length of every
+// level is known. The result has one "layer" per level:
+// DataOffset(level, 0) is where level_lengths[level] bytes go.
+KtxLayout ComputeSupercompressedKtx2Layout(const Ktx2Description& desc,
+        const std::vector<uint64_t>& level_lengths, const std::vector<uint64_t>& uncompressed_lengths);
+
+// fseek() with 64-bit offsets. Returns 0 on success.
+int SeekOutput(FILE* f, uint64_t offset);
+
+// Writes everything except the layer data: every chunk (header, imageSize
+// fields, ...) and zeros in every padding gap. Returns false on I/O error.
+bool WriteKtxSkeleton(FILE* f, const KtxLayout& layout);
+// Same, for an output file mapped into memory at mapped_output. Only the
+// chunks are written; the gaps of a freshly created file are already zero.
+void WriteKtxSkeleton(uint8_t* mapped_output, const KtxLayout& layout);
+
+// Final pipeline stage: writes finished layers to their precomputed offsets on
+// a dedicated thread, then frees their buffers and tells the decode stage that
+// another layer may be loaded. Layers that duplicate an earlier layer are never
+// compressed; the writer copies the source layer's data to their offsets
+// instead, either when the source is written or (if it already was) by reading
+// it back from the output file.
+//
+// With a memory-mapped output, output_mips that already point into the
+// mapping at their final offsets (see PixelBuffer::Wrap()) are not copied at
+// all; the writer only fills in duplicates and releases in-flight slots.
+class LayerWriter {
+public:
+    LayerWriter(FILE* f, const KtxLayout& layout, std::vector<ImagePixels>& images,
+            std::function<void()> on_layer_written);
+    LayerWriter(uint8_t* mapped_output, const KtxLayout& layout, std::vector<ImagePixels>& images,
+            std::function<void()> on_layer_written);
+    ~LayerWriter();
+
+    // Queues a layer whose output_mips are complete.
+    void Push(int layer);
+    // Queues a layer whose data is identical to source_layer's (which must be
+    // Push()ed or PushUnchanged()ed at some point). Does not call
+    // on_layer_written for it.
+    void PushDuplicate(int layer, int source_layer);
+    // Queues a layer whose data is already in the output file (--update).
+    // Nothing is written for it; duplicates of it are copied from the file.
+    // Does not call on_layer_written for it.
+    void PushUnchanged(int layer);
+
+    // Writes any queued layers and stops the thread. Returns false if any write failed.
+    bool Finish();
+    // Seconds spent writing a layer (including copies of it to its duplicates,
+    // or reading it back for a duplicate). Only valid after Finish().
+    double LayerWriteSeconds(int layer) const { return m_write_seconds[layer]; }
+
+private:
+    struct WriteRequest {
+        int layer;
+        int source_layer;  // -1 unless layer is a duplicate; layer itself if unchanged
+    };
+
+    void Enqueue(const WriteRequest& request);
+    void WriteAt(uint64_t offset, const uint8_t* data, size_t size);
+    // Copies an already-written layer's data to another layer's offsets.
+    void CopyWrittenLayer(int source_layer, int layer);
+    void ThreadMain();
+
+    FILE* m_file;
+    uint8_t* m_mapped_output;  // null unless writing to a mapped file
+    const KtxLayout& m_layout;
+    std::vector<ImagePixels>& m_images;
+    std::function<void()> m_on_layer_written;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<WriteRequest> m_queue;
+    bool m_done = false;
+    bool m_failed = false;
+    // Only accessed by the writer thread:
+    std::vector<bool> m_written;
+    std::vector<double> m_write_seconds;
+    std::map<int, std::vector<int>> m_pending_duplicates;  // source layer -> duplicates
+    std::thread m_thread;  // declared last, so it starts after the members above are initialized
+};
\ No newline at end of file
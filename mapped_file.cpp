@@ -0,0 +1,159 @@
+#include "mapped_file.h"
+
+#include <algorithm>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+#if defined(_WIN32)
+
+bool MappedFile::Create(const std::string& filename, uint64_t size) {
+    Close();
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    m_file = file;
+    // Mapping more than the current file size extends the file.
+    m_mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, nullptr);
+    if (m_mapping) {
+        m_data = (uint8_t*)MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, (SIZE_T)size);
+    }
+    if (!m_data) {
+        Close();
+        return false;
+    }
+    m_size = size;
+    return true;
+}
+
+bool MappedFile::Open(const std::string& filename) {
+    Close();
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    m_file = file;
+    LARGE_INTEGER size = {};
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+        m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    }
+    if (m_mapping) {
+        m_data = (uint8_t*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (!m_data) {
+        Close();
+        return false;
+    }
+    m_size = (uint64_t)size.QuadPart;
+    return true;
+}
+
+void MappedFile::Discard(uint64_t, uint64_t) {
+    // Clean pages of a read-only view are trimmed from the working set as
+    // needed; there is no cheap way to ask for it early.
+}
+
+bool MappedFile::Close() {
+    bool ok = true;
+    if (m_data) {
+        ok = UnmapViewOfFile(m_data) != 0;
+    }
+    if (m_mapping) {
+        CloseHandle(m_mapping);
+    }
+    if (m_file) {
+        CloseHandle(m_file);
+    }
+    m_data = nullptr;
+    m_size = 0;
+    m_mapping = nullptr;
+    m_file = nullptr;
+    return ok;
+}
+
+#else
+
+bool MappedFile::Create(const std::string& filename, uint64_t size) {
+    Close();
+    m_fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m_fd < 0) {
+        return false;
+    }
+#if defined(__linux__)
+    // Reserve the disk space now. A sparse file that cannot be filled in later
+    // would fail with SIGBUS on a store to the mapping, not with an error.
+    const bool sized = posix_fallocate(m_fd, 0, (off_t)size) == 0;
+#else
+    const bool sized = ftruncate(m_fd, (off_t)size) == 0;
+#endif
+    if (!sized) {
+        Close();
+        return false;
+    }
+    void* data = mmap(nullptr, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (data == MAP_FAILED) {
+        Close();
+        return false;
+    }
+    m_data = (uint8_t*)data;
+    m_size = size;
+    return true;
+}
+
+bool MappedFile::Open(const std::string& filename) {
+    Close();
+    m_fd = open(filename.c_str(), O_RDONLY);
+    struct stat st = {};
+    if (m_fd < 0 || fstat(m_fd, &st) != 0 || st.st_size <= 0) {
+        Close();
+        return false;
+    }
+    void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (data == MAP_FAILED) {
+        Close();
+        return false;
+    }
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+    m_data = (uint8_t*)data;
+    m_size = (uint64_t)st.st_size;
+    return true;
+}
+
+void MappedFile::Discard(uint64_t offset, uint64_t size) {
+    const uint64_t page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+    const uint64_t begin = (offset + page_size - 1) / page_size * page_size;
+    const uint64_t end = std::min(offset + size, m_size) / page_size * page_size;
+    if (m_data && begin < end) {
+        madvise(m_data + begin, (size_t)(end - begin), MADV_DONTNEED);
+    }
+}
+
+bool MappedFile::Close() {
+    bool ok = true;
+    if (m_data) {
+        ok = munmap(m_data, (size_t)m_size) == 0;
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+    m_data = nullptr;
+    m_size = 0;
+    m_fd = -1;
+    return ok;
+}
+
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// A file mapped into memory. Create() maps a new file for writing and sizes it
+// up front, so every byte can be written in place, from any thread, without
+// seeks or buffered I/O; bytes that are never written read back as zeros.
+// Open() maps an existing file read-only, so it can be read without copying
+// it into a buffer first.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Creates (or truncates) filename, resizes it to size bytes and maps it.
+    // Returns false on failure.
+    bool Create(const std::string& filename, uint64_t size);
+    // Maps an existing, non-empty file for reading. Returns false on failure.
+    // The OS is told the file will be read sequentially.
+    bool Open(const std::string& filename);
+    // Tells the OS that bytes [offset, offset + size) of a file mapped with
+    // Open() will not be read again, so their pages can leave this process's
+    // working set right away. Only whole pages inside the range are affected.
+    void Discard(uint64_t offset, uint64_t size);
+    // Unmaps the file. Its pages are written back by the OS, as with fclose().
+    bool Close();
+
+    uint8_t* data() { return m_data; }
+    uint64_t size() const { return m_size; }
+
+private:
+    uint8_t* m_data = nullptr;
+    uint64_t m_size = 0;
+#if defined(_WIN32)
+    void* m_file = nullptr;  // HANDLE
+    void* m_mapping = nullptr;  // HANDLE
+#else
+    int m_fd = -1;
+#endif
+};
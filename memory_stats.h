@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstdint>
+
+// Highest resident set size (physical memory) this process has used so far,
+// in bytes. Returns 0 if the platform does not report it.
+uint64_t PeakResidentBytes();
@@ -0,0 +1,164 @@
+#include "mip_cache.h"
+
+#include "hash64.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <system_error>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+const uint32_t kEntryMagic = 0x434B3249;  // "I2KC"
+const uint32_t kEntryVersion = 1;
+const char kEntryExtension[] = ".bin";
+// Temporary files older than this were left behind by a crashed process.
+const auto kStaleTempAge = std::chrono::hours(1);
+
+struct EntryHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t payload_size;
+    uint64_t payload_hash;
+};
+}  // namespace
+
+MipCache::MipCache(const std::string& dir, uint64_t max_bytes)
+    : m_dir(dir), m_max_bytes(max_bytes), m_temp_counter(0),
+      m_hits(0), m_misses(0), m_evictions(0) {
+    std::random_device rd;
+    m_temp_prefix = ((uint64_t)rd() << 32) ^ rd() ^
+        (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+MipCacheKey MipCache::MakeKey(const uint8_t* pixels, size_t pixel_bytes,
+        int width, int height, const std::string& encoder) {
+    struct {
+        int32_t width, height;
+        uint64_t pixels_lo, pixels_hi;
+    } desc = {};
+    desc.width = width;
+    desc.height = height;
+    desc.pixels_lo = Hash64(pixels, pixel_bytes, 0);
+    desc.pixels_hi = Hash64(pixels, pixel_bytes, desc.pixels_lo);
+    MipCacheKey key;
+    key.lo = Hash64(encoder.data(), encoder.size(), Hash64(&desc, sizeof(desc), 1));
+    key.hi = Hash64(encoder.data(), encoder.size(), Hash64(&desc, sizeof(desc), 2));
+    return key;
+}
+
+std::string MipCache::EntryPath(const MipCacheKey& key) const {
+    char name[40];
+    snprintf(name, sizeof(name), "%016llx%016llx", (unsigned long long)key.hi, (unsigned long long)key.lo);
+    // Shard by the first byte so no single directory grows too large.
+    return m_dir + "/" + std::string(name, 2) + "/" + name + kEntryExtension;
+}
+
+bool MipCache::Load(const MipCacheKey& key, uint8_t* dst, size_t size) {
+    const std::string path = EntryPath(key);
+    bool hit = false;
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f) {
+        EntryHeader header = {};
+        hit = fread(&header, sizeof(header), 1, f) == 1 &&
+            header.magic == kEntryMagic && header.version == kEntryVersion &&
+            header.payload_size == size &&
+            fread(dst, 1, size, f) == size &&
+            Hash64(dst, size) == header.payload_hash;
+        fclose(f);
+        if (hit) {
+            // Mark the entry as recently used for Trim().
+            std::error_code ec;
+            fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+        }
+    }
+    (hit ? m_hits : m_misses) += 1;
+    return hit;
+}
+
+void MipCache::Store(const MipCacheKey& key, const uint8_t* src, size_t size) {
+    const std::string path = EntryPath(key);
+    std::error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+    char suffix[48];
+    snprintf(suffix, sizeof(suffix), ".%016llx.%llu.tmp", (unsigned long long)m_temp_prefix,
+            (unsigned long long)m_temp_counter++);
+    const std::string temp_path = path + suffix;
+    FILE* f = fopen(temp_path.c_str(), "wb");
+    if (!f) {
+        return;  // the cache is best-effort
+    }
+    EntryHeader header = {};
+    header.magic = kEntryMagic;
+    header.version = kEntryVersion;
+    header.payload_size = size;
+    header.payload_hash = Hash64(src, size);
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+        fwrite(src, 1, size, f) == size;
+    ok = (fclose(f) == 0) && ok;
+    if (ok) {
+        // Atomic replace; if another process stored the same entry first, the
+        // contents are identical anyway.
+        fs::rename(temp_path, path, ec);
+        ok = !ec;
+    }
+    if (!ok) {
+        fs::remove(temp_path, ec);
+    }
+}
+
+void MipCache::Trim() {
+    struct Entry {
+        fs::path path;
+        uint64_t size;
+        fs::file_time_type last_used;
+    };
+    std::vector<Entry> entries;
+    uint64_t total_bytes = 0;
+    const auto now = fs::file_time_type::clock::now();
+    std::error_code ec;
+    for(fs::recursive_directory_iterator it(m_dir, ec), end; !ec && it != end; it.increment(ec)) {
+        std::error_code entry_ec;
+        if (!it->is_regular_file(entry_ec)) {
+            continue;
+        }
+        Entry e;
+        e.path = it->path();
+        e.size = it->file_size(entry_ec);
+        e.last_used = it->last_write_time(entry_ec);
+        if (entry_ec) {
+            continue;  // removed by another process
+        }
+        if (e.path.extension() == ".tmp") {
+            if (now - e.last_used > kStaleTempAge) {
+                fs::remove(e.path, entry_ec);
+            }
+            continue;
+        }
+        if (e.path.extension() != kEntryExtension) {
+            continue;
+        }
+        total_bytes += e.size;
+        entries.push_back(e);
+    }
+    if (total_bytes <= m_max_bytes) {
+        return;
+    }
+    std::sort(entries.begin(), entries.end(),
+            [](const Entry& a, const Entry& b) { return a.last_used < b.last_used; });
+    for(const auto& e : entries) {
+        if (total_bytes <= m_max_bytes) {
+            break;
+        }
+        // Another process may have already evicted (or be reading) this entry;
+        // either way it no longer counts against this trim.
+        if (fs::remove(e.path, ec)) {
+            m_evictions += 1;
+        }
+        total_bytes -= e.size;
+    }
+}
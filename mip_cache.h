@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 128-bit content address of one compressed mip level.
+struct MipCacheKey {
+    uint64_t hi, lo;
+};
+
+// An on-disk, content-addressed store of compressed mip levels. Entries are
+// written to a temporary file and renamed into place, so several processes
+// may share one directory: readers only ever see complete entries, and every
+// entry carries a checksum that is verified on load. Trim() evicts the least
+// recently used entries until the directory fits in the size limit.
+class MipCache {
+public:
+    MipCache(const std::string& dir, uint64_t max_bytes);
+
+    // Builds the key for one padded input surface. `encoder` must identify
+    // everything else that affects the compressed bytes (format, encoder
+    // profile, tool version).
+    static MipCacheKey MakeKey(const uint8_t* pixels, size_t pixel_bytes,
+            int width, int height, const std::string& encoder);
+
+    // Copies the cached entry for key into dst if it exists and is exactly
+    // size bytes. Returns false on a miss.
+    bool Load(const MipCacheKey& key, uint8_t* dst, size_t size);
+    void Store(const MipCacheKey& key, const uint8_t* src, size_t size);
+    // Deletes least recently used entries until the cache fits in max_bytes.
+    void Trim();
+
+    uint64_t Hits() const { return m_hits; }
+    uint64_t Misses() const { return m_misses; }
+    uint64_t Evictions() const { return m_evictions; }
+
+private:
+    std::string EntryPath(const MipCacheKey& key) const;
+
+    std::string m_dir;
+    uint64_t m_max_bytes;
+    uint64_t m_temp_prefix;  // makes temporary file names unique to this process
+    std::atomic<uint64_t> m_temp_counter;
+    std::atomic<uint64_t> m_hits, m_misses, m_evictions;
+};
@@ -0,0 +1,358 @@
+#include "mip_downsample.h"
+
+#include "cpu_features.h"
+#include "worker_pool.h"
+
+#include <stb_image_resize.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(IMG2KTX_X86)
+#include <immintrin.h>
+#endif
+#if defined(IMG2KTX_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+const char* const kResizeFilterNames[kResizeFilterCount] = {
+    "default", "box", "triangle", "cubicbspline", "catmullrom", "mitchell",
+};
+const stbir_filter kResizeStbirFilters[kResizeFilterCount] = {
+    STBIR_FILTER_DEFAULT, STBIR_FILTER_BOX, STBIR_FILTER_TRIANGLE, STBIR_FILTER_CUBICBSPLINE,
+    STBIR_FILTER_CATMULLROM, STBIR_FILTER_MITCHELL,
+};
+
+// Output rows per ResizeImage() task. Each strip also filters the few source
+// rows its neighbours share with it, so strips should be much taller than the
+// filter is wide.
+const int kResizeStripRows = 64;
+
+// Averages pairs of RGBA pixels across two rows: dst[i] = round(mean of
+// top[2i], top[2i+1], bottom[2i], bottom[2i+1]). Each kernel handles a prefix
+// of the row and returns how many output pixels it wrote.
+typedef int (*Box2x2RowFunc)(const uint8_t* top, const uint8_t* bottom, uint8_t* dst, int dst_width);
+
+int Box2x2RowScalar(const uint8_t* top, const uint8_t* bottom, uint8_t* dst, int dst_width) {
+    for(int x = 0; x < dst_width * 4; ++x) {
+        const int sx = (x & ~3) * 2 + (x & 3);
+        dst[x] = (uint8_t)((top[sx] + top[sx + 4] + bottom[sx] + bottom[sx + 4] + 2) >> 2);
+    }
+    return dst_width;
+}
+
+#if defined(IMG2KTX_X86)
+// 4 output pixels per iteration. Pixels are widened to 16 bits, summed
+// vertically, then each pixel is added to its horizontal neighbour by swapping
+// the 64-bit halves of the register.
+IMG2KTX_TARGET("sse2")
+int Box2x2RowSse2(const uint8_t* top, const uint8_t* bottom, uint8_t* dst, int dst_width) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+    int x = 0;
+    for(; x + 4 <= dst_width; x += 4) {
+        __m128i t0 = _mm_loadu_si128((const __m128i*)(top + x * 8));
+        __m128i t1 = _mm_loadu_si128((const __m128i*)(top + x * 8 + 16));
+        __m128i b0 = _mm_loadu_si128((const __m128i*)(bottom + x * 8));
+        __m128i b1 = _mm_loadu_si128((const __m128i*)(bottom + x * 8 + 16));
+        __m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(t0, zero), _mm_unpacklo_epi8(b0, zero));  // px 0,1
+        __m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(t0, zero), _mm_unpackhi_epi8(b0, zero));  // px 2,3
+        __m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(t1, zero), _mm_unpacklo_epi8(b1, zero));  // px 4,5
+        __m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(t1, zero), _mm_unpackhi_epi8(b1, zero));  // px 6,7
+        s0 = _mm_add_epi16(s0, _mm_shuffle_epi32(s0, _MM_SHUFFLE(1, 0, 3, 2)));
+        s1 = _mm_add_epi16(s1, _mm_shuffle_epi32(s1, _MM_SHUFFLE(1, 0, 3, 2)));
+        s2 = _mm_add_epi16(s2, _mm_shuffle_epi32(s2, _MM_SHUFFLE(1, 0, 3, 2)));
+        s3 = _mm_add_epi16(s3, _mm_shuffle_epi32(s3, _MM_SHUFFLE(1, 0, 3, 2)));
+        __m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(s0, s1), two), 2);
+        __m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(s2, s3), two), 2);
+        _mm_storeu_si128((__m128i*)(dst + x * 4), _mm_packus_epi16(lo, hi));
+    }
+    return x;
+}
+
+// Same as the SSE2 kernel, 8 output pixels per iteration. All shuffles stay
+// within 128-bit lanes until the final cross-lane permute.
+IMG2KTX_TARGET("avx2")
+int Box2x2RowAvx2(const uint8_t* top, const uint8_t* bottom, uint8_t* dst, int dst_width) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i two = _mm256_set1_epi16(2);
+    int x = 0;
+    for(; x + 8 <= dst_width; x += 8) {
+        __m256i t0 = _mm256_loadu_si256((const __m256i*)(top + x * 8));        // px 0-3 | 4-7
+        __m256i t1 = _mm256_loadu_si256((const __m256i*)(top + x * 8 + 32));   // px 8-11 | 12-15
+        __m256i b0 = _mm256_loadu_si256((const __m256i*)(bottom + x * 8));
+        __m256i b1 = _mm256_loadu_si256((const __m256i*)(bottom + x * 8 + 32));
+        __m256i s0 = _mm256_add_epi16(_mm256_unpacklo_epi8(t0, zero), _mm256_unpacklo_epi8(b0, zero));  // 0,1 | 4,5
+        __m256i s1 = _mm256_add_epi16(_mm256_unpackhi_epi8(t0, zero), _mm256_unpackhi_epi8(b0, zero));  // 2,3 | 6,7
+        __m256i s2 = _mm256_add_epi16(_mm256_unpacklo_epi8(t1, zero), _mm256_unpacklo_epi8(b1, zero));  // 8,9 | 12,13
+        __m256i s3 = _mm256_add_epi16(_mm256_unpackhi_epi8(t1, zero), _mm256_unpackhi_epi8(b1, zero));  // 10,11 | 14,15
+        s0 = _mm256_add_epi16(s0, _mm256_shuffle_epi32(s0, _MM_SHUFFLE(1, 0, 3, 2)));
+        s1 = _mm256_add_epi16(s1, _mm256_shuffle_epi32(s1, _MM_SHUFFLE(1, 0, 3, 2)));
+        s2 = _mm256_add_epi16(s2, _mm256_shuffle_epi32(s2, _MM_SHUFFLE(1, 0, 3, 2)));
+        s3 = _mm256_add_epi16(s3, _mm256_shuffle_epi32(s3, _MM_SHUFFLE(1, 0, 3, 2)));
+        __m256i lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_unpacklo_epi64(s0, s1), two), 2);  // out 0,1 | 2,3
+        __m256i hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_unpacklo_epi64(s2, s3), two), 2);  // out 4,5 | 6,7
+        __m256i packed = _mm256_packus_epi16(lo, hi);  // out 0,1,4,5 | 2,3,6,7
+        packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i*)(dst + x * 4), packed);
+    }
+    return x;
+}
+#endif  // IMG2KTX_X86
+
+#if defined(IMG2KTX_NEON)
+// 4 output pixels per iteration. vld2q_u32 splits even and odd pixels, so
+// horizontal neighbours line up in the same lanes.
+int Box2x2RowNeon(const uint8_t* top, const uint8_t* bottom, uint8_t* dst, int dst_width) {
+    int x = 0;
+    for(; x + 4 <= dst_width; x += 4) {
+        uint32x4x2_t t = vld2q_u32((const uint32_t*)(top + x * 8));
+        uint32x4x2_t b = vld2q_u32((const uint32_t*)(bottom + x * 8));
+        uint8x16_t te = vreinterpretq_u8_u32(t.val[0]), to = vreinterpretq_u8_u32(t.val[1]);
+        uint8x16_t be = vreinterpretq_u8_u32(b.val[0]), bo = vreinterpretq_u8_u32(b.val[1]);
+        uint16x8_t lo = vaddq_u16(vaddl_u8(vget_low_u8(te), vget_low_u8(to)),
+                vaddl_u8(vget_low_u8(be), vget_low_u8(bo)));
+        uint16x8_t hi = vaddq_u16(vaddl_u8(vget_high_u8(te), vget_high_u8(to)),
+                vaddl_u8(vget_high_u8(be), vget_high_u8(bo)));
+        vst1q_u8(dst + x * 4, vcombine_u8(vrshrn_n_u16(lo, 2), vrshrn_n_u16(hi, 2)));
+    }
+    return x;
+}
+#endif  // IMG2KTX_NEON
+
+Box2x2RowFunc SelectBox2x2Row() {
+#if defined(IMG2KTX_X86)
+    const CpuFeatures& cpu = GetCpuFeatures();
+    if (cpu.avx2) {
+        return Box2x2RowAvx2;
+    }
+    if (cpu.sse2) {
+        return Box2x2RowSse2;
+    }
+#elif defined(IMG2KTX_NEON)
+    return Box2x2RowNeon;
+#endif
+    return Box2x2RowScalar;
+}
+
+// sRGB <-> linear conversion tables. Linear values are 16-bit fixed point, so
+// the decode table is exact enough that encode(decode(v)) == v for every v.
+// Entries are laid out for AVX2 gathers: to_linear is 32 bits wide, and
+// to_srgb has 3 bytes of padding so a 32-bit load at any entry stays inside it.
+struct SrgbTables {
+    uint32_t to_linear[256];
+    uint8_t to_srgb[65536 + 3];
+    SrgbTables() : to_srgb() {
+        for(int i = 0; i < 256; ++i) {
+            double c = i / 255.0;
+            double l = (c <= 0.04045) ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+            to_linear[i] = (uint32_t)(l * 65535.0 + 0.5);
+        }
+        for(int i = 0; i < 65536; ++i) {
+            double l = i / 65535.0;
+            double c = (l <= 0.0031308) ? l * 12.92 : 1.055 * pow(l, 1.0 / 2.4) - 0.055;
+            to_srgb[i] = (uint8_t)(c * 255.0 + 0.5);
+        }
+    }
+};
+const SrgbTables& GetSrgbTables() {
+    static const SrgbTables tables;
+    return tables;
+}
+
+// Box2x2RowScalar() in linear light: color channels are decoded from sRGB,
+// averaged and re-encoded; alpha is averaged as is.
+int Box2x2RowLinearScalar(const uint8_t* top, const uint8_t* bottom, uint8_t* dst, int dst_width) {
+    const SrgbTables& srgb = GetSrgbTables();
+    for(int x = 0; x < dst_width; ++x) {
+        const uint8_t* t = top + x * 8;
+        const uint8_t* b = bottom + x * 8;
+        for(int c = 0; c < 3; ++c) {
+            uint32_t sum = srgb.to_linear[t[c]] + srgb.to_linear[t[c + 4]] +
+                    srgb.to_linear[b[c]] + srgb.to_linear[b[c + 4]];
+            dst[x * 4 + c] = srgb.to_srgb[(sum + 2) >> 2];
+        }
+        dst[x * 4 + 3] = (uint8_t)((t[3] + t[7] + b[3] + b[7] + 2) >> 2);
+    }
+    return dst_width;
+}
+
+#if defined(IMG2KTX_X86)
+// 2 output pixels per iteration, one 32-bit lane per channel. Even and odd
+// source pixels are split apart so horizontal neighbours share lanes; color
+// lanes go through the tables with gathers and alpha lanes (3 and 7) bypass
+// them.
+IMG2KTX_TARGET("avx2")
+int Box2x2RowLinearAvx2(const uint8_t* top, const uint8_t* bottom, uint8_t* dst, int dst_width) {
+    const SrgbTables& srgb = GetSrgbTables();
+    const int* to_linear = (const int*)srgb.to_linear;
+    const int* to_srgb = (const int*)srgb.to_srgb;
+    const __m256i two = _mm256_set1_epi32(2);
+    const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+    int x = 0;
+    for(; x + 2 <= dst_width; x += 2) {
+        // px 0,2,1,3 of the four source pixels in each row
+        __m128i t = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(top + x * 8)), _MM_SHUFFLE(3, 1, 2, 0));
+        __m128i b = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(bottom + x * 8)), _MM_SHUFFLE(3, 1, 2, 0));
+        __m256i te = _mm256_cvtepu8_epi32(t);
+        __m256i to = _mm256_cvtepu8_epi32(_mm_srli_si128(t, 8));
+        __m256i be = _mm256_cvtepu8_epi32(b);
+        __m256i bo = _mm256_cvtepu8_epi32(_mm_srli_si128(b, 8));
+        __m256i alpha = _mm256_add_epi32(_mm256_add_epi32(te, to), _mm256_add_epi32(be, bo));
+        __m256i sum = _mm256_add_epi32(
+                _mm256_add_epi32(_mm256_i32gather_epi32(to_linear, te, 4), _mm256_i32gather_epi32(to_linear, to, 4)),
+                _mm256_add_epi32(_mm256_i32gather_epi32(to_linear, be, 4), _mm256_i32gather_epi32(to_linear, bo, 4)));
+        __m256i color = _mm256_and_si256(
+                _mm256_i32gather_epi32(to_srgb, _mm256_srli_epi32(_mm256_add_epi32(sum, two), 2), 1), byte_mask);
+        __m256i out = _mm256_blend_epi32(color, _mm256_srli_epi32(_mm256_add_epi32(alpha, two), 2), 0x88);
+        __m256i packed = _mm256_packus_epi16(_mm256_packus_epi32(out, out), _mm256_setzero_si256());
+        __m128i pixels = _mm_unpacklo_epi32(_mm256_castsi256_si128(packed), _mm256_extracti128_si256(packed, 1));
+        _mm_storel_epi64((__m128i*)(dst + x * 4), pixels);
+    }
+    return x;
+}
+#endif  // IMG2KTX_X86
+
+// No gathers on SSE2 or NEON, and the table lookups are the whole cost, so
+// they use the scalar kernel.
+Box2x2RowFunc SelectBox2x2RowLinear() {
+#if defined(IMG2KTX_X86)
+    if (GetCpuFeatures().avx2) {
+        return Box2x2RowLinearAvx2;
+    }
+#endif
+    return Box2x2RowLinearScalar;
+}
+
+// Averages step_x x step_y blocks of pixels (each step is 1 or 2), for the
+// degenerate 1-pixel-wide/tall levels.
+void BoxDownsampleGeneric(const uint8_t* src, int src_stride, uint8_t* dst, int dst_width, int dst_height,
+        int dst_stride, int step_x, int step_y, bool linear_light) {
+    const int count = step_x * step_y;
+    const SrgbTables* srgb = linear_light ? &GetSrgbTables() : nullptr;
+    for(int y = 0; y < dst_height; ++y) {
+        const uint8_t* rows[2] = { src + (size_t)(y * step_y) * src_stride,
+            src + (size_t)(y * step_y + step_y - 1) * src_stride };
+        uint8_t* out = dst + (size_t)y * dst_stride;
+        for(int x = 0; x < dst_width; ++x) {
+            for(int c = 0; c < 4; ++c) {
+                uint32_t sum = 0;
+                for(int sy = 0; sy < step_y; ++sy) {
+                    for(int sx = 0; sx < step_x; ++sx) {
+                        uint8_t v = rows[sy][(x * step_x + sx) * 4 + c];
+                        sum += (srgb && c < 3) ? srgb->to_linear[v] : v;
+                    }
+                }
+                uint32_t avg = (sum + count / 2) / count;
+                out[x * 4 + c] = (srgb && c < 3) ? srgb->to_srgb[avg] : (uint8_t)avg;
+            }
+        }
+    }
+}
+
+}  // namespace
+
+const char* ResizeFilterName(ResizeFilter filter) {
+    return kResizeFilterNames[filter];
+}
+
+bool ParseResizeFilter(const char* name, ResizeFilter* filter) {
+    for(int f = 0; f < kResizeFilterCount; ++f) {
+        if (strcmp(name, kResizeFilterNames[f]) == 0) {
+            *filter = (ResizeFilter)f;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ResizeImage(const uint8_t* src, int src_width, int src_height, size_t src_stride,
+        uint8_t* dst, int dst_width, int dst_height, size_t dst_stride,
+        ResizeFilter filter, WorkerPool& pool) {
+    // The same scale stbir_resize_uint8() derives, and a whole-pixel shift to
+    // each strip's first row, so every output pixel is sampled exactly as it
+    // would be by a single call. Edges clamp, as stbir_resize_uint8()'s do.
+    const float x_scale = (float)dst_width / src_width;
+    const float y_scale = (float)dst_height / src_height;
+    const stbir_filter stbir_filter_kind = kResizeStbirFilters[filter];
+    TaskGroup tasks;
+    for(int y0 = 0; y0 < dst_height; y0 += kResizeStripRows) {
+        const int rows = std::min(kResizeStripRows, dst_height - y0);
+        pool.Submit([=]() {
+            stbir_resize_subpixel(src, src_width, src_height, (int)src_stride,
+                    dst + (size_t)y0 * dst_stride, dst_width, rows, (int)dst_stride,
+                    STBIR_TYPE_UINT8, 4, STBIR_ALPHA_CHANNEL_NONE, 0, STBIR_EDGE_CLAMP, STBIR_EDGE_CLAMP,
+                    stbir_filter_kind, stbir_filter_kind, STBIR_COLORSPACE_LINEAR, nullptr,
+                    x_scale, y_scale, 0.0f, (float)y0);
+        }, &tasks);
+    }
+    pool.Wait(tasks);
+}
+
+void DownsampleMip(const uint8_t* src, int src_width, int src_height, int src_stride,
+        uint8_t* dst, int dst_width, int dst_height, int dst_stride,
+        MipFilter filter, bool linear_light) {
+    const bool halves_x = (src_width == dst_width * 2) || (src_width == 1 && dst_width == 1);
+    const bool halves_y = (src_height == dst_height * 2) || (src_height == 1 && dst_height == 1);
+    if (filter != kMipFilterBox || !halves_x || !halves_y) {
+        if (linear_light) {
+            // Color is not weighted by alpha, matching the box kernels.
+            stbir_resize_uint8_srgb(src, src_width, src_height, src_stride,
+                    dst, dst_width, dst_height, dst_stride, 4, 3, STBIR_FLAG_ALPHA_PREMULTIPLIED);
+        } else {
+            stbir_resize_uint8(src, src_width, src_height, src_stride,
+                    dst, dst_width, dst_height, dst_stride, 4);
+        }
+        return;
+    }
+    const int step_x = src_width / dst_width;
+    const int step_y = src_height / dst_height;
+    if (step_x != 2 || step_y != 2) {
+        BoxDownsampleGeneric(src, src_stride, dst, dst_width, dst_height, dst_stride,
+                step_x, step_y, linear_light);
+        return;
+    }
+    static const Box2x2RowFunc box_2x2_row = SelectBox2x2Row();
+    static const Box2x2RowFunc box_2x2_row_linear = SelectBox2x2RowLinear();
+    const Box2x2RowFunc row_kernel = linear_light ? box_2x2_row_linear : box_2x2_row;
+    const Box2x2RowFunc tail_kernel = linear_light ? Box2x2RowLinearScalar : Box2x2RowScalar;
+    for(int y = 0; y < dst_height; ++y) {
+        const uint8_t* top = src + (size_t)(2 * y) * src_stride;
+        const uint8_t* bottom = top + src_stride;
+        uint8_t* out = dst + (size_t)y * dst_stride;
+        int done = row_kernel(top, bottom, out, dst_width);
+        tail_kernel(top + done * 8, bottom + done * 8, out + done * 4, dst_width - done);
+    }
+}
+
+void DownsampleRowGroup(const uint8_t* rows, int row_count, int src_width,
+        uint8_t* dst, int dst_width, bool linear_light) {
+    const size_t src_stride = (size_t)src_width * 4;
+    if ((row_count == 2 || row_count == 1) && (src_width == dst_width * 2 || (src_width == 1 && dst_width == 1))) {
+        // Exact halving: same kernels, same results as DownsampleMip().
+        DownsampleMip(rows, src_width, row_count, (int)src_stride, dst, dst_width, 1, dst_width * 4,
+                kMipFilterBox, linear_light);
+        return;
+    }
+    const SrgbTables* srgb = linear_light ? &GetSrgbTables() : nullptr;
+    for(int x = 0; x < dst_width; ++x) {
+        // The last output column also covers the leftover column of an odd width.
+        const int x0 = std::min(2 * x, src_width - 1);
+        const int x1 = (x + 1 < dst_width) ? x0 + 1 : src_width - 1;
+        const uint32_t count = (uint32_t)(x1 - x0 + 1) * row_count;
+        for(int c = 0; c < 4; ++c) {
+            uint32_t sum = 0;
+            for(int r = 0; r < row_count; ++r) {
+                for(int sx = x0; sx <= x1; ++sx) {
+                    uint8_t v = rows[r * src_stride + sx * 4 + c];
+                    sum += (srgb && c < 3) ? srgb->to_linear[v] : v;
+                }
+            }
+            uint32_t avg = (sum + count / 2) / count;
+            dst[x * 4 + c] = (srgb && c < 3) ? srgb->to_srgb[avg] : (uint8_t)avg;
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class WorkerPool;
+
+enum MipFilter {
+    kMipFilterBox,  // 2x2 box filter for exact halvings; stb_image_resize for other sizes
+    kMipFilterStb,  // always use stb_image_resize's default (Mitchell) filter
+};
+
+// Filters for resizing the base level (-r), as named by --resize-filter. The
+// default is stb_image_resize's own choice: Catmull-Rom when enlarging,
+// Mitchell when shrinking.
+enum ResizeFilter {
+    kResizeFilterDefault,
+    kResizeFilterBox,
+    kResizeFilterTriangle,
+    kResizeFilterCubicBSpline,
+    kResizeFilterCatmullRom,
+    kResizeFilterMitchell,
+    kResizeFilterCount,
+};
+
+const char* ResizeFilterName(ResizeFilter filter);
+bool ParseResizeFilter(const char* name, ResizeFilter* filter);
+
+// Resizes an RGBA8 image on pool, one strip of output rows per task, straight
+// into dst (which may have any row stride, e.g. block-padded). Every strip
+// reads the whole source with the same scale, so the output is identical to
+// resizing in one call, for any thread count.
+void ResizeImage(const uint8_t* src, int src_width, int src_height, size_t src_stride,
+        uint8_t* dst, int dst_width, int dst_height, size_t dst_stride,
+        ResizeFilter filter, WorkerPool& pool);
+
+// Generates one RGBA8 mip level from the previous one. src and dst may have
+// any row stride (e.g. block-padded). If linear_light is set, color channels
+// are treated as sRGB and averaged in linear light; alpha is always linear.
+void DownsampleMip(const uint8_t* src, int src_width, int src_height, int src_stride,
+        uint8_t* dst, int dst_width, int dst_height, int dst_stride,
+        MipFilter filter, bool linear_light);
+
+// Box-filters one output row of a level from the 1-3 tightly packed source rows
+// it covers, for callers that see a level a few rows at a time. Output pixel x averages source
+// columns 2x and 2x+1; when a dimension is odd, the last output row/column also
+// takes in the leftover source row/column. For even dimensions this matches
+// DownsampleMip() with kMipFilterBox exactly.
+void DownsampleRowGroup(const uint8_t* rows, int row_count, int src_width,
+        uint8_t* dst, int dst_width, bool linear_light);
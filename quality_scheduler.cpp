@@ -0,0 +1,67 @@
+#include "quality_scheduler.h"
+
+#include "job_stats.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+// Fraction of the remaining time that encoding may use. The rest covers
+// decoding, mip generation, writing and estimation error.
+const double kEncodeTimeShare = 0.85;
+// Weight of each new measurement in the running per-block cost estimate.
+const double kEstimateBlend = 0.25;
+}  // namespace
+
+QualityScheduler::QualityScheduler(double budget_seconds, uint64_t total_blocks, int thread_count)
+    : m_deadline(NowSeconds() + budget_seconds), m_thread_count(std::max(1, thread_count)),
+      m_unscheduled_blocks(total_blocks) {}
+
+void QualityScheduler::Calibrate(const rgba_surface& sample, const GlFormatInfo* format_info,
+        int original_components) {
+    const uint64_t blocks = (uint64_t)(sample.width / format_info->block_dim_x) *
+        (sample.height / format_info->block_dim_y);
+    std::vector<uint8_t> scratch(blocks * format_info->block_bytes);
+    double seconds_per_block[kEncoderQualityCount];
+    for(int q = 0; q < kEncoderQualityCount; ++q) {
+        const double start = NowSeconds();
+        CompressSurface(&sample, scratch.data(), format_info, original_components, (EncoderQuality)q);
+        seconds_per_block[q] = (NowSeconds() - start) / std::max<uint64_t>(blocks, 1);
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(int q = 0; q < kEncoderQualityCount; ++q) {
+        m_seconds_per_block[q] = seconds_per_block[q];
+    }
+}
+
+EncoderQuality QualityScheduler::Choose(uint64_t blocks, double* reserved_seconds) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const double available = std::max(0.0, m_deadline - NowSeconds()) * m_thread_count * kEncodeTimeShare;
+    EncoderQuality chosen = kQualityUltrafast;
+    for(int q = kEncoderQualityCount - 1; q > 0; --q) {
+        if (m_reserved_seconds + m_unscheduled_blocks * m_seconds_per_block[q] <= available) {
+            chosen = (EncoderQuality)q;
+            break;
+        }
+    }
+    blocks = std::min(blocks, m_unscheduled_blocks);
+    m_unscheduled_blocks -= blocks;
+    *reserved_seconds = blocks * m_seconds_per_block[chosen];
+    m_reserved_seconds += *reserved_seconds;
+    return chosen;
+}
+
+void QualityScheduler::Finish(EncoderQuality quality, uint64_t blocks, double reserved_seconds,
+        double encoded_seconds) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_reserved_seconds = std::max(0.0, m_reserved_seconds - reserved_seconds);
+    if (encoded_seconds > 0 && blocks > 0) {
+        double& estimate = m_seconds_per_block[quality];
+        estimate += kEstimateBlend * (encoded_seconds / blocks - estimate);
+    }
+}
+
+void QualityScheduler::Skip(uint64_t blocks) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_unscheduled_blocks -= std::min(blocks, m_unscheduled_blocks);
+}
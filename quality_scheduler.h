@@ -0,0 +1,38 @@
+#pragma once
+
+#include "encoders.h"
+
+#include <cstdint>
+#include <mutex>
+
+// Chooses an EncoderQuality for each mip level so that a whole job finishes
+// within a wall-clock budget (--time-budget). Every choice picks the highest
+// quality at which all the work not yet finished is expected to fit in the
+// time left, so quality adapts as the job runs: it drops if encoding is slower
+// than predicted and rises again if there is time to spare. Predictions start
+// from a calibration run and are refined with measured encode times.
+// Thread-safe.
+class QualityScheduler {
+public:
+    QualityScheduler(double budget_seconds, uint64_t total_blocks, int thread_count);
+
+    // Times every quality on a small padded sample of the input.
+    void Calibrate(const rgba_surface& sample, const GlFormatInfo* format_info, int original_components);
+
+    // Picks the quality for a level of `blocks` blocks and reserves the
+    // estimated time. Pass the returned reservation to Finish().
+    EncoderQuality Choose(uint64_t blocks, double* reserved_seconds);
+    // Releases a reservation. If encoded_seconds > 0 (summed over all threads),
+    // it refines the cost estimate for that quality.
+    void Finish(EncoderQuality quality, uint64_t blocks, double reserved_seconds, double encoded_seconds);
+    // Removes blocks that will never be encoded (e.g. deduplicated layers).
+    void Skip(uint64_t blocks);
+
+private:
+    mutable std::mutex m_mutex;
+    double m_deadline;
+    int m_thread_count;
+    uint64_t m_unscheduled_blocks;
+    double m_reserved_seconds = 0;  // CPU seconds of chosen but unfinished work
+    double m_seconds_per_block[kEncoderQualityCount] = {};  // CPU seconds
+};
@@ -0,0 +1,118 @@
+#include "supercompress.h"
+
+#if defined(IMG2KTX_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+#if defined(IMG2KTX_HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+#include <atomic>
+#include <mutex>
+
+bool SupercompressionAvailable(Ktx2Supercompression scheme) {
+    switch(scheme) {
+    case kKtx2SupercompressionNone:
+        return true;
+#if defined(IMG2KTX_HAVE_ZSTD)
+    case kKtx2SupercompressionZstd:
+        return true;
+#endif
+#if defined(IMG2KTX_HAVE_ZLIB)
+    case kKtx2SupercompressionZlib:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+const char* SupercompressionName(Ktx2Supercompression scheme) {
+    switch(scheme) {
+    case kKtx2SupercompressionZstd: return "zstd";
+    case kKtx2SupercompressionZlib: return "zlib";
+    default: return "none";
+    }
+}
+
+bool Supercompress(Ktx2Supercompression scheme, const uint8_t* src, size_t size, int level,
+        std::vector<uint8_t>* out) {
+    switch(scheme) {
+#if defined(IMG2KTX_HAVE_ZSTD)
+    case kKtx2SupercompressionZstd: {
+        out->resize(ZSTD_compressBound(size));
+        const size_t result = ZSTD_compress(out->data(), out->size(), src, size, level);  // 0 = default level
+        if (ZSTD_isError(result)) {
+            return false;
+        }
+        out->resize(result);
+        return true;
+    }
+#endif
+#if defined(IMG2KTX_HAVE_ZLIB)
+    case kKtx2SupercompressionZlib: {
+        uLongf out_size = compressBound((uLong)size);
+        out->resize(out_size);
+        if (compress2(out->data(), &out_size, src, (uLong)size, level == 0 ? Z_DEFAULT_COMPRESSION : level) != Z_OK) {
+            return false;
+        }
+        out->resize(out_size);
+        return true;
+    }
+#endif
+    default:
+        (void)src; (void)size; (void)level; (void)out;
+        return false;
+    }
+}
+
+bool WriteSupercompressedKtx2(FILE* src, const KtxLayout& uncompressed_layout, const Ktx2Description& desc,
+        int level, WorkerPool& pool, FILE* dst, uint64_t* file_size) {
+    // Each level is one task: read it back from src, compress it. The reads
+    // share src, so they are serialized; the compression runs in parallel.
+    const size_t level_count = uncompressed_layout.mip_sizes.size();
+    std::vector<std::vector<uint8_t>> compressed(level_count);
+    std::vector<uint64_t> uncompressed_lengths(level_count);
+    std::mutex read_mutex;
+    std::atomic<bool> failed(false);
+    TaskGroup tasks;
+    for(size_t mip = 0; mip < level_count; ++mip) {
+        uncompressed_lengths[mip] = (uint64_t)uncompressed_layout.mip_sizes[mip] * uncompressed_layout.layer_count;
+        pool.Submit([&, mip]() {
+            std::vector<uint8_t> level_data((size_t)uncompressed_lengths[mip]);
+            {
+                std::lock_guard<std::mutex> lock(read_mutex);
+                if (SeekOutput(src, uncompressed_layout.DataOffset((int)mip, 0)) != 0 ||
+                        fread(level_data.data(), 1, level_data.size(), src) != level_data.size()) {
+                    failed = true;
+                    return;
+                }
+            }
+            if (!Supercompress(desc.supercompression, level_data.data(), level_data.size(), level,
+                    &compressed[mip])) {
+                failed = true;
+            }
+        }, &tasks);
+    }
+    pool.Wait(tasks);
+    if (failed) {
+        return false;
+    }
+
+    std::vector<uint64_t> level_lengths(level_count);
+    for(size_t mip = 0; mip < level_count; ++mip) {
+        level_lengths[mip] = compressed[mip].size();
+    }
+    const KtxLayout layout = ComputeSupercompressedKtx2Layout(desc, level_lengths, uncompressed_lengths);
+    if (!WriteKtxSkeleton(dst, layout)) {
+        return false;
+    }
+    for(size_t mip = 0; mip < level_count; ++mip) {
+        if (SeekOutput(dst, layout.DataOffset((int)mip, 0)) != 0 ||
+                fwrite(compressed[mip].data(), 1, compressed[mip].size(), dst) != compressed[mip].size()) {
+            return false;
+        }
+    }
+    *file_size = layout.file_size;
+    return fflush(dst) == 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "ktx_file.h"
+#include "worker_pool.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// KTX2 supercompression (zstd / zlib) of whole mip levels. Each library is
+// optional at build time; see SupercompressionAvailable().
+
+// Returns true if img2ktx was built with the library for scheme.
+// kKtx2SupercompressionNone is always available.
+bool SupercompressionAvailable(Ktx2Supercompression scheme);
+const char* SupercompressionName(Ktx2Supercompression scheme);
+
+// Compresses size bytes from src into *out (replacing its contents).
+// level 0 selects the library's default. Returns false on failure.
+bool Supercompress(Ktx2Supercompression scheme, const uint8_t* src, size_t size, int level,
+        std::vector<uint8_t>* out);
+
+// Copies the KTX2 file in src, laid out by ComputeKtx2Layout(desc, ...) as
+// uncompressed_layout, into dst with every level supercompressed using
+// desc.supercompression. Levels are compressed in parallel as tasks on pool.
+// On success, stores the size of the new file in *file_size.
+bool WriteSupercompressedKtx2(FILE* src, const KtxLayout& uncompressed_layout, const Ktx2Description& desc,
+        int level, WorkerPool& pool, FILE* dst, uint64_t* file_size);
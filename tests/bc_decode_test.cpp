@@ -0,0 +1,130 @@
+// Decodes hand-built BC1-BC5 blocks with DecodeBcBlocks() and checks every
+// pixel against values worked out from the block layouts, so the reference
+// decoder the bench's PSNR check relies on is itself checked independently of
+// the encoders.
+#include "bc_encoder.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+int g_failures = 0;
+
+// Decodes one block and compares it with expected, 16 RGBA pixels in
+// row-major order.
+void CheckBlock(const char* name, const uint8_t* block, BcFormat format, const uint8_t (*expected)[4]) {
+    uint8_t decoded[16][4];
+    memset(decoded, 0xCD, sizeof(decoded));
+    DecodeBcBlocks(block, 1, 1, format, decoded[0], 16);
+    for(int p = 0; p < 16; ++p) {
+        if (memcmp(decoded[p], expected[p], 4) != 0) {
+            fprintf(stderr, "FAIL %s: pixel %d is (%d,%d,%d,%d), expected (%d,%d,%d,%d)\n", name, p,
+                    decoded[p][0], decoded[p][1], decoded[p][2], decoded[p][3],
+                    expected[p][0], expected[p][1], expected[p][2], expected[p][3]);
+            g_failures += 1;
+            return;
+        }
+    }
+}
+
+// Color block with endpoints c0 and c1 (RGB565) whose pixel p uses index p % 4.
+void MakeColorBlock(uint8_t* block, uint16_t c0, uint16_t c1) {
+    block[0] = (uint8_t)c0;
+    block[1] = (uint8_t)(c0 >> 8);
+    block[2] = (uint8_t)c1;
+    block[3] = (uint8_t)(c1 >> 8);
+    memset(block + 4, 0xE4, 4);  // indices 0,1,2,3 in every row
+}
+
+// Channel block with endpoints a0 and a1 whose pixel p uses index p % 8.
+void MakeChannelBlock(uint8_t* block, uint8_t a0, uint8_t a1) {
+    static const uint8_t kIndices[6] = { 0x88, 0xC6, 0xFA, 0x88, 0xC6, 0xFA };  // 0..7, twice
+    block[0] = a0;
+    block[1] = a1;
+    memcpy(block + 2, kIndices, sizeof(kIndices));
+}
+
+const uint16_t kRed565 = 0xF800, kBlue565 = 0x001F, kPurple565 = 0x081F;  // (255,0,0), (0,0,255), (8,0,255)
+
+// c0 > c1: four colors, thirds rounded to nearest.
+const uint8_t kFourColors[4][4] = { {255, 0, 0, 255}, {8, 0, 255, 255}, {173, 0, 85, 255}, {90, 0, 170, 255} };
+// c0 <= c1: three colors and black, which BC1a makes transparent.
+const uint8_t kThreeColors[4][4] = { {0, 0, 255, 255}, {255, 0, 0, 255}, {128, 0, 128, 255}, {0, 0, 0, 255} };
+const uint8_t kPunchThrough[4][4] = { {0, 0, 255, 255}, {255, 0, 0, 255}, {128, 0, 128, 255}, {0, 0, 0, 0} };
+// a0 = 201 > a1 = 60: six interpolated values in sevenths.
+const uint8_t kEightValues[8] = { 201, 60, 181, 161, 141, 120, 100, 80 };
+// a0 = 41 <= a1 = 240: four interpolated values in fifths, then 0 and 255.
+const uint8_t kSixValues[8] = { 41, 240, 81, 121, 160, 200, 0, 255 };
+
+void TestBc1() {
+    uint8_t block[8];
+    uint8_t expected[16][4];
+    MakeColorBlock(block, kRed565, kPurple565);
+    for(int p = 0; p < 16; ++p) {
+        memcpy(expected[p], kFourColors[p % 4], 4);
+    }
+    CheckBlock("BC1 four colors", block, kBcFormatBC1, expected);
+    CheckBlock("BC1a four colors", block, kBcFormatBC1a, expected);
+
+    MakeColorBlock(block, kBlue565, kRed565);
+    for(int p = 0; p < 16; ++p) {
+        memcpy(expected[p], kThreeColors[p % 4], 4);
+    }
+    CheckBlock("BC1 three colors", block, kBcFormatBC1, expected);
+    for(int p = 0; p < 16; ++p) {
+        memcpy(expected[p], kPunchThrough[p % 4], 4);
+    }
+    CheckBlock("BC1a punch-through", block, kBcFormatBC1a, expected);
+}
+
+void TestBc3() {
+    uint8_t block[16];
+    uint8_t expected[16][4];
+    MakeChannelBlock(block, 41, 240);
+    MakeColorBlock(block + 8, kBlue565, kRed565);  // BC3 color never has transparent black
+    for(int p = 0; p < 16; ++p) {
+        memcpy(expected[p], kThreeColors[p % 4], 3);
+        expected[p][3] = kSixValues[p % 8];
+    }
+    CheckBlock("BC3", block, kBcFormatBC3, expected);
+}
+
+void TestBc4Bc5() {
+    uint8_t block[16];
+    uint8_t expected[16][4];
+    MakeChannelBlock(block, 201, 60);
+    for(int p = 0; p < 16; ++p) {
+        const uint8_t pixel[4] = { kEightValues[p % 8], 0, 0, 255 };
+        memcpy(expected[p], pixel, 4);
+    }
+    CheckBlock("BC4 eight values", block, kBcFormatBC4, expected);
+
+    MakeChannelBlock(block, 41, 240);
+    for(int p = 0; p < 16; ++p) {
+        expected[p][0] = kSixValues[p % 8];
+    }
+    CheckBlock("BC4 six values", block, kBcFormatBC4, expected);
+
+    MakeChannelBlock(block, 201, 60);
+    MakeChannelBlock(block + 8, 41, 240);
+    for(int p = 0; p < 16; ++p) {
+        const uint8_t pixel[4] = { kEightValues[p % 8], kSixValues[p % 8], 0, 255 };
+        memcpy(expected[p], pixel, 4);
+    }
+    CheckBlock("BC5", block, kBcFormatBC5, expected);
+}
+
+}  // namespace
+
+int main() {
+    TestBc1();
+    TestBc3();
+    TestBc4Bc5();
+    if (g_failures > 0) {
+        fprintf(stderr, "%d block(s) decoded incorrectly.\n", g_failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,286 @@
+#include "tiled_convert.h"
+
+#include "mip_downsample.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace {
+
+// Pixels per band, before it is handed to the encoder (which splits it into
+// strips for the worker threads).
+const int kTiledBandTargetPixels = 256 * 1024;
+
+// Input rows are dropped from memory in batches of this many, once read.
+const int kTiledDiscardRows = 256;
+
+// Limits the bands allocated but not yet compressed, across all levels.
+struct BandBudget {
+    std::mutex mutex;
+    int in_flight = 0;
+    int max_in_flight = 1;
+};
+
+// One mip level, fed a row at a time. Rows are collected into a band of whole
+// block rows, which is compressed once full; each group of rows that makes up
+// one row of the next level is downsampled and pushed to that level. A level
+// whose padded pixels are already in memory (source) is compressed from there
+// in bands of the same size, without copying.
+class TiledLevel {
+public:
+    TiledLevel(const TiledLayerSettings& settings, int mip, int width, int height, TiledLevel* next,
+            WorkerPool& pool, TaskGroup* tasks, BandBudget* budget,
+            const uint8_t* source = nullptr, size_t source_pitch = 0)
+        : m_settings(settings), m_mip(mip), m_width(width), m_height(height), m_next(next),
+          m_pool(pool), m_tasks(tasks), m_budget(budget), m_source(source), m_source_pitch(source_pitch) {
+        const GlFormatInfo* format_info = settings.format_info;
+        m_pitch_x = ((width + format_info->block_dim_x - 1) / format_info->block_dim_x) * format_info->block_dim_x;
+        const int block_rows_per_band = std::max(1,
+                kTiledBandTargetPixels / (m_pitch_x * (int)format_info->block_dim_y));
+        m_band_rows = block_rows_per_band * format_info->block_dim_y;
+        if (m_next) {
+            m_group.resize((size_t)3 * width * 4);
+            m_next_row.resize((size_t)m_next->m_width * 4);
+        }
+    }
+
+    void PushRow(const uint8_t* rgba) {
+        uint8_t* dst = nullptr;
+        if (!m_source) {
+            if (!m_band) {
+                StartBand();
+            }
+            dst = m_band->data() + (size_t)(m_row - m_band_first_row) * m_pitch_x * 4;
+            memcpy(dst, rgba, (size_t)m_width * 4);
+            for(int x = m_width; x < m_pitch_x; ++x) {
+                memcpy(dst + x * 4, rgba + (m_width - 1) * 4, 4);  // replicate the right edge
+            }
+        }
+        if (m_next) {
+            FeedNextLevel(rgba);
+        }
+        m_row += 1;
+        if (m_row == m_height) {
+            // Replicate the bottom edge into the rest of the last block row
+            // (a source is padded already).
+            const int block_dim_y = m_settings.format_info->block_dim_y;
+            const int rows = m_row - m_band_first_row;
+            const int padded_rows = ((rows + block_dim_y - 1) / block_dim_y) * block_dim_y;
+            for(int y = rows; dst && y < padded_rows; ++y) {
+                memcpy(m_band->data() + (size_t)y * m_pitch_x * 4, dst, (size_t)m_pitch_x * 4);
+            }
+            SubmitBand(padded_rows);
+        } else if (m_row - m_band_first_row == m_band_rows) {
+            SubmitBand(m_band_rows);
+        }
+    }
+
+private:
+    void StartBand() {
+        // While waiting for a band to be released, run pool tasks so that
+        // this thread is never idle while work is queued.
+        BandBudget* budget = m_budget;
+        m_pool.HelpUntil([budget]() {
+            std::lock_guard<std::mutex> lock(budget->mutex);
+            return budget->in_flight < budget->max_in_flight;
+        });
+        {
+            std::lock_guard<std::mutex> lock(m_budget->mutex);
+            m_budget->in_flight += 1;
+        }
+        m_band = std::make_shared<PixelBuffer>();
+        m_band->Allocate((size_t)m_pitch_x * m_band_rows * 4, m_settings.buffers, m_settings.buffer_usage);
+        m_band_first_row = m_row;
+    }
+
+    void SubmitBand(int rows) {
+        const GlFormatInfo* format_info = m_settings.format_info;
+        const size_t block_row_bytes = (size_t)(m_pitch_x / format_info->block_dim_x) * format_info->block_bytes;
+        uint8_t* dst = m_settings.mip_outputs[m_mip] + (size_t)(m_band_first_row / format_info->block_dim_y)
+            * block_row_bytes;
+        auto* compress_nanoseconds = m_settings.compress_nanoseconds.empty() ? nullptr
+            : m_settings.compress_nanoseconds[m_mip];
+        if (m_source) {
+            rgba_surface surface = { const_cast<uint8_t*>(m_source) + (size_t)m_band_first_row * m_source_pitch,
+                m_pitch_x, rows, (int)m_source_pitch };
+            SubmitCompressSurface(m_pool, surface, dst, format_info, m_settings.original_components,
+                    m_settings.quality, m_tasks, nullptr, compress_nanoseconds);
+            m_band_first_row = m_row;
+            return;
+        }
+        rgba_surface surface = { m_band->data(), m_pitch_x, rows, m_pitch_x * 4 };
+        std::shared_ptr<PixelBuffer> band = std::move(m_band);
+        BandBudget* budget = m_budget;
+        WorkerPool* pool = &m_pool;
+        SubmitCompressSurface(m_pool, surface, dst, format_info, m_settings.original_components,
+                m_settings.quality, m_tasks, [band, budget, pool]() {
+            band->Reset();
+            {
+                std::lock_guard<std::mutex> lock(budget->mutex);
+                budget->in_flight -= 1;
+            }
+            pool->Notify();  // wakes StartBand()'s HelpUntil()
+        }, compress_nanoseconds);
+    }
+
+    void FeedNextLevel(const uint8_t* rgba) {
+        memcpy(m_group.data() + (size_t)m_group_rows * m_width * 4, rgba, (size_t)m_width * 4);
+        m_group_rows += 1;
+        // Each row of the next level covers two rows of this one; the last row
+        // also covers the leftover row of an odd height.
+        const int next_y = m_next->m_row;
+        const int group_end = (next_y + 1 < m_next->m_height) ? 2 * next_y + 1 : m_height - 1;
+        if (m_row == group_end) {
+            DownsampleRowGroup(m_group.data(), m_group_rows, m_width,
+                    m_next_row.data(), m_next->m_width, m_settings.linear_mips);
+            m_group_rows = 0;
+            m_next->PushRow(m_next_row.data());
+        }
+    }
+
+    const TiledLayerSettings& m_settings;
+    const int m_mip;
+    const int m_width, m_height;
+    TiledLevel* const m_next;  // null at the last level
+    WorkerPool& m_pool;
+    TaskGroup* const m_tasks;
+    BandBudget* const m_budget;
+    const uint8_t* const m_source;  // null unless the level is already in memory
+    const size_t m_source_pitch;
+    int m_pitch_x = 0;  // padded to the block width
+    int m_band_rows = 0;  // a multiple of the block height
+    int m_row = 0;  // rows received so far
+    int m_band_first_row = 0;
+    std::shared_ptr<PixelBuffer> m_band;  // null between bands
+    std::vector<uint8_t> m_group;  // up to 3 rows waiting to be downsampled
+    int m_group_rows = 0;
+    std::vector<uint8_t> m_next_row;
+};
+
+}  // namespace
+
+bool PnmImage::Open(const std::string& filename) {
+    if (!m_file.Open(filename)) {
+        return false;
+    }
+    const uint8_t* data = m_file.data();
+    const uint64_t size = m_file.size();
+    if (size < 2 || data[0] != 'P' || (data[1] != '5' && data[1] != '6')) {
+        return false;
+    }
+    // Header: magic, width, height, maxval, separated by whitespace and
+    // #-comments, then a single whitespace byte before the pixels.
+    uint64_t pos = 2;
+    long long fields[3] = {};
+    for(int f = 0; f < 3; ++f) {
+        for(;;) {
+            while (pos < size && isspace(data[pos])) {
+                ++pos;
+            }
+            if (pos < size && data[pos] == '#') {
+                while (pos < size && data[pos] != '\n') {
+                    ++pos;
+                }
+                continue;
+            }
+            break;
+        }
+        if (pos >= size || !isdigit(data[pos])) {
+            return false;
+        }
+        while (pos < size && isdigit(data[pos]) && fields[f] < (1LL << 31)) {
+            fields[f] = fields[f] * 10 + (data[pos++] - '0');
+        }
+    }
+    if (pos >= size || !isspace(data[pos]) || fields[0] < 1 || fields[1] < 1 ||
+            fields[0] >= (1LL << 31) || fields[1] >= (1LL << 31) || fields[2] != 255) {
+        return false;
+    }
+    pos += 1;
+    m_width = (int)fields[0];
+    m_height = (int)fields[1];
+    m_components = (data[1] == '5') ? 1 : 3;
+    if (size - pos < (uint64_t)m_width * m_height * m_components) {
+        return false;
+    }
+    m_pixels = data + pos;
+    m_pixels_offset = pos;
+    return true;
+}
+
+void PnmImage::ReadRowRgba(int y, uint8_t* dst) const {
+    const uint8_t* src = m_pixels + (size_t)y * m_width * m_components;
+    if (m_components == 3) {
+        for(int x = 0; x < m_width; ++x) {
+            dst[x * 4 + 0] = src[x * 3 + 0];
+            dst[x * 4 + 1] = src[x * 3 + 1];
+            dst[x * 4 + 2] = src[x * 3 + 2];
+            dst[x * 4 + 3] = 255;
+        }
+    } else {
+        for(int x = 0; x < m_width; ++x) {
+            dst[x * 4 + 0] = dst[x * 4 + 1] = dst[x * 4 + 2] = src[x];
+            dst[x * 4 + 3] = 255;
+        }
+    }
+}
+
+void PnmImage::DiscardRowsBefore(int y) {
+    m_file.Discard(m_pixels_offset, (uint64_t)y * m_width * m_components);
+}
+
+namespace {
+
+// Feeds the rows returned by read_row(y), in order, through every level of
+// settings. If level0 is set, it holds those rows already padded to whole
+// blocks (row pitch level0_pitch), and level 0 is compressed from there.
+void CompressTiledRows(int width, int height, const TiledLayerSettings& settings, WorkerPool& pool,
+        const std::function<const uint8_t*(int y)>& read_row, const uint8_t* level0 = nullptr,
+        size_t level0_pitch = 0) {
+    BandBudget budget;
+    // Every level may hold one partly filled band while a deeper level waits
+    // for a new one, so the limit must leave room for one more than that.
+    budget.max_in_flight = std::max(settings.max_bands_in_flight, settings.mip_levels + 1);
+    TaskGroup tasks;
+    std::vector<int> widths(settings.mip_levels), heights(settings.mip_levels);
+    widths[0] = width;
+    heights[0] = height;
+    for(int mip = 1; mip < settings.mip_levels; ++mip) {
+        widths[mip] = std::max(1, widths[mip - 1] / 2);
+        heights[mip] = std::max(1, heights[mip - 1] / 2);
+    }
+    std::vector<std::unique_ptr<TiledLevel>> levels(settings.mip_levels);
+    for(int mip = settings.mip_levels - 1; mip >= 0; --mip) {
+        TiledLevel* next = (mip + 1 < settings.mip_levels) ? levels[mip + 1].get() : nullptr;
+        levels[mip].reset(new TiledLevel(settings, mip, widths[mip], heights[mip], next, pool, &tasks, &budget,
+                mip == 0 ? level0 : nullptr, level0_pitch));
+    }
+    for(int y = 0; y < height; ++y) {
+        levels[0]->PushRow(read_row(y));
+    }
+    pool.Wait(tasks);
+}
+
+}  // namespace
+
+void CompressTiledLayer(PnmImage& image, const TiledLayerSettings& settings, WorkerPool& pool) {
+    std::vector<uint8_t> row((size_t)image.Width() * 4);
+    CompressTiledRows(image.Width(), image.Height(), settings, pool, [&](int y) {
+        image.ReadRowRgba(y, row.data());
+        if (y > 0 && y % kTiledDiscardRows == 0) {
+            image.DiscardRowsBefore(y);
+        }
+        return (const uint8_t*)row.data();
+    });
+}
+
+void CompressTiledLayer(const uint8_t* pixels, int width, int height, size_t row_pitch,
+        const TiledLayerSettings& settings, WorkerPool& pool) {
+    CompressTiledRows(width, height, settings, pool, [&](int y) {
+        return pixels + (size_t)y * row_pitch;
+    }, pixels, row_pitch);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "buffer_pool.h"
+#include "encoders.h"
+#include "mapped_file.h"
+#include "worker_pool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Tiled conversion (--tiled) of images too large to decode into memory at
+// once. The input is read in place through a memory-mapped file, a band of
+// block rows at a time; each band is padded, compressed straight into its
+// final place in the output, and box-filtered into the next mip level's band.
+// Memory use grows with the image width, not its height.
+//
+// Images already in memory (--fused) take the same path, so that each band of
+// every level is compressed and downsampled into the next level while it is
+// still in cache, instead of each level being written out whole and read back.
+
+// A binary PGM or PPM image (P5 or P6, maxval 255) read in place. Rows of
+// these can be read without decoding the rest of the file; stb_image needs
+// the whole image in memory for every other format.
+class PnmImage {
+public:
+    // Returns false if filename cannot be mapped or is not a supported PNM file.
+    bool Open(const std::string& filename);
+
+    int Width() const { return m_width; }
+    int Height() const { return m_height; }
+    int Components() const { return m_components; }  // 1 (gray) or 3 (RGB)
+    // Converts row y to RGBA (alpha = 255, gray replicated like stb_image does).
+    void ReadRowRgba(int y, uint8_t* dst) const;
+    // Rows before y will not be read again; drops them from memory.
+    void DiscardRowsBefore(int y);
+
+private:
+    MappedFile m_file;
+    const uint8_t* m_pixels = nullptr;
+    uint64_t m_pixels_offset = 0;  // of m_pixels in the file
+    int m_width = 0, m_height = 0, m_components = 0;
+};
+
+struct TiledLayerSettings {
+    const GlFormatInfo* format_info;
+    int original_components;
+    EncoderQuality quality;
+    bool linear_mips;
+    int mip_levels;
+    std::vector<uint8_t*> mip_outputs;  // final location of each compressed level
+    std::vector<std::atomic<uint64_t>*> compress_nanoseconds;  // per level, may be null
+    int max_bands_in_flight;  // bands allocated but not yet compressed, across all levels
+    BufferPool* buffers;
+    BufferUsage* buffer_usage;  // counts the band buffers, may be null
+};
+
+// Converts one layer into every mip level of settings, running compression on
+// pool. Returns once every band is compressed.
+void CompressTiledLayer(PnmImage& image, const TiledLayerSettings& settings, WorkerPool& pool);
+// Same, for width x height RGBA pixels in memory with rows row_pitch bytes
+// apart, already padded to whole blocks (see PadSurfaceEdges()). Level 0 is
+// compressed in place; only the smaller levels are built in bands.
+void CompressTiledLayer(const uint8_t* pixels, int width, int height, size_t row_pitch,
+        const TiledLayerSettings& settings, WorkerPool& pool);
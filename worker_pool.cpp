@@ -0,0 +1,107 @@
+#include "worker_pool.h"
+
+WorkerPool::WorkerPool(int thread_count, int caller_threads)
+    : m_thread_count(thread_count) {
+    for(int i = caller_threads; i < thread_count; ++i) {
+        m_threads.emplace_back(&WorkerPool::WorkerMain, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shutdown = true;
+    }
+    m_task_ready.notify_all();
+    for(auto& t : m_threads) {
+        t.join();
+    }
+}
+
+int WorkerPool::DefaultThreadCount() {
+    unsigned int n = std::thread::hardware_concurrency();
+    return (n > 0) ? (int)n : 1;
+}
+
+void WorkerPool::Submit(std::function<void()> task, TaskGroup* group) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(Task{std::move(task), group});
+        if (group) {
+            group->m_pending += 1;
+        }
+    }
+    m_task_ready.notify_one();
+    m_idle.notify_all();  // lets threads blocked in WaitIdle(), Wait() or HelpUntil() pick up the new task
+}
+
+void WorkerPool::RunOne(std::unique_lock<std::mutex>& lock) {
+    Task task = std::move(m_tasks.front());
+    m_tasks.pop_front();
+    m_active += 1;
+    lock.unlock();
+    task.func();
+    lock.lock();
+    m_active -= 1;
+    if (task.group) {
+        task.group->m_pending -= 1;
+        if (task.group->m_pending == 0) {
+            m_idle.notify_all();
+        }
+    }
+    if (m_active == 0 && m_tasks.empty()) {
+        m_idle.notify_all();
+    }
+}
+
+void WorkerPool::WorkerMain() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for(;;) {
+        m_task_ready.wait(lock, [this]{ return m_shutdown || !m_tasks.empty(); });
+        if (m_tasks.empty()) {
+            return;  // shutting down
+        }
+        RunOne(lock);
+    }
+}
+
+void WorkerPool::WaitIdle() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for(;;) {
+        if (!m_tasks.empty()) {
+            RunOne(lock);
+        } else if (m_active > 0) {
+            // Wake up when the last task finishes, or when a running task submits more work.
+            m_idle.wait(lock, [this]{ return m_active == 0 || !m_tasks.empty(); });
+        } else {
+            return;
+        }
+    }
+}
+
+void WorkerPool::Wait(TaskGroup& group) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (group.m_pending > 0) {
+        if (!m_tasks.empty()) {
+            RunOne(lock);
+        } else {
+            m_idle.wait(lock, [&]{ return group.m_pending == 0 || !m_tasks.empty(); });
+        }
+    }
+}
+
+void WorkerPool::HelpUntil(const std::function<bool()>& done) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!done()) {
+        if (!m_tasks.empty()) {
+            RunOne(lock);
+        } else {
+            m_idle.wait(lock);
+        }
+    }
+}
+
+void WorkerPool::Notify() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_idle.notify_all();
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Tracks the tasks that belong to one unit of work (e.g. one output file), so
+// several of them can share a WorkerPool and each wait only for its own tasks.
+class TaskGroup {
+private:
+    friend class WorkerPool;
+    int m_pending = 0;  // guarded by the owning pool's mutex
+};
+
+// A fixed-size pool of worker threads that run independent tasks in FIFO order.
+// Tasks may submit further tasks. The thread that calls WaitIdle() also runs
+// tasks until the queue drains, so a pool created with thread_count=N uses N-1
+// background threads plus the waiting thread; thread_count=1 runs everything on
+// the caller, in submission order. If several outside threads run tasks while
+// they wait (e.g. --batch job runners), pass their number as caller_threads:
+// the pool then starts only enough background threads to make thread_count.
+class WorkerPool {
+public:
+    explicit WorkerPool(int thread_count, int caller_threads = 1);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    int ThreadCount() const { return m_thread_count; }
+
+    // If group is non-null, the task counts towards that group until it finishes.
+    void Submit(std::function<void()> task, TaskGroup* group = nullptr);
+    // Blocks until every submitted task (including tasks submitted by other
+    // tasks) has finished.
+    void WaitIdle();
+    // Blocks until every task in group has finished. The caller runs queued
+    // tasks from any group while it waits.
+    void Wait(TaskGroup& group);
+    // Runs queued tasks on the calling thread until done() returns true. done
+    // is checked under the pool's lock whenever a task is submitted or a group
+    // finishes, and after every Notify(). Lets a caller thread that has run
+    // out of its own work, or is blocked on something else (e.g. a memory
+    // budget), keep the pool moving.
+    void HelpUntil(const std::function<bool()>& done);
+    // Wakes HelpUntil() callers to check done() again.
+    void Notify();
+
+    // Returns the default pool size for this machine (always >= 1).
+    static int DefaultThreadCount();
+
+private:
+    struct Task {
+        std::function<void()> func;
+        TaskGroup* group;
+    };
+    void WorkerMain();
+    // Pops and runs a single task. Requires m_mutex to be held by lock; returns with it held.
+    void RunOne(std::unique_lock<std::mutex>& lock);
+
+    int m_thread_count;
+    std::vector<std::thread> m_threads;
+    std::deque<Task> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_task_ready;
+    std::condition_variable m_idle;
+    int m_active = 0;  // tasks currently executing
+    bool m_shutdown = false;
+};